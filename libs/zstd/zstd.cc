@@ -27,6 +27,14 @@ namespace zstd {
 		}
 	}
 
+	Buf &Buf::operator=(Buf &&b) {
+		if (this != &b) {
+			swap(data, b.data);
+			swap(len, b.len);
+		}
+		return *this;
+	}
+
 	const char *Buf::getErrorString() const {
 		static const char *error_strings[Count] = {
 			"No Error",                     // None
@@ -39,6 +47,34 @@ namespace zstd {
 	}
 
 
+	Stream::~Stream() {
+		ZSTD_freeDStream((ZSTD_DStream *)ctx);
+		ctx = nullptr;
+	}
+
+	bool Stream::reset() {
+		if (!ctx) {
+			ctx = ZSTD_createDStream();
+			return ctx != nullptr;
+		}
+		return !ZSTD_isError(ZSTD_DCtx_reset((ZSTD_DStream *)ctx, ZSTD_reset_session_only));
+	}
+
+	bool Stream::decompress(const void *in, size_t in_len, size_t &in_pos, void *out, size_t out_len, size_t &out_pos) {
+		if (!ctx) return false;
+
+		ZSTD_inBuffer input = { in, in_len, in_pos };
+		ZSTD_outBuffer output = { out, out_len, out_pos };
+		size_t result = ZSTD_decompressStream((ZSTD_DStream *)ctx, &output, &input);
+		in_pos = input.pos;
+		out_pos = output.pos;
+		return !ZSTD_isError(result);
+	}
+
+	size_t Stream::getInputSize() {
+		return ZSTD_DStreamInSize();
+	}
+
 	Buf compress(const void *buf, size_t buflen, int level) {
 		Buf out;
 		out.len = ZSTD_compressBound(buflen);
@@ -82,4 +118,11 @@ namespace zstd {
 
 		return out;
 	}
+
+	bool decompressInto(const void *buf, size_t buflen, void *out, size_t outlen) {
+		if (ZSTD_getFrameContentSize(buf, buflen) != outlen) {
+			return false;
+		}
+		return ZSTD_decompress(out, outlen, buf, buflen) == outlen;
+	}
 }
@@ -18,6 +18,7 @@ namespace zstd {
 		Buf() = default;
 		~Buf();
 		Buf(Buf &&b);
+		Buf &operator=(Buf &&b);
 
 		void *data = nullptr;
 		size_t len = 0;
@@ -26,6 +27,25 @@ namespace zstd {
 		const char *getErrorString() const;
 	};
 
+	// streaming decompression, so the whole output doesn't need to be in memory
+	struct Stream {
+		Stream() = default;
+		~Stream();
+		Stream(const Stream &s) = delete;
+
+		// has to be called before decompressing, starts again from the beginning of a frame
+		bool reset();
+		// decompresses from in (starting at in_pos) to out (starting at out_pos) until
+		// either one runs out, both positions are moved forward. returns false on error
+		bool decompress(const void *in, size_t in_len, size_t &in_pos, void *out, size_t out_len, size_t &out_pos);
+		// recommended size for the input buffer
+		static size_t getInputSize();
+
+		void *ctx = nullptr;
+	};
+
 	Buf compress(const void *buf, size_t buflen, int level = 0);
 	Buf decompress(const void *buf, size_t buflen);
+	// decompresses straight into out, fails if the frame isn't exactly outlen bytes
+	bool decompressInto(const void *buf, size_t buflen, void *out, size_t outlen);
 }
\ No newline at end of file
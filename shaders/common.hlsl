@@ -33,6 +33,194 @@ float trilinearInterpolation(float3 pos, float3 size, Texture3D<snorm float> tex
     return c0 * rem.z + c1 * delta.z;
 }
 
+// == sparse volume ==================================
+
+// the sculpture is stored in 8x8x8 bricks, see GpuVolume in gpu_volume.h.
+// the table has one entry per brick: bricks where every voxel has the same value
+// have BRICK_UNIFORM set and the value (as 16 bit snorm) in the low bits, the
+// others have where they are in the atlas (in bricks, 10 bits per axis)
+#define BRICK_SIZE 8
+#define BRICK_UNIFORM (1u << 31)
+
+// same as GpuVolume::counters
+#define FREE_BRICKS_COUNTER 0
+#define RELEASED_BRICKS_COUNTER 1
+
+bool isUniformBrick(uint entry) {
+    return (entry & BRICK_UNIFORM) != 0;
+}
+
+float brickUniformValue(uint entry) {
+    // sign extend the 16 bit value, both -32768 and -32767 are -1 like in d3d
+    const int value = int(entry << 16) >> 16;
+    return max(value / 32767., -1);
+}
+
+uint uniformBrickEntry(int value) {
+    return BRICK_UNIFORM | (uint(value) & 0xffff);
+}
+
+int3 brickAtlasPos(uint entry) {
+    return int3(entry & 0x3ff, (entry >> 10) & 0x3ff, (entry >> 20) & 0x3ff) * BRICK_SIZE;
+}
+
+// same as snorm::fromFloat in volume.h, this is what a r16_snorm texture stores
+int snormFromFloat(float value) {
+    value = clamp(value, -1, 1) * 32767;
+    return int(value >= 0 ? value + 0.5 : value - 0.5);
+}
+
+float3 volumeSize(Texture3D<uint> table) {
+    uint3 brick_count = 0;
+    table.GetDimensions(brick_count.x, brick_count.y, brick_count.z);
+    return float3(brick_count * BRICK_SIZE);
+}
+
+// same as Texture3D.Load on a dense volume
+float volumeLoad(int3 pos, Texture3D<uint> table, Texture3D<snorm float> atlas) {
+    const uint entry = table.Load(int4(pos / BRICK_SIZE, 0));
+    if (isUniformBrick(entry)) return brickUniformValue(entry);
+    return atlas.Load(int4(brickAtlasPos(entry) + pos % BRICK_SIZE, 0));
+}
+
+// same as trilinearInterpolation, most of the time the 8 voxels are in
+// the same brick so the table is only read once
+float volumeTrilinear(float3 pos, float3 size, Texture3D<uint> table, Texture3D<snorm float> atlas) {
+    int3 start = max(min(int3(pos), int3(size) - 2), 0);
+    int3 end = start + 1;
+
+    float3 delta = pos - start;
+    float3 rem = 1 - delta;
+
+    // corners at x = start (c0) and x = end (c1), in the order
+    // (y, z) = (start, start), (end, start), (start, end), (end, end)
+    float4 c0, c1;
+    const int3 brick = start / BRICK_SIZE;
+
+    if (all(end / BRICK_SIZE == brick)) {
+        const uint entry = table.Load(int4(brick, 0));
+        if (isUniformBrick(entry)) return brickUniformValue(entry);
+        const int3 base = brickAtlasPos(entry) + start % BRICK_SIZE;
+
+#define map(x, y, z) atlas.Load(int4(base + int3((x), (y), (z)), 0))
+        c0 = float4(map(0, 0, 0), map(0, 1, 0), map(0, 0, 1), map(0, 1, 1));
+        c1 = float4(map(1, 0, 0), map(1, 1, 0), map(1, 0, 1), map(1, 1, 1));
+#undef map
+    }
+    else {
+#define map(x, y, z) volumeLoad(int3((x), (y), (z)), table, atlas)
+        c0 = float4(map(start.x, start.y, start.z), map(start.x, end.y, start.z), map(start.x, start.y, end.z), map(start.x, end.y, end.z));
+        c1 = float4(map(end.x,   start.y, start.z), map(end.x,   end.y, start.z), map(end.x,   start.y, end.z), map(end.x,   end.y, end.z));
+#undef map
+    }
+
+    float4 c = c0 * rem.x + c1 * delta.x;
+
+    float cz0 = c.x * rem.y + c.y * delta.y;
+    float cz1 = c.z * rem.y + c.w * delta.y;
+
+    return cz0 * rem.z + cz1 * delta.z;
+}
+
+// a sculpt operation can only change the voxels inside the brush bounding box
+// plus MAX_STEP on each side, so only the thread groups over that region are
+// dispatched. keep these in sync with brushRegionGroups/brushRegionStart in sdf.h
+int3 brushRegionGroups(float3 brush_extent, float3 vol_size) {
+    const float3 region_size = brush_extent + MAX_STEP * 2;
+    // one more group as the start of the region is aligned down
+    return min(int3(ceil(region_size / 8)) + 1, int3(vol_size) / 8);
+}
+
+int3 brushRegionStart(float3 brush_pos, float3 brush_extent, float3 vol_size) {
+    const float3 region_size = brush_extent + MAX_STEP * 2;
+    const int3 group_count = brushRegionGroups(brush_extent, vol_size);
+    const int3 start = int3(floor((brush_pos + vol_size * 0.5 - region_size * 0.5) / 8)) * 8;
+    return clamp(start, 0, int3(vol_size) - group_count * 8);
+}
+
+// min-distance mips used for empty space skipping, each level is MIN_MIP_FACTOR times
+// smaller than the previous one (the first level is 4 times smaller than the volume).
+// every texel stores the smallest distance in its cell, including a border of
+// one voxel so it also covers the trilinear interpolation
+#define MIN_MIP_LEVELS 3
+#define MIN_MIP_FACTOR 4
+
+float cellExitDistance(float3 pos, float3 dir, float3 cell_min, float cell_size) {
+    const float3 exit_plane = cell_min + (dir > 0) * cell_size;
+    const float3 t = abs(dir) < 1e-6 ? 1e20 : (exit_plane - pos) / dir;
+    return max(min(t.x, min(t.y, t.z)), 0);
+}
+
+float minMipStep(float3 tex_pos, float3 dir, Texture3D<snorm float> mip, float cell_size) {
+    const float3 cell = floor(tex_pos / cell_size);
+    const float min_dist = mip.Load(int4(cell, 0)) * MAX_STEP;
+    if (min_dist <= ROUGH_MIN_HIT_DISTANCE + 1) return 0;
+    // the whole cell is at least min_dist away from the surface, so we can go to
+    // its exit and then move by min_dist again
+    return cellExitDistance(tex_pos, dir, cell * cell_size, cell_size) + min_dist;
+}
+
+// returns how far the ray can safely move using the coarsest level that is far
+// enough from the surface, or 0 if none of them are
+float emptySpaceStep(float3 tex_pos, float3 dir, Texture3D<snorm float> mip0, Texture3D<snorm float> mip1, Texture3D<snorm float> mip2) {
+    float step = minMipStep(tex_pos, dir, mip2, 64);
+    if (step == 0) step = minMipStep(tex_pos, dir, mip1, 16);
+    if (step == 0) step = minMipStep(tex_pos, dir, mip0, 4);
+    return step;
+}
+
+// octahedral normal encoding, maps a unit vector to [-1, 1]^2 so it can be stored
+// in two snorm channels. from "A Survey of Efficient Representations for Independent Unit Vectors"
+float2 octWrap(float2 v) {
+    return (1 - abs(v.yx)) * (v.xy >= 0 ? 1 : -1);
+}
+
+float2 octEncode(float3 n) {
+    n /= sum(abs(n));
+    n.xy = n.z >= 0 ? n.xy : octWrap(n.xy);
+    return n.xy;
+}
+
+float3 octDecode(float2 f) {
+    float3 n = float3(f.x, f.y, 1 - sum(abs(f)));
+    const float t = saturate(-n.z);
+    n.xy += n.xy >= 0 ? -t : t;
+    return normalize(n);
+}
+
+// the normals are only stored for the bricks in the atlas (same layout as the volume
+// one), uniform bricks have no gradient so they get what octDecode(0) would return
+float3 normalVolumeLoad(int3 pos, Texture3D<uint> table, Texture3D<snorm float2> normal_atlas) {
+    const uint entry = table.Load(int4(pos / BRICK_SIZE, 0));
+    if (isUniformBrick(entry)) return float3(0, 0, 1);
+    return octDecode(normal_atlas.Load(int4(brickAtlasPos(entry) + pos % BRICK_SIZE, 0)));
+}
+
+// trilinear interpolation of the normal volume. the normals are decoded before
+// blending them, filtering the encoded values breaks where the octahedron folds.
+// this is 8 loads (plus the table) instead of the 32 that calcNormal needs
+float3 normalVolumeSample(float3 pos, float3 size, Texture3D<uint> table, Texture3D<snorm float2> normal_atlas) {
+    int3 start = max(min(int3(pos), int3(size) - 2), 0);
+    int3 end = start + 1;
+
+    float3 delta = pos - start;
+    float3 rem = 1 - delta;
+
+#define map(x, y, z) normalVolumeLoad(int3((x), (y), (z)), table, normal_atlas)
+
+    float3 c00 = map(start.x, start.y, start.z) * rem.x + map(end.x, start.y, start.z) * delta.x;
+    float3 c10 = map(start.x, end.y,   start.z) * rem.x + map(end.x, end.y,   start.z) * delta.x;
+    float3 c01 = map(start.x, start.y, end.z)   * rem.x + map(end.x, start.y, end.z)   * delta.x;
+    float3 c11 = map(start.x, end.y,   end.z)   * rem.x + map(end.x, end.y,   end.z)   * delta.x;
+
+#undef map
+
+    float3 c0 = c00 * rem.y + c10 * delta.y;
+    float3 c1 = c01 * rem.y + c11 * delta.y;
+
+    return normalize(c0 * rem.z + c1 * delta.z);
+}
+
 float sdf_sphere(float3 pos, float3 centre, float r) {
 	return length(pos - centre) - r;
 }
@@ -68,4 +256,78 @@ float3 toneMapping(float3 colour, float exposure_bias) {
 	colour = colour * white_scale;
 	colour = pow(colour, 1/2.2);
 	return colour;
-}
\ No newline at end of file
+}
+
+// == lights =========================================
+
+// same as LightData in material_editor.h
+struct LightData {
+    float3 pos;
+    float radius;
+    float3 colour;
+    bool render;
+};
+
+// same as LightBVH::Node in light_bvh.h, the lights are uploaded in the order
+// of the leaves so a leaf is a range of the lights buffer
+struct LightNode {
+    float3 bounds_min;
+    // leaf: first light, otherwise: index of the left child (the right one is after it)
+    uint first;
+    float3 bounds_max;
+    // number of lights in the leaf, 0 if it's not a leaf
+    uint count;
+};
+
+#define LIGHT_BVH_STACK_SIZE 32
+
+float boxDistance(float3 pos, float3 bounds_min, float3 bounds_max) {
+    return length(max(max(bounds_min - pos, pos - bounds_max), 0));
+}
+
+// distance to the closest light (at most MAX_STEP), only the nodes of the bvh
+// closer than that are visited. the hidden lights (render == false) are skipped
+// unless include_hidden is true
+float lightBVHDistance(
+    float3 pos, 
+    bool include_hidden, 
+    uint num_of_lights, 
+    StructuredBuffer<LightData> lights, 
+    StructuredBuffer<LightNode> nodes, 
+    inout uint light_id
+) {
+    float dist = MAX_STEP;
+    if (num_of_lights == 0) return dist;
+
+    uint stack[LIGHT_BVH_STACK_SIZE];
+    uint stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        const LightNode node = nodes[stack[--stack_size]];
+        if (boxDistance(pos, node.bounds_min, node.bounds_max) >= dist) continue;
+
+        if (node.count > 0) {
+            for (uint i = node.first; i < node.first + node.count; ++i) {
+                LightData light = lights[i];
+                if (light.render || include_hidden) {
+                    float light_dist = sdf_sphere(pos, light.pos, light.radius);
+                    if (light_dist < dist) {
+                        dist = light_dist;
+                        light_id = i;
+                    }
+                }
+            }
+        }
+        else if (stack_size + 2 <= LIGHT_BVH_STACK_SIZE) {
+            // visit the closest child first so the other one is more likely to be skipped
+            const LightNode left = nodes[node.first];
+            const LightNode right = nodes[node.first + 1];
+            const bool left_first = boxDistance(pos, left.bounds_min, left.bounds_max) <= boxDistance(pos, right.bounds_min, right.bounds_max);
+            stack[stack_size++] = left_first ? node.first + 1 : node.first;
+            stack[stack_size++] = left_first ? node.first : node.first + 1;
+        }
+    }
+
+    return dist;
+}
@@ -16,7 +16,9 @@ struct BrushData {
 	float padding__5;
 };
 
-Texture3D<snorm float> vol_tex : register(t0);
+// the sculpture, see "sparse volume" in common.hlsl
+Texture3D<uint> brick_table : register(t0);
+Texture3D<snorm float> brick_atlas : register(t1);
 RWStructuredBuffer<BrushData> brush : register(u0);
 static float3 vol_tex_size = 0;
 
@@ -25,11 +27,13 @@ float3 worldToTex(float3 world) {
 }
 
 float preciseMap(float3 coords) {
-	return trilinearInterpolation(coords, vol_tex_size, vol_tex);
+	return volumeTrilinear(coords, vol_tex_size, brick_table, brick_atlas);
 }
 
 float roughMap(float3 coords) {
-	return vol_tex.Load(int4(round(coords), 0));
+	// the ray can be a bit outside of the volume, reading outside of the table gives
+	// entry 0 which is the first brick of the atlas, not empty space
+	return volumeLoad(clamp(int3(round(coords)), 0, int3(vol_tex_size) - 1), brick_table, brick_atlas);
 }
 
 float texBoundarySDF(float3 pos) {
@@ -91,7 +95,7 @@ void rayMarch(float3 ro, float3 rd, out float3 out_normal, out float3 out_pos) {
 
 [numthreads(1, 1, 1)]
 void main() {
-	vol_tex.GetDimensions(vol_tex_size.x, vol_tex_size.y, vol_tex_size.z);
+	vol_tex_size = volumeSize(brick_table);
 
     rayMarch(pos, dir, brush[0].norm, brush[0].pos);
 
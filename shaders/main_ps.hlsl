@@ -16,7 +16,8 @@ cbuffer ShaderData : register(b0) {
 	uint num_of_lights;
 	bool use_tonemapping;
 	float exposure_bias;
-	float2 padding__0;
+	bool use_normal_volume;
+	float padding__0;
 };
 
 cbuffer Material : register(b1) {
@@ -35,18 +36,18 @@ struct BrushData {
 	float padding__4;
 };
 
-struct LightData {
-    float3 pos;
-    float radius;
-    float3 colour;
-    bool render;
-};
-
 StructuredBuffer<BrushData> brush  : register(t0);
-Texture3D<snorm float> vol_tex     : register(t1);
+// the sculpture, see "sparse volume" in common.hlsl
+Texture3D<uint> brick_table        : register(t1);
 Texture2D material_tex             : register(t2);
 Texture2D background               : register(t3);
 StructuredBuffer<LightData> lights : register(t4);
+Texture3D<snorm float> min_mip0    : register(t5);
+Texture3D<snorm float> min_mip1    : register(t6);
+Texture3D<snorm float> min_mip2    : register(t7);
+Texture3D<snorm float2> normal_atlas : register(t8);
+StructuredBuffer<LightNode> light_nodes : register(t9);
+Texture3D<snorm float> brick_atlas : register(t10);
 
 sampler tex_sampler;
 
@@ -63,11 +64,11 @@ float3 worldToTex(float3 world) {
 }
 
 float preciseMap(float3 coords) {
-	return trilinearInterpolation(coords, vol_tex_size, vol_tex);
+	return volumeTrilinear(coords, vol_tex_size, brick_table, brick_atlas);
 }
 
 float roughMap(float3 coords) {
-	return vol_tex.Load(int4(round(coords), 0));
+	return volumeLoad(int3(round(coords)), brick_table, brick_atlas);
 }
 
 float texBoundarySDF(float3 pos) {
@@ -85,6 +86,12 @@ float3 calcNormal(float3 pos) {
 	);
 }
 
+// use the precomputed normals if we have them, otherwise compute them from the volume
+float3 getNormal(float3 pos) {
+	if (!use_normal_volume) return calcNormal(pos);
+	return normalVolumeSample(pos, vol_tex_size, brick_table, normal_atlas);
+}
+
 float getMouseDist(float3 pos) {
 	return sdf_sphere(pos, brush[0].pos, brush[0].radius);
 }
@@ -130,19 +137,8 @@ bool isInMouse(float3 ro, float3 rd, out float3 p) {
 	return false;
 }
 
-float lightDistance(float3 pos, out uint light_id) {
-    float dist = MAX_STEP;
-    for (uint i = 0; i < num_of_lights; ++i) {
-        LightData light = lights[i];
-        if (light.render) {
-            float light_dist = sdf_sphere(pos, light.pos, light.radius);
-            if (light_dist < dist) {
-                dist = light_dist;
-                light_id = i;
-            }
-        }
-    }
-    return dist;
+float lightDistance(float3 pos, inout uint light_id) {
+    return lightBVHDistance(pos, false, num_of_lights, lights, light_nodes, light_id);
 }
 
 float3 rayMarch(float3 ray_origin, float3 ray_dir) {
@@ -186,13 +182,17 @@ float3 rayMarch(float3 ray_origin, float3 ray_dir) {
 			// without doing any filtering and is only used to avoid that expensive calculation
 			// when we can
 			closest = roughMap(tex_pos) * MAX_STEP;
+			// if we're far from the surface, try to jump through the empty space using the min-distance mips
+			if (closest > ROUGH_MIN_HIT_DISTANCE + 1) {
+				closest = max(closest, emptySpaceStep(tex_pos, ray_dir, min_mip0, min_mip1, min_mip2));
+			}
 
 			// if it is roughly close to a shape, do a much more precise check using trilinear filtering
 			if (closest < ROUGH_MIN_HIT_DISTANCE) {
 				closest = preciseMap(tex_pos) * MAX_STEP;
 
 				if (closest < MIN_HIT_DISTANCE) {
-					const float3 normal = calcNormal(tex_pos);
+					const float3 normal = getNormal(tex_pos);
 					const float3 albedo = getAlbedo(tex_pos, normal);
 					const float diffuse_intensity = max(0, dot(normal, light_dir));
 					const float ambient_intensity = 0.35;
@@ -231,7 +231,7 @@ float3 rayMarch(float3 ray_origin, float3 ray_dir) {
 }
 
 float4 main(PixelInput input) : SV_TARGET {
-	vol_tex.GetDimensions(vol_tex_size.x, vol_tex_size.y, vol_tex_size.z);
+	vol_tex_size = volumeSize(brick_table);
 	vol_tex_centre = vol_tex_size * 0.5;
 
 	// convert to range (-1, 1)
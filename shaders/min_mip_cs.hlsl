@@ -0,0 +1,59 @@
+#include "shaders/common.hlsl"
+
+cbuffer MinMipData : register(b0) {
+    float3 brush_extent;
+    uint cell_size;
+    float3 vol_size;
+    // set for the first level, which is built from the sculpture instead of the previous level
+    bool from_volume;
+    uint3 cell_count;
+    uint padding__1;
+};
+
+struct BrushData {
+	float3 brush_pos;
+	float radius;
+	float3 brush_norm;
+	float padding__1;
+};
+
+// input, the previous level
+Texture3D<snorm float> source : register(t0);
+StructuredBuffer<BrushData> brush_data : register(t1);
+// or the sculpture (see "sparse volume" in common.hlsl)
+Texture3D<uint> brick_table : register(t2);
+Texture3D<snorm float> brick_atlas : register(t3);
+// output
+RWTexture3D<snorm float> destination : register(u0);
+
+[numthreads(4, 4, 4)]
+void main(uint3 thread_id : SV_DispatchThreadID) {
+    if (any(thread_id >= cell_count)) return;
+
+    int3 src_size = int3(vol_size);
+    int3 dst_size = 0;
+    if (!from_volume) source.GetDimensions(src_size.x, src_size.y, src_size.z);
+    destination.GetDimensions(dst_size.x, dst_size.y, dst_size.z);
+
+    // only the cells around the brush region are dispatched (one more before it, as
+    // the cells also include the first voxel of the next one), when rebuilding the
+    // whole level cell_count is the size of the level so start is always 0
+    const int3 region_start = brushRegionStart(brush_data[0].brush_pos, brush_extent, vol_size);
+    const int3 start = clamp(region_start / int(cell_size) - 1, 0, dst_size - int3(cell_count));
+    const int3 cell = start + int3(thread_id);
+
+    const int3 src_start = cell * MIN_MIP_FACTOR;
+    const int3 src_end = min(src_start + MIN_MIP_FACTOR, src_size - 1);
+
+    float min_dist = 1;
+    for (int z = src_start.z; z <= src_end.z; ++z) {
+        for (int y = src_start.y; y <= src_end.y; ++y) {
+            for (int x = src_start.x; x <= src_end.x; ++x) {
+                if (from_volume) min_dist = min(min_dist, volumeLoad(int3(x, y, z), brick_table, brick_atlas));
+                else             min_dist = min(min_dist, source.Load(int4(x, y, z, 0)));
+            }
+        }
+    }
+
+    destination[cell] = min_dist;
+}
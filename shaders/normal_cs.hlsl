@@ -0,0 +1,56 @@
+#include "shaders/common.hlsl"
+
+cbuffer NormalData : register(b0) {
+    float3 brush_extent;
+    bool full_rebuild;
+    float3 vol_size;
+    float padding__0;
+};
+
+struct BrushData {
+	float3 brush_pos;
+	float radius;
+	float3 brush_norm;
+	float padding__1;
+};
+
+// input, the sculpture (see "sparse volume" in common.hlsl)
+Texture3D<uint> brick_table : register(t0);
+StructuredBuffer<BrushData> brush_data : register(t1);
+Texture3D<snorm float> brick_atlas : register(t2);
+// output, same layout as brick_atlas
+RWTexture3D<snorm float2> normal_atlas : register(u0);
+
+float preciseMap(float3 coords) {
+	return volumeTrilinear(coords, vol_size, brick_table, brick_atlas);
+}
+
+// same as calcNormal in main_ps.hlsl and ray_tracing_cs.hlsl
+float3 calcNormal(float3 pos) {
+	const float2 k = float2(1, -1);
+
+	return normalize(
+		k.xyy * preciseMap(pos + k.xyy * NORMAL_STEP) +
+		k.yyx * preciseMap(pos + k.yyx * NORMAL_STEP) +
+		k.yxy * preciseMap(pos + k.yxy * NORMAL_STEP) +
+		k.xxx * preciseMap(pos + k.xxx * NORMAL_STEP)
+	);
+}
+
+[numthreads(8, 8, 8)]
+void main(uint3 thread_id : SV_DispatchThreadID) {
+    // like sculpt_cs, only the groups over the brush region are dispatched
+    // unless we're rebuilding the whole volume
+    int3 id = thread_id;
+    if (!full_rebuild) {
+        id += brushRegionStart(brush_data[0].brush_pos, brush_extent, vol_size);
+    }
+
+    // every group is one brick, the uniform ones are not in the atlas so they have no normals
+    const uint entry = brick_table.Load(int4(id / BRICK_SIZE, 0));
+    if (isUniformBrick(entry)) return;
+
+    const float3 normal = calcNormal(id);
+    // voxels far from the surface have a flat distance, so the gradient is 0
+    normal_atlas[brickAtlasPos(entry) + id % BRICK_SIZE] = any(isnan(normal)) ? 0 : octEncode(normal);
+}
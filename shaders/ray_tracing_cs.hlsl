@@ -1,4 +1,5 @@
 #include "shaders/common.hlsl"
+#include "shaders/sampler.hlsl"
 
 cbuffer RayTraceData : register(b0) {
     uint2 thread_loc;
@@ -8,6 +9,16 @@ cbuffer RayTraceData : register(b0) {
 	uint maximum_rays;
 	float maximum_trace_dist;
 	float jitter_amount;
+	float noise_threshold;
+	float ray_scale;
+	uint min_samples;
+	uint tile_frame;
+	uint2 image_size;
+	// size of the importance sampling table of the background, 0 if there isn't one
+	uint2 env_size;
+	// index of the current tile in tile_noise
+	uint tile_index;
+	uint3 padding__2;
 };
 
 cbuffer ShaderData : register(b1) {
@@ -21,7 +32,8 @@ cbuffer ShaderData : register(b1) {
 	float padding__0;
 	bool use_tonemapping;
 	float exposure_bias;
-	float2 padding__1;
+	bool use_normal_volume;
+	float padding__1;
 };
 
 cbuffer Material : register(b2) {
@@ -33,19 +45,46 @@ cbuffer Material : register(b2) {
     float specular_probability;
 };
 
-struct LightData {
-    float3 pos;
-    float radius;
-    float3 colour;
-    bool render;
+// same as envmap::Entry in env_map.h, one for every cell of the background.
+// a cell is picked uniformly, then it's kept with probability prob or
+// replaced with its alias (vose's alias method)
+struct EnvSample {
+	float prob;
+	uint alias;
+	// probability of picking the cell
+	float pdf;
+	float padding;
 };
 
-RWTexture2D<unorm float4> output   : register(u0);
-
-Texture3D<snorm float> vol_tex     : register(t0);
+// rgb: sum of the light of every ray, a: number of rays. the image is
+// resolved from this in resolve_cs.hlsl, so it keeps its precision in long renders
+RWStructuredBuffer<float4> radiance : register(u0);
+// x: mean luminance, y: sum of squared differences from the mean (welford),
+// z: number of rays, w: 1 if the pixel has converged
+RWStructuredBuffer<float4> pixel_stats : register(u1);
+// number of converged pixels, it's cleared every frame
+RWStructuredBuffer<uint> converged_count : register(u2);
+// what the rays of the pixel hit first, for the denoiser (cpu_denoise.h)
+// rgb: sum of the albedo, a: number of rays
+RWStructuredBuffer<float4> first_albedo : register(u3);
+// xyz: sum of the normal, w: sum of the distance from the camera
+RWStructuredBuffer<float4> first_normal : register(u4);
+// per tile, x: sum of noiseRatio of the pixels that haven't converged (in 1/256ths),
+// y: how many of them there are. the rays of the next pass are spread based on it
+RWStructuredBuffer<uint2> tile_noise : register(u5);
+
+// the sculpture, see "sparse volume" in common.hlsl
+Texture3D<uint> brick_table        : register(t0);
 Texture2D diffuse_tex              : register(t1);
 Texture2D background               : register(t2);
 StructuredBuffer<LightData> lights : register(t3);
+Texture3D<snorm float> min_mip0    : register(t4);
+Texture3D<snorm float> min_mip1    : register(t5);
+Texture3D<snorm float> min_mip2    : register(t6);
+Texture3D<snorm float2> normal_atlas : register(t7);
+StructuredBuffer<EnvSample> env_table : register(t8);
+StructuredBuffer<LightNode> light_nodes : register(t9);
+Texture3D<snorm float> brick_atlas : register(t10);
 
 sampler tex_sampler;
 
@@ -57,39 +96,24 @@ static float3 vol_tex_centre = 0;
 
 // == scene functions ================================
 
-float3 getPrevious(uint2 id) {
-    return output[id].rgb;
-}
-
 float3 worldToTex(float3 world) {
 	return world + vol_tex_centre;
 }
 
 float preciseMap(float3 coords) {
-	return trilinearInterpolation(coords, vol_tex_size, vol_tex);
+	return volumeTrilinear(coords, vol_tex_size, brick_table, brick_atlas);
 }
 
 float roughMap(float3 coords) {
-	return vol_tex.Load(int4(round(coords), 0));
+	return volumeLoad(int3(round(coords)), brick_table, brick_atlas);
 }
 
 float texBoundarySDF(float3 pos) {
     return sdf_box(pos, 0, vol_tex_size);
 }
 
-float lightDistance(float3 pos, int bounce, out uint light_id) {
-    float dist = MAX_STEP;
-    for (uint i = 0; i < num_of_lights; ++i) {
-        LightData light = lights[i];
-        if (light.render || bounce) {
-            float light_dist = sdf_sphere(pos, light.pos, light.radius);
-            if (light_dist < dist) {
-                dist = light_dist;
-                light_id = i;
-            }
-        }
-    }
-    return dist;
+float lightDistance(float3 pos, int bounce, inout uint light_id) {
+    return lightBVHDistance(pos, bounce > 0, num_of_lights, lights, light_nodes, light_id);
 }
 
 float3 calcNormal(float3 pos) {
@@ -103,6 +127,13 @@ float3 calcNormal(float3 pos) {
 	);
 }
 
+// same as getNormal in main_ps.hlsl, this runs once per bounce so
+// using the normal volume saves a lot of loads
+float3 getNormal(float3 pos) {
+	if (!use_normal_volume) return calcNormal(pos);
+	return normalVolumeSample(pos, vol_tex_size, brick_table, normal_atlas);
+}
+
 float3 lightNormal(float3 pos, float3 c, float r) {
 	return normalize(pos - c);
 }
@@ -126,11 +157,21 @@ float3 getAlbedo(float3 pos, float3 normal) {
 	return colour;
 }
 
-float3 getEnvironment(float3 rd) {
+float2 envDirToUV(float3 rd) {
 	float2 uv;
 	uv.x = 0.5 + atan2(rd.z, rd.x) / (2 * PI);
 	uv.y = 0.5 - asin(rd.y) / PI;
-	return background.SampleLevel(tex_sampler, uv, 0).rgb;
+	return uv;
+}
+
+float3 envUVToDir(float2 uv) {
+	const float phi = (uv.x - 0.5) * 2 * PI;
+	const float elevation = (0.5 - uv.y) * PI;
+	return float3(cos(phi) * cos(elevation), sin(elevation), sin(phi) * cos(elevation));
+}
+
+float3 getEnvironment(float3 rd) {
+	return background.SampleLevel(tex_sampler, envDirToUV(rd), 0).rgb;
 }
 
 // == random functions ===============================
@@ -161,10 +202,111 @@ float3 randomHemisphereDir(float3 norm, inout uint state) {
 	return dir * sign(dot(norm, dir));
 }
 
-float2 randomPointInCircle(inout uint state) {
-    float angle = random(state) * 2. * PI;
+// the functions below map uniform samples in [0, 1) (from random or from the
+// SampleSequence) to the distributions the path tracer needs
+
+// uniform point on the unit sphere, same distribution as randomDir
+float3 sphereDir(float2 u) {
+	const float z = 1 - 2 * u.x;
+	const float r = sqrt(max(1 - z * z, 0));
+	const float phi = 2 * PI * u.y;
+	return float3(r * cos(phi), r * sin(phi), z);
+}
+
+float2 pointInCircle(float2 u) {
+    float angle = u.x * 2. * PI;
     float2 point_on_circle = float2(cos(angle), sin(angle));
-    return point_on_circle * sqrt(random(state));
+    return point_on_circle * sqrt(u.y);
+}
+
+// == environment sampling ===========================
+
+bool hasEnvTable() {
+	return all(env_size > 0);
+}
+
+// probability (per solid angle) of envSample returning rd. inside a cell
+// the uvs are uniform, the cosine is how much the equirectangular mapping
+// stretches the cell at that height
+float envPdf(float3 rd) {
+	const float2 uv = envDirToUV(rd);
+	const uint2 cell = min(uint2(uv * env_size), env_size - 1);
+	const float cos_elevation = sqrt(max(1 - rd.y * rd.y, 0));
+	if (cos_elevation <= 1e-4) return 0;
+	const float cell_pdf = env_table[cell.y * env_size.x + cell.x].pdf;
+	return cell_pdf * env_size.x * env_size.y / (2 * PI * PI * cos_elevation);
+}
+
+float3 envSample(inout uint state, out float pdf) {
+	const uint count = env_size.x * env_size.y;
+	uint index = min(uint(random(state) * count), count - 1);
+	const EnvSample entry = env_table[index];
+	if (random(state) > entry.prob) {
+		index = entry.alias;
+	}
+
+	const uint2 cell = uint2(index % env_size.x, index / env_size.x);
+	const float2 uv = (cell + float2(random(state), random(state))) / env_size;
+	const float3 dir = envUVToDir(uv);
+	pdf = envPdf(dir);
+	return dir;
+}
+
+// == light sampling =================================
+
+void makeBasis(float3 w, out float3 u, out float3 v) {
+	const float3 a = abs(w.x) > 0.9 ? float3(0, 1, 0) : float3(1, 0, 0);
+	u = normalize(cross(a, w));
+	v = cross(w, u);
+}
+
+// cosine of the cone the light covers as seen from pos, 1 if pos is inside of it
+float lightConeCos(LightData light, float3 pos) {
+	const float dist2 = mag2(light.pos - pos);
+	const float radius2 = light.radius * light.radius;
+	if (dist2 <= radius2) return 1;
+	return sqrt(1 - radius2 / dist2);
+}
+
+// probability (per solid angle) of sampleLightDir picking a direction towards
+// the light, including the chance of picking the light itself
+float lightPdf(LightData light, float3 pos) {
+	const float cos_max = lightConeCos(light, pos);
+	if (cos_max >= 1) return 0;
+	return 1 / (2 * PI * (1 - cos_max) * num_of_lights);
+}
+
+// uniform direction inside the cone that the light covers
+float3 sampleLightDir(LightData light, float3 pos, float2 xi) {
+	const float3 w = normalize(light.pos - pos);
+	float3 u, v;
+	makeBasis(w, u, v);
+
+	const float cos_max = lightConeCos(light, pos);
+	const float cos_theta = 1 - xi.x * (1 - cos_max);
+	const float sin_theta = sqrt(max(1 - cos_theta * cos_theta, 0));
+	const float phi = xi.y * 2 * PI;
+	return normalize(u * cos(phi) * sin_theta + v * sin(phi) * sin_theta + w * cos_theta);
+}
+
+// == multiple importance sampling ===================
+
+// power heuristic (beta = 2)
+float misWeight(float pdf, float other_pdf) {
+	const float a = pdf * pdf;
+	const float b = other_pdf * other_pdf;
+	return a + b > 0 ? a / (a + b) : 0;
+}
+
+// the diffuse lobe is picked (1 - specular_probability) of the times, and
+// its directions are cosine distributed. the specular lobe doesn't have a
+// pdf we can evaluate, so only the diffuse one is sampled directly
+float diffusePdf(float cos_theta) {
+	return (1 - saturate(specular_probability)) * max(cos_theta, 0) / PI;
+}
+
+float3 diffuseBSDF(float3 surface_albedo) {
+	return (1 - saturate(specular_probability)) * surface_albedo / PI;
 }
 
 // == ray tracing ====================================
@@ -174,6 +316,8 @@ struct HitInfo {
 	float3 position;
 	float3 albedo;
 	float3 light;
+	// index of the light that was hit, -1 if it wasn't a light
+	int light_id;
 };
 
 HitInfo rayMarch(float3 ro, float3 rd, int bounce, inout uint state) {
@@ -184,6 +328,7 @@ HitInfo rayMarch(float3 ro, float3 rd, int bounce, inout uint state) {
 	info.position = 0;
 	info.albedo = 0;
 	info.light  = 0;
+	info.light_id = -1;
 
 	float distance_traveled = 0;
 
@@ -199,6 +344,7 @@ HitInfo rayMarch(float3 ro, float3 rd, int bounce, inout uint state) {
             info.position        = current_pos;
             info.albedo = 0;
             info.light  = light.colour;
+            info.light_id = light_id;
             break;
 		}
 
@@ -210,13 +356,17 @@ HitInfo rayMarch(float3 ro, float3 rd, int bounce, inout uint state) {
 			// without doing any filtering and is only used to avoid that expensive calculation
 			// when we can
 			closest = roughMap(tex_pos) * MAX_STEP;
+			// if we're far from the surface, try to jump through the empty space using the min-distance mips
+			if (closest > ROUGH_MIN_HIT_DISTANCE + 1) {
+				closest = max(closest, emptySpaceStep(tex_pos, rd, min_mip0, min_mip1, min_mip2));
+			}
 
 			// if it is roughly close to a shape, do a much more precise check using trilinear filtering
 			if (closest < ROUGH_MIN_HIT_DISTANCE) {
 				closest = preciseMap(tex_pos) * MAX_STEP;
 
 				if (closest < MIN_HIT_DISTANCE) {
-                    info.normal          = calcNormal(tex_pos);
+                    info.normal          = getNormal(tex_pos);
                     info.position        = current_pos;
                     info.albedo = getAlbedo(tex_pos, info.normal);
 	                info.light  = emissive_colour;
@@ -235,26 +385,96 @@ HitInfo rayMarch(float3 ro, float3 rd, int bounce, inout uint state) {
 	return info;
 }
 
-float3 rayTrace(float3 ro, float3 rd, inout uint state) {
+// light coming from the background towards the surface (diffuse lobe only)
+float3 sampleEnvironment(HitInfo info, int bounce, inout uint state) {
+	float light_pdf = 0;
+	const float3 dir = envSample(state, light_pdf);
+	const float cos_theta = dot(info.normal, dir);
+	if (light_pdf <= 0 || cos_theta <= 0) return 0;
+
+	// anything in the way (including the lights) blocks the background
+	const HitInfo shadow = rayMarch(info.position + info.normal, dir, bounce + 1, state);
+	if (any(shadow.normal != 0)) return 0;
+
+	const float weight = misWeight(light_pdf, diffusePdf(cos_theta));
+	return getEnvironment(dir) * diffuseBSDF(info.albedo) * cos_theta / light_pdf * weight;
+}
+
+// light coming from one of the lights (picked at random) towards the surface (diffuse lobe only)
+// xi.x picks the light, what's left of it is reused for the direction
+float3 sampleLights(HitInfo info, int bounce, float2 xi, inout uint state) {
+	const uint light_id = min(uint(xi.x * num_of_lights), num_of_lights - 1);
+	xi.x = saturate(xi.x * num_of_lights - light_id);
+	const LightData light = lights[light_id];
+	const float3 pos = info.position + info.normal;
+
+	const float light_pdf = lightPdf(light, pos);
+	if (light_pdf <= 0) return 0;
+
+	const float3 dir = sampleLightDir(light, pos, xi);
+	const float cos_theta = dot(info.normal, dir);
+	if (cos_theta <= 0) return 0;
+
+	// the shadow ray has to reach the same light, it could be behind the sculpture or another light
+	const HitInfo shadow = rayMarch(pos, dir, bounce + 1, state);
+	if (shadow.light_id != (int)light_id) return 0;
+
+	const float weight = misWeight(light_pdf, diffusePdf(cos_theta));
+	return light.colour * diffuseBSDF(info.albedo) * cos_theta / light_pdf * weight;
+}
+
+// the sequence is used for the choices that matter the most (which light to
+// sample, the direction and the lobe of the bounce), the rest uses state.
+// first_hit is whatever the ray from the camera hit, it's used by the denoiser
+float3 rayTrace(float3 ro, float3 rd, inout uint state, inout SampleSequence seq, out HitInfo first_hit) {
 	float3 incoming_light = 0;
 	float3 ray_colour = 1;
+	// pdf of the last diffuse bounce, 0 if the ray didn't come from one
+	float bsdf_pdf = 0;
+
+	first_hit = (HitInfo)0;
+	first_hit.light_id = -1;
 
 	for (int bounce = 0; bounce <= maximum_bounces; ++bounce) {
 		HitInfo info = rayMarch(ro, rd, bounce, state);
+		if (bounce == 0) first_hit = info;
 		
 		if (any(info.normal != 0)) {
+			// always taken, so that every bounce uses the same dimensions in every path
+			const float2 light_u = sample2D(seq);
+			const float2 dir_u = sample2D(seq);
+			const float lobe_u = sample1D(seq);
+
+			// the light was also sampled directly from the last diffuse bounce
+			float light_weight = 1;
+			if (info.light_id >= 0 && bsdf_pdf > 0) {
+				light_weight = misWeight(bsdf_pdf, lightPdf(lights[info.light_id], ro));
+			}
+            incoming_light += info.light * ray_colour * light_weight;
+
+			if (any(info.albedo > 0)) {
+				if (num_of_lights > 0) {
+					incoming_light += sampleLights(info, bounce, light_u, state) * ray_colour;
+				}
+				if (hasEnvTable()) {
+					incoming_light += sampleEnvironment(info, bounce, state) * ray_colour;
+				}
+			}
+
 			ro = info.position + info.normal;
-            float3 diffuse_dir = normalize(info.normal + randomDir(state));
+            float3 diffuse_dir = normalize(info.normal + sphereDir(dir_u));
             float3 specular_dir = reflect(rd, info.normal);
-            bool is_specular_bounce = specular_probability >= random(state);
+            bool is_specular_bounce = specular_probability >= lobe_u;
             rd = lerp(diffuse_dir, specular_dir, smoothness * is_specular_bounce);
 
-            incoming_light += info.light * ray_colour;
 		    ray_colour *= lerp(info.albedo, specular_colour, is_specular_bounce);
+			bsdf_pdf = is_specular_bounce ? 0 : diffusePdf(dot(info.normal, rd));
 		}
 		// no hit
 		else {
-            incoming_light += getEnvironment(rd) * ray_colour;
+			// the background was also sampled directly from the last diffuse bounce
+			const float weight = hasEnvTable() && bsdf_pdf > 0 ? misWeight(bsdf_pdf, envPdf(rd)) : 1;
+            incoming_light += getEnvironment(rd) * ray_colour * weight;
 			break;
 		}
 	}
@@ -262,18 +482,50 @@ float3 rayTrace(float3 ro, float3 rd, inout uint state) {
 	return incoming_light;
 }
 
+// == adaptive sampling ==============================
+
+float luminance(float3 colour) {
+	return dot(colour, float3(0.2126, 0.7152, 0.0722));
+}
+
+// a pixel has converged once the standard error of its mean is small enough
+// compared to the mean itself
+bool hasConverged(float4 stats) {
+	if (noise_threshold <= 0 || stats.z < min_samples) return false;
+	const float variance = stats.y / (stats.z - 1);
+	const float std_error = sqrt(variance / stats.z);
+	return std_error <= noise_threshold * max(stats.x, 1e-3);
+}
+
+// how many times the error of the pixel is still bigger than what counts as converged,
+// same as in hasConverged. 1 if there aren't enough rays to know yet
+float noiseRatio(float4 stats) {
+	if (stats.z < 2) return 1;
+	const float variance = stats.y / (stats.z - 1);
+	const float std_error = sqrt(variance / stats.z);
+	return std_error / (noise_threshold * max(stats.x, 1e-3));
+}
+
 // == main ===========================================
 
 [numthreads(8, 8, 1)]
 void main(uint2 thread_id : SV_DispatchThreadID) {
     uint2 id = thread_id + thread_loc;
 
-	uint2 tex_size;
-	output.GetDimensions(tex_size.x, tex_size.y);
+	const uint2 tex_size = image_size;
 
-    if (any(id > tex_size)) return;
+    if (any(id >= tex_size)) return;
 
-	vol_tex.GetDimensions(vol_tex_size.x, vol_tex_size.y, vol_tex_size.z);
+	const uint pixel_index = id.y * tex_size.x + id.x;
+	float4 stats = tile_frame > 0 ? pixel_stats[pixel_index] : 0;
+
+	// already converged, the previous colour is good enough
+	if (stats.w > 0) {
+		InterlockedAdd(converged_count[0], 1);
+		return;
+	}
+
+	vol_tex_size = volumeSize(brick_table);
 	vol_tex_centre = vol_tex_size * 0.5;
 
     float2 tex_uv = (float2)id / tex_size;
@@ -282,32 +534,58 @@ void main(uint2 thread_id : SV_DispatchThreadID) {
 	// convert to range (-1, 1)
 	float2 uv = tex_uv * 2.0 - 1.0;
 	uv.y *= one_over_aspect_ratio;
-	uint rng_state = id.y * tex_size.x + id.x + num_rendered_frames * 12345;
+	uint rng_state = hashUint(hashCombine(pixel_index, num_rendered_frames + tile_frame));
 
 	float3 total_light = 0;
+	float4 total_albedo = 0;
+	float4 total_normal = 0;
 
     float3 ray_origin = cam_pos + cam_fwd * cam_zoom;
     float3 focus_point = cam_fwd + cam_right * uv.x + cam_up * uv.y;
 
 	float jitter = jitter_amount / 1000.0;
 
-	for (int ray = 0; ray < maximum_rays; ++ray) {
-        float2 aa_jitter = randomPointInCircle(rng_state) * jitter;
+	// the rays saved on the converged pixels are spread over the ones left
+	const uint ray_count = max(uint(maximum_rays * ray_scale), 1);
+
+	for (uint ray = 0; ray < ray_count; ++ray) {
+		// the rays of a pixel keep going through its sequence across frames
+		SampleSequence seq = makeSampleSequence(id, (uint)stats.z);
+
+        float2 aa_jitter = pointInCircle(sample2D(seq)) * jitter;
         float3 aa_focus_point = focus_point + cam_right * aa_jitter.x + cam_up * aa_jitter.y;
         float3 ray_dir = normalize(aa_focus_point);
 		
-        total_light += rayTrace(ray_origin, ray_dir, rng_state);
+        HitInfo first_hit;
+        float3 ray_light = rayTrace(ray_origin, ray_dir, rng_state, seq, first_hit);
+        total_light += ray_light;
+
+        // the lights don't have an albedo, white keeps them apart from the surfaces around them
+        const bool has_hit = any(first_hit.normal != 0);
+        total_albedo += float4(first_hit.light_id >= 0 ? float3(1, 1, 1) : first_hit.albedo, 1);
+        total_normal += float4(first_hit.normal, has_hit ? length(first_hit.position - ray_origin) : maximum_trace_dist);
+
+        // running variance of the luminance
+        const float lum = luminance(ray_light);
+        stats.z += 1;
+        const float delta = lum - stats.x;
+        stats.x += delta / stats.z;
+        stats.y += delta * (lum - stats.x);
 	}
 
-	float3 colour = total_light / maximum_rays;
-	if (use_tonemapping) {
-		colour = toneMapping(colour, exposure_bias);
-	}
-
-    if (num_rendered_frames > 0) {
-        float3 previous_col = output[id].rgb;
-        colour = lerp(previous_col, colour, 1.0 / (num_rendered_frames + 1));
-    }
+	float4 sum = tile_frame > 0 ? radiance[pixel_index] : 0;
+	radiance[pixel_index] = sum + float4(total_light, ray_count);
+	first_albedo[pixel_index] = (tile_frame > 0 ? first_albedo[pixel_index] : 0) + total_albedo;
+	first_normal[pixel_index] = (tile_frame > 0 ? first_normal[pixel_index] : 0) + total_normal;
 
-    output[id] = float4(colour, 1);
+	stats.w = hasConverged(stats);
+	pixel_stats[pixel_index] = stats;
+	if (stats.w > 0) {
+		InterlockedAdd(converged_count[0], 1);
+	}
+	else if (noise_threshold > 0) {
+		// clamped so that a few very noisy pixels don't take all the rays (or overflow)
+		InterlockedAdd(tile_noise[tile_index].x, uint(min(noiseRatio(stats), 64.0) * 256.0));
+		InterlockedAdd(tile_noise[tile_index].y, 1);
+	}
 }
\ No newline at end of file
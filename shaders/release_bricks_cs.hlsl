@@ -0,0 +1,34 @@
+#include "shaders/common.hlsl"
+
+// moves the bricks that sculpt_cs didn't need anymore back to the free list. this can't
+// be done in sculpt_cs itself: a group could put a brick back in the same place another
+// group is taking one from, and then two groups would get the same brick
+
+// same as GpuVolume::free_bricks, released_bricks and counters
+RWStructuredBuffer<uint> free_bricks : register(u0);
+RWStructuredBuffer<uint> released_bricks : register(u1);
+RWStructuredBuffer<uint> brick_counters : register(u2);
+
+#define THREAD_COUNT 64
+
+groupshared uint free_count;
+groupshared uint released_count;
+
+// a single group, there are usually only a few bricks to move
+[numthreads(THREAD_COUNT, 1, 1)]
+void main(uint thread_id : SV_GroupIndex) {
+    if (thread_id == 0) {
+        free_count = brick_counters[FREE_BRICKS_COUNTER];
+        released_count = brick_counters[RELEASED_BRICKS_COUNTER];
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    for (uint i = thread_id; i < released_count; i += THREAD_COUNT) {
+        free_bricks[free_count + i] = released_bricks[i];
+    }
+
+    if (thread_id == 0) {
+        brick_counters[FREE_BRICKS_COUNTER] = free_count + released_count;
+        brick_counters[RELEASED_BRICKS_COUNTER] = 0;
+    }
+}
@@ -0,0 +1,39 @@
+#include "shaders/common.hlsl"
+
+// same as the ShaderData in ray_tracing_cs.hlsl
+cbuffer ShaderData : register(b0) {
+	float3 cam_up;
+	float time;
+	float3 cam_fwd;
+	float one_over_aspect_ratio;
+	float3 cam_right;
+	float cam_zoom;
+	float3 cam_pos; 
+	float padding__0;
+	bool use_tonemapping;
+	float exposure_bias;
+	bool use_normal_volume;
+	float padding__1;
+};
+
+// rgb: sum of the light of every ray, a: number of rays
+StructuredBuffer<float4> radiance : register(t0);
+RWTexture2D<unorm float4> output  : register(u0);
+
+// turns the accumulated light into the image that is shown
+[numthreads(8, 8, 1)]
+void main(uint2 id : SV_DispatchThreadID) {
+	uint2 tex_size;
+	output.GetDimensions(tex_size.x, tex_size.y);
+
+	if (any(id >= tex_size)) return;
+
+	const float4 sum = radiance[id.y * tex_size.x + id.x];
+	float3 colour = sum.a > 0 ? sum.rgb / sum.a : 0;
+
+	if (use_tonemapping) {
+		colour = toneMapping(colour, exposure_bias);
+	}
+
+	output[id] = float4(colour, 1);
+}
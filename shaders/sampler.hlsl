@@ -0,0 +1,82 @@
+// low discrepancy sampler for the path tracer.
+// it's a 2D sobol sequence with hash based owen scrambling (burley, "practical
+// hash-based owen scrambling"). every pair of dimensions gets its own shuffled
+// and scrambled copy of the sequence, so the samples of a pixel are well spread
+// in every pair, the pixels are decorrelated from each other and the sequence
+// keeps going from one frame to the next instead of starting over
+
+struct SampleSequence {
+	// which sample of the pixel this is
+	uint index;
+	// different for every pixel
+	uint seed;
+	// next pair of dimensions, every call to sample2D or sample1D uses a new one.
+	// the samples have to be taken in the same order for every path
+	uint dim;
+};
+
+uint hashUint(uint x) {
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+uint hashCombine(uint seed, uint value) {
+	return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+// permutes the bits of x so that every bit only depends on the ones below it
+uint laineKarrasPermutation(uint x, uint seed) {
+	x += seed;
+	x ^= x * 0x6c50b47c;
+	x ^= x * 0xb82f1e52;
+	x ^= x * 0xc7afe638;
+	x ^= x * 0x8d22f6e6;
+	return x;
+}
+
+// owen scrambling of a number in base 2, bits are flipped based on the ones above them
+uint nestedUniformScramble(uint x, uint seed) {
+	x = reversebits(x);
+	x = laineKarrasPermutation(x, seed);
+	return reversebits(x);
+}
+
+// first two dimensions of the sobol sequence
+uint2 sobol2D(uint index) {
+	uint2 result = uint2(reversebits(index), 0);
+	for (uint v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+		if (index & 1) result.y ^= v;
+	}
+	return result;
+}
+
+float uintToUnitFloat(uint x) {
+	// only keep 24 bits so that it's always less than 1
+	return (x >> 8) * (1.0 / 16777216.0);
+}
+
+SampleSequence makeSampleSequence(uint2 pixel, uint index) {
+	SampleSequence seq;
+	seq.index = index;
+	seq.seed = hashUint(hashCombine(hashUint(pixel.x), pixel.y));
+	seq.dim = 0;
+	return seq;
+}
+
+float2 sample2D(inout SampleSequence seq) {
+	const uint dim_seed = hashCombine(seq.seed, hashUint(seq.dim++));
+	const uint index = nestedUniformScramble(seq.index, dim_seed);
+	const uint2 sobol = sobol2D(index);
+	return float2(
+		uintToUnitFloat(nestedUniformScramble(sobol.x, hashCombine(dim_seed, 0))),
+		uintToUnitFloat(nestedUniformScramble(sobol.y, hashCombine(dim_seed, 1)))
+	);
+}
+
+float sample1D(inout SampleSequence seq) {
+	return sample2D(seq).x;
+}
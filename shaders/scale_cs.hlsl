@@ -1,13 +1,15 @@
 #include "shaders/common.hlsl"
 
-Texture3D<snorm float> source : register(t0);
+// the sculpture, see "sparse volume" in common.hlsl
+Texture3D<uint> source_table : register(t0);
+Texture3D<snorm float> source_atlas : register(t1);
 RWTexture3D<snorm float> destination : register(u0);
 
 static float3 src_size;
 static float3 dst_size;
 
 inline float sampleSource(float3 position, float3 scale) {
-    return trilinearInterpolation(position / scale, src_size, source);
+    return volumeTrilinear(position / scale, src_size, source_table, source_atlas);
 }
 
 inline float3 idToWorld(uint3 id) {
@@ -16,7 +18,7 @@ inline float3 idToWorld(uint3 id) {
 
 [numthreads(8, 8, 8)]
 void main(uint3 id : SV_DispatchThreadID) {
-    source.GetDimensions(src_size.x, src_size.y, src_size.z);
+    src_size = volumeSize(source_table);
     destination.GetDimensions(dst_size.x, dst_size.y, dst_size.z);
 
     const float3 scale = dst_size / src_size;
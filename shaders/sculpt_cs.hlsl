@@ -17,11 +17,29 @@ struct BrushData {
 // input
 Texture3D<snorm float> brush : register(t0);
 StructuredBuffer<BrushData> brush_data : register(t1);
-// output
-RWTexture3D<snorm float> vol_tex : register(u0);
+// output, the sculpture (see "sparse volume" in common.hlsl)
+RWTexture3D<uint> brick_table : register(u0);
+RWTexture3D<snorm float> brick_atlas : register(u1);
+// one bit per 8x8x8 brick (one thread group), set if the group changed any voxel.
+// see DirtyTracker in dirty_tracker.h
+RWStructuredBuffer<uint> dirty_bricks : register(u2);
+// same as GpuVolume::free_bricks, released_bricks and counters. the groups take
+// bricks from free_bricks and put the ones they don't need anymore in released_bricks,
+// release_bricks_cs moves them back after the dispatch
+RWStructuredBuffer<uint> free_bricks : register(u3);
+RWStructuredBuffer<uint> released_bricks : register(u4);
+RWStructuredBuffer<uint> brick_counters : register(u5);
 
 static float3 brush_size = 0;
 static float3 volume_tex_size = 0;
+// set when this thread changes its voxel
+static bool has_changed = false;
+groupshared uint group_changed;
+// table entry of the group's brick
+groupshared uint group_entry;
+// smallest and biggest new value in the brick, if they're the same it's uniform
+groupshared int group_min;
+groupshared int group_max;
 
 // operation is a 32 bit unsigned integer used for flags,
 // the left-most bit is used to flag if the operation is smooth
@@ -40,23 +58,23 @@ inline float sampleBrush(float3 position) {
     return trilinearInterpolation(position / brush_scale, brush_size, brush);
 }
 
-inline float sampleWorld(float3 position) {
-    return vol_tex[position];
-}
-
-inline void op_union(float vold, float vnew, uint3 id) {
+inline float op_union(float vold, float vnew) {
     if (vnew < vold) {
-        vol_tex[id] = vnew;
+        has_changed = true;
+        return vnew;
     }
+    return vold;
 }
 
-inline void op_subtraction(float vold, float vnew, uint3 id) {
+inline float op_subtraction(float vold, float vnew) {
     if ((-vnew) > vold) {
-        vol_tex[id] = -vnew;
+        has_changed = true;
+        return -vnew;
     }
+    return vold;
 }
 
-inline void op_smooth_union(float vold, float vnew, float k, uint3 id) {
+inline float op_smooth_union(float vold, float vnew, float k) {
     // this formula doesn't work if vold and vnew are <1, so premultiply them by
     // MAX_STEP and then divide it again at the end
     vnew *= MAX_STEP; vold *= MAX_STEP;
@@ -64,10 +82,11 @@ inline void op_smooth_union(float vold, float vnew, float k, uint3 id) {
 	const float h = clamp(0.5 + 0.5 * (vnew - vold) / k, 0.0, 1.0);
 	const float result = lerp(vnew, vold, h) - k * h * (1.0 - h);
     
-    vol_tex[id] = result / MAX_STEP;
+    has_changed = true;
+    return result / MAX_STEP;
 }
 
-inline void op_smooth_subtraction(float vold, float vnew, float k, uint3 id) {
+inline float op_smooth_subtraction(float vold, float vnew, float k) {
     // this formula doesn't work if vold and vnew are <1, so premultiply them by
     // MAX_STEP and then divide it again at the end
     vnew *= MAX_STEP; vold *= MAX_STEP;
@@ -75,18 +94,18 @@ inline void op_smooth_subtraction(float vold, float vnew, float k, uint3 id) {
 	const float h = clamp(0.5 - 0.5 * (vold + vnew) / k, 0.0, 1.0);
 	const float result = lerp(vold, -vnew, h) + k * h * (1.0 - h);
     
-    vol_tex[id] = result / MAX_STEP;
+    has_changed = true;
+    return result / MAX_STEP;
 }
 
-inline void setVolumeTexture(uint3 id, float new_value) {
-    const float old_value = sampleWorld(id);
-    
+inline float applyOperation(float old_value, float new_value) {
     switch (operation) {
-        case OP_UNION:               op_union(old_value, new_value, id);                             break;                   
-        case OP_SUBTRACTION:         op_subtraction(old_value, new_value, id);                       break;       
-        case OP_SMOOTH_UNION:        op_smooth_union(old_value, new_value, smooth_amount, id);       break;       
-        case OP_SMOOTH_SUBTRACTION:  op_smooth_subtraction(old_value, new_value, smooth_amount, id); break; 
+        case OP_UNION:               return op_union(old_value, new_value);
+        case OP_SUBTRACTION:         return op_subtraction(old_value, new_value);
+        case OP_SMOOTH_UNION:        return op_smooth_union(old_value, new_value, smooth_amount);
+        case OP_SMOOTH_SUBTRACTION:  return op_smooth_subtraction(old_value, new_value, smooth_amount);
     }
+    return old_value;
 }
 
 inline float3 idToWorld(uint3 id) {
@@ -97,7 +116,7 @@ inline float3 worldToBrush(float3 pos) {
     return pos - brush_data[0].brush_pos + brush_size * brush_scale * 0.5;
 }
 
-inline void writeApproximateDistance(float3 pos, uint3 id) {
+inline float approximateDistance(float3 pos) {
     // clamp the position to the bounds, this way we get a point inside the rect 
     // in the same rough direction as the point
     const float3 edge_pos = clamp(pos, 0, brush_size * brush_scale);
@@ -112,30 +131,115 @@ inline void writeApproximateDistance(float3 pos, uint3 id) {
     // but not by much (hopefully lol)
     distance *= 0.9;
     // make sure that we don't go over the maximum value
-    distance = saturate(distance / MAX_STEP);
-
-    setVolumeTexture(id, distance);
+    return saturate(distance / MAX_STEP);
 }
 
 inline float texBoundarySDF(float3 pos) {
     return sdf_box(pos, brush_data[0].brush_pos, brush_size * brush_scale);
 }
 
-[numthreads(8, 8, 8)]
-void main(uint3 id : SV_DispatchThreadID) {
-    vol_tex.GetDimensions(volume_tex_size.x, volume_tex_size.y, volume_tex_size.z);
-    brush.GetDimensions(brush_size.x, brush_size.y, brush_size.z);
-
+// returns the new value of the voxel
+inline float sculptVoxel(uint3 id, float old_value) {
     float3 pos = idToWorld(id);
     float dist_from_tex = texBoundarySDF(pos);
     pos = worldToBrush(pos);
 
     if (dist_from_tex > 0) {
         if (dist_from_tex < MAX_STEP) {
-            writeApproximateDistance(pos, id);
+            return applyOperation(old_value, approximateDistance(pos));
         }
-        return;
+        return old_value;
     }
 
-    setVolumeTexture(id, sampleBrush(pos));
+    return applyOperation(old_value, sampleBrush(pos));
 }
+
+inline void markBrickDirty(uint3 id) {
+    const uint3 brick = id / 8;
+    const uint3 brick_count = uint3(volume_tex_size) / 8;
+    const uint index = brick.x + brick.y * brick_count.x + brick.z * brick_count.x * brick_count.y;
+    InterlockedOr(dirty_bricks[index / 32], 1u << (index % 32));
+}
+
+// takes a brick from the free list, returns the uniform entry back if there are none left.
+// GpuVolume::reserve makes sure there are enough before every dispatch, so this shouldn't happen
+inline uint allocBrick(uint uniform_entry) {
+    uint capacity, stride;
+    free_bricks.GetDimensions(capacity, stride);
+
+    uint count;
+    InterlockedAdd(brick_counters[FREE_BRICKS_COUNTER], 0xffffffff, count);
+    // the counter could have wrapped around if another group found it empty at the same time
+    if (count == 0 || count > capacity) {
+        InterlockedAdd(brick_counters[FREE_BRICKS_COUNTER], 1);
+        return uniform_entry;
+    }
+    return free_bricks[count - 1];
+}
+
+inline void releaseBrick(uint entry) {
+    uint index;
+    InterlockedAdd(brick_counters[RELEASED_BRICKS_COUNTER], 1, index);
+    released_bricks[index] = entry;
+}
+
+[numthreads(8, 8, 8)]
+void main(uint3 thread_id : SV_DispatchThreadID, uint group_index : SV_GroupIndex) {
+    brick_table.GetDimensions(volume_tex_size.x, volume_tex_size.y, volume_tex_size.z);
+    volume_tex_size *= BRICK_SIZE;
+    brush.GetDimensions(brush_size.x, brush_size.y, brush_size.z);
+
+    // we're only dispatched over the region the brush can reach, move
+    // the thread to where that region is in the volume
+    const uint3 id = thread_id + brushRegionStart(brush_data[0].brush_pos, brush_size * brush_scale, volume_tex_size);
+    // the region start is aligned to 8, so every group is exactly one brick
+    const uint3 brick = id / BRICK_SIZE;
+
+    if (group_index == 0) {
+        group_changed = 0;
+        group_entry = brick_table[brick];
+        group_min = 32767;
+        group_max = -32768;
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    const uint entry = group_entry;
+    float old_value = brickUniformValue(entry);
+    if (!isUniformBrick(entry)) {
+        old_value = brick_atlas[brickAtlasPos(entry) + int3(id % BRICK_SIZE)];
+    }
+    const float new_value = sculptVoxel(id, old_value);
+
+    const int new_snorm = snormFromFloat(new_value);
+    InterlockedMin(group_min, new_snorm);
+    InterlockedMax(group_max, new_snorm);
+    // only one atomic per group instead of one per voxel
+    if (has_changed) group_changed = 1;
+    GroupMemoryBarrierWithGroupSync();
+
+    const bool is_uniform = group_min == group_max;
+
+    if (group_index == 0 && group_changed) {
+        markBrickDirty(id);
+
+        if (is_uniform) {
+            // the brick doesn't need to be in the atlas anymore
+            brick_table[brick] = uniformBrickEntry(group_min);
+            if (!isUniformBrick(entry)) releaseBrick(entry);
+        }
+        else if (isUniformBrick(entry)) {
+            group_entry = allocBrick(entry);
+            brick_table[brick] = group_entry;
+        }
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    if (!group_changed || is_uniform || isUniformBrick(group_entry)) {
+        return;
+    }
+
+    // a brick that was just taken from the free list has to be written completely
+    if (has_changed || isUniformBrick(entry)) {
+        brick_atlas[brickAtlasPos(group_entry) + int3(id % BRICK_SIZE)] = new_value;
+    }
+}
\ No newline at end of file
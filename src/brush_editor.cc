@@ -11,6 +11,10 @@
 #include "camera.h"
 #include "fs.h"
 #include "mem.h"
+#include "options.h"
+#include "cpu_sculpt.h"
+#include "cpu_check.h"
+#include "gpu_volume.h"
 
 constexpr vec3u brush_tex_size = 64;
 constexpr Texture3D::Type brush_type = Texture3D::Type::r16_snorm;
@@ -69,8 +73,8 @@ BrushEditor::BrushEditor() {
 	addBrush("Cylinder", Shapes::Cylinder, ShapeData(vec3(0), 21, 42));
 }
 
-void BrushEditor::drawWidget(Handle<Texture3D> main_tex) {
-	mouseWidget(main_tex);
+void BrushEditor::drawWidget(GpuVolume &volume) {
+	mouseWidget(volume);
 
 	if (isActionPressed(Action::ChangeToBrush))  setState(State::Brush);
 	if (isActionPressed(Action::ChangeToEraser)) setState(State::Eraser);
@@ -189,19 +193,14 @@ void BrushEditor::update() {
 	if (!has_changed) return;
 	if (Buffer *buf = oper_handle.get()) {
 		if (OperationData *data = buf->map<OperationData>()) {
-			data->operation = (uint32_t)state_to_oper[(int)state];
-			if (smooth_k > 0.f) {
-				data->operation |= (uint32_t)Operations::Smooth;
-			}
-			data->smooth_k = smooth_k;
-			data->scale = scale;
+			*data = getOperationData();
 			buf->unmap();
 		}
 	}
 	has_changed = false;
 }
 
-void BrushEditor::findBrush(const Camera &cam, Handle<Texture3D> texture) {
+void BrushEditor::findBrush(const Camera &cam, GpuVolume &volume) {
 	cam_pos = cam.pos + cam.fwd * cam.getZoom();
 	cam_dir = cam.getMouseDir();
 
@@ -213,7 +212,7 @@ void BrushEditor::findBrush(const Camera &cam, Handle<Texture3D> texture) {
 		find_data_handle->unmap();
 	}
 
-	find_brush->dispatch(1, { find_data_handle }, { texture->srv }, { data_handle->uav });
+	find_brush->dispatch(1, { find_data_handle }, { volume.table->srv, volume.atlas->srv }, { data_handle->uav });
 }
 
 void BrushEditor::setOpen(bool new_is_open) {
@@ -247,6 +246,10 @@ vec3i BrushEditor::getBrushSize() const {
 	return 0;
 }
 
+vec3 BrushEditor::getBrushExtent() const {
+	return vec3(getBrushSize()) * scale;
+}
+
 float BrushEditor::getScale() const {
 	constexpr float base_brush_size = 64.f;
 	if (const Texture3D *brush = get(brush_index)) {
@@ -262,6 +265,39 @@ Handle<Buffer> BrushEditor::getOperHandle() {
 	return oper_handle;
 }
 
+OperationData BrushEditor::getOperationData() const {
+	OperationData data;
+	data.operation = (uint32_t)state_to_oper[(int)state];
+	if (smooth_k > 0.f) {
+		data.operation |= (uint32_t)Operations::Smooth;
+	}
+	data.smooth_k = smooth_k;
+	data.scale = scale;
+	data.depth = depth;
+	return data;
+}
+
+bool BrushEditor::readBrushData(BrushData &out) {
+	if (!data_readback) {
+		data_readback = Buffer::makeStructured<BrushData>(1, Bind::CpuRead);
+		if (!data_readback) {
+			err("could not create brush data readback buffer");
+			return false;
+		}
+	}
+
+	data_readback->copyFrom(*data_handle.get());
+	const BrushData *data = data_readback->mapRead<BrushData>();
+	if (!data) return false;
+	out = *data;
+	data_readback->unmap();
+	return true;
+}
+
+Handle<Texture3D> BrushEditor::getBrushTexture() {
+	return brush_index < textures.len ? textures[brush_index].handle : Handle<Texture3D>();
+}
+
 void BrushEditor::runFillShader(Shapes shape, const ShapeData &shape_data, Handle<Texture3D> destination) {
 	if (shape != Shapes::None) {
 		if (ShapeData *data = fill_buffer->map<ShapeData>()) {
@@ -271,6 +307,13 @@ void BrushEditor::runFillShader(Shapes shape, const ShapeData &shape_data, Handl
 	}
 	
 	fill_shaders[(int)shape]->dispatch(destination->size / 8, { fill_buffer }, {}, { destination->uav });
+
+	if (Options::get().check_cpu_sculpt) {
+		Volume volume(destination->size);
+		cpu::fill(volume, shape, shape_data);
+		// same groups as the dispatch above
+		cpu::compareVolume(volume, *destination.get(), vec3i(0), destination->size / 8 * 8, "fill");
+	}
 }
 
 Texture3D *BrushEditor::get(size_t index) {
@@ -318,7 +361,7 @@ size_t BrushEditor::checkTextureAlreadyLoaded(str::view name) {
 	return -1;
 }
 
-void BrushEditor::mouseWidget(Handle<Texture3D> main_tex) {
+void BrushEditor::mouseWidget(GpuVolume &volume) {
 	static bool is_menu_open = false;
 
 	if (gfx::isMainRTVActive() || is_menu_open) {
@@ -351,19 +394,19 @@ void BrushEditor::mouseWidget(Handle<Texture3D> main_tex) {
 
 		if (shift) {
 			beginMenu("Scale", is_menu_open, scale, 1.f, 5.f);
-			findBrush(main_tex);
+			findBrush(volume);
 			return;
 		}
 
 		if (ctrl) {
 			beginMenu("Depth", is_menu_open, depth, -1.5f, 1.5f);
-			findBrush(main_tex);
+			findBrush(volume);
 			return;
 		}
 
 		if (alt) {
 			beginMenu("Blend amount", is_menu_open, smooth_k, 0.f, 20.f);
-			findBrush(main_tex);
+			findBrush(volume);
 			return;
 		}
 
@@ -371,7 +414,7 @@ void BrushEditor::mouseWidget(Handle<Texture3D> main_tex) {
 	}
 }
 
-void BrushEditor::findBrush(Handle<Texture3D> main_tex) {
+void BrushEditor::findBrush(GpuVolume &volume) {
 	if (BrushFindData *data = find_data_handle->map<BrushFindData>()) {
 		data->pos = cam_pos;
 		data->dir = cam_dir;
@@ -380,7 +423,7 @@ void BrushEditor::findBrush(Handle<Texture3D> main_tex) {
 		find_data_handle->unmap();
 	}
 
-	find_brush->dispatch(1, { find_data_handle }, { main_tex->srv }, { data_handle->uav });
+	find_brush->dispatch(1, { find_data_handle }, { volume.table->srv, volume.atlas->srv }, { data_handle->uav });
 }
 
 void BrushEditor::setState(State newstate) {
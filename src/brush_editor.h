@@ -11,6 +11,7 @@
 struct Buffer;
 struct Shader;
 struct Camera;
+struct GpuVolume;
 
 enum class Shapes : int {
 	Sphere, Box, Cylinder, None, Count
@@ -70,9 +71,9 @@ GFX_CLASS_CHECK(BrushFindData);
 
 struct BrushEditor {
 	BrushEditor();
-	void drawWidget(Handle<Texture3D> main_tex);
+	void drawWidget(GpuVolume &volume);
 	void update();
-	void findBrush(const Camera &cam, Handle<Texture3D> texture);
+	void findBrush(const Camera &cam, GpuVolume &volume);
 	void setOpen(bool is_open);
 	bool isOpen() const;
 
@@ -81,8 +82,15 @@ struct BrushEditor {
 	ID3D11UnorderedAccessView *getDataUAV();
 	ID3D11ShaderResourceView *getDataSRV();
 	vec3i getBrushSize() const;
+	// size of the brush in the sculpture, this is what sculpt_cs uses
+	vec3 getBrushExtent() const;
 	float getScale() const;
 	Handle<Buffer> getOperHandle();
+	// same values update() writes in the operation buffer
+	OperationData getOperationData() const;
+	// copies the brush data written by the find brush shader, waits for the gpu
+	bool readBrushData(BrushData &out);
+	Handle<Texture3D> getBrushTexture();
 
 	void runFillShader(Shapes shape, const ShapeData &data, Handle<Texture3D> destination);
 
@@ -100,8 +108,8 @@ private:
 	size_t addTexture(const char *name);
 	size_t addBrush(const char *name, Shapes shape, const ShapeData &data);
 	size_t checkTextureAlreadyLoaded(str::view name);
-	void mouseWidget(Handle<Texture3D> main_tex);
-	void findBrush(Handle<Texture3D> main_tex);
+	void mouseWidget(GpuVolume &volume);
+	void findBrush(GpuVolume &volume);
 	void setState(State newstate);
 
 	vec3 position = 0.f;
@@ -112,6 +120,8 @@ private:
 	size_t brush_index = 0;
 	Handle<Buffer> oper_handle;
 	Handle<Buffer> data_handle;
+	// only created when the cpu sculpt check needs it
+	Handle<Buffer> data_readback;
 	Handle<Buffer> find_data_handle;
 	Handle<Shader> find_brush;
 
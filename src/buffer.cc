@@ -179,6 +179,48 @@ void Buffer::unmap(uint subresource) {
     gfx::context->Unmap(buffer, subresource);
 }
 
+const void *Buffer::mapRead(uint subresource) {
+    D3D11_MAPPED_SUBRESOURCE resource;
+    HRESULT hr = gfx::context->Map(buffer, subresource, D3D11_MAP_READ, 0, &resource);
+    if (FAILED(hr)) {
+        err("couldn't map buffer for reading");
+        return nullptr;
+    }
+    return resource.pData;
+}
+
+const void *Buffer::tryMapRead(uint subresource) {
+    D3D11_MAPPED_SUBRESOURCE resource;
+    HRESULT hr = gfx::context->Map(buffer, subresource, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &resource);
+    if (hr == DXGI_ERROR_WAS_STILL_DRAWING) {
+        return nullptr;
+    }
+    if (FAILED(hr)) {
+        err("couldn't map buffer for reading");
+        return nullptr;
+    }
+    return resource.pData;
+}
+
+void Buffer::copyFrom(Buffer &source) {
+    gfx::context->CopyResource(buffer, source.buffer);
+}
+
+void Buffer::update(const void *data, size_t len, size_t offset) {
+    D3D11_BOX box;
+    mem::zero(box);
+    box.left = (UINT)offset;
+    box.right = (UINT)(offset + len);
+    box.bottom = 1;
+    box.back = 1;
+    gfx::context->UpdateSubresource(buffer, 0, &box, data, 0, 0);
+}
+
+void Buffer::clearUAV(uint value) {
+    const UINT values[4] = { value, value, value, value };
+    gfx::context->ClearUnorderedAccessViewUint(uav, values);
+}
+
 // == PRIVATE FUNCTIONS ==================================================
 
 static bool bufMakeConstant(Buffer *buf, size_t type_size, Buffer::Usage usage, bool cpu_can_write, bool cpu_can_read, const void *initial_data, size_t data_count) {
@@ -236,6 +278,10 @@ static bool bufMakeStructured(Buffer *buf, size_t type_size, size_t count, Bind
         desc.Usage = D3D11_USAGE_DYNAMIC;
         desc.CPUAccessFlags |= D3D11_CPU_ACCESS_WRITE;
     }
+    // cpu read only, used to read back from the gpu
+    if (bind == Bind::CpuRead) {
+        desc.Usage = D3D11_USAGE_STAGING;
+    }
     desc.ByteWidth = (UINT)(type_size * count);
     desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
     desc.StructureByteStride = (UINT)type_size;
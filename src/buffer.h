@@ -60,6 +60,25 @@ struct Buffer {
 	//void *mapRegion();
 	void unmap(uint subresource = 0);
 
+	// only for buffers made with Bind::CpuRead, waits for the gpu to be done with it
+	template<typename T>
+	const T *mapRead(uint subresource = 0) {
+		return (const T *)mapRead(subresource);
+	}
+
+	const void *mapRead(uint subresource = 0);
+	// same as mapRead, but returns nullptr instead of waiting if the gpu is not done with it yet
+	template<typename T>
+	const T *tryMapRead(uint subresource = 0) {
+		return (const T *)tryMapRead(subresource);
+	}
+
+	const void *tryMapRead(uint subresource = 0);
+	void copyFrom(Buffer &source);
+	// only for buffers without cpu access, replaces len bytes starting from offset with data
+	void update(const void *data, size_t len, size_t offset = 0);
+	void clearUAV(uint value = 0);
+
 	void bindCBuffer(ShaderType type, uint slot = 0) { bindCBuffer(*this, type, slot); }
 	void bindSRV(ShaderType type, uint slot = 0) { bindSRV(*this, type, slot); }
 	void bindUAV(uint slot = 0) { bindUAV(*this, slot); }
@@ -0,0 +1,167 @@
+#include "cpu_check.h"
+
+#include <stdlib.h>
+
+#include "texture.h"
+#include "gpu_volume.h"
+#include "tracelog.h"
+
+namespace cpu {
+	// the bricks are read back in batches so the whole texture is never copied at once
+	static constexpr size_t read_batch = 4096;
+
+	static vec3i getBrickStart(const Volume &volume, size_t brick) {
+		return vec3i(
+			(int)(brick % volume.brick_count.x),
+			(int)((brick / volume.brick_count.x) % volume.brick_count.y),
+			(int)(brick / ((size_t)volume.brick_count.x * volume.brick_count.y))
+		) * Volume::brick_size;
+	}
+
+	static bool checkTexture(const Volume &volume, Texture3D &texture) {
+		if (texture.getType() != Texture3D::Type::r16_snorm) {
+			err("only r16_snorm textures can be compared with a volume");
+			return false;
+		}
+		if (any(volume.size != texture.size)) {
+			err("volume is %dx%dx%d, but the texture is %dx%dx%d",
+				volume.size.x, volume.size.y, volume.size.z,
+				texture.size.x, texture.size.y, texture.size.z
+			);
+			return false;
+		}
+		return true;
+	}
+
+	bool readVolume(Texture3D &texture, Volume &out) {
+		if (!out.init(texture.size) || !checkTexture(out, texture)) {
+			return false;
+		}
+
+		const size_t brick_count = (size_t)out.brick_count.x * out.brick_count.y * out.brick_count.z;
+		arr<uint32_t> bricks;
+		arr<uint8_t> data;
+
+		for (size_t first = 0; first < brick_count; first += read_batch) {
+			const size_t last = math::min(first + read_batch, brick_count);
+
+			bricks.clear();
+			for (size_t i = first; i < last; ++i) {
+				bricks.push((uint32_t)i);
+			}
+
+			if (!texture.readBricks(bricks, Volume::brick_size, data)) {
+				return false;
+			}
+
+			const int16_t *values = (const int16_t *)data.buf;
+			for (size_t i = 0; i < bricks.len; ++i) {
+				out.setBrick(bricks[i], values + i * Volume::brick_voxels);
+			}
+		}
+
+		return true;
+	}
+
+	static void getRegionBricks(const Volume &volume, const vec3i &start, const vec3i &end, arr<uint32_t> &out) {
+		const vec3i first = math::max(start, vec3i(0)) / Volume::brick_size;
+		const vec3i last = (math::min(end, volume.size) + Volume::brick_size - 1) / Volume::brick_size;
+
+		for (int z = first.z; z < last.z; ++z) {
+			for (int y = first.y; y < last.y; ++y) {
+				for (int x = first.x; x < last.x; ++x) {
+					out.push((uint32_t)((size_t)x + (size_t)y * volume.brick_count.x + (size_t)z * volume.brick_count.x * volume.brick_count.y));
+				}
+			}
+		}
+	}
+
+	// values has brick_voxels values for each brick one after the other
+	static bool compareBricks(Volume &volume, Slice<uint32_t> bricks, const int16_t *values, const char *what, int tolerance) {
+		size_t different_bricks = 0;
+		int max_difference = 0;
+		vec3i max_pos = 0;
+
+		for (size_t i = 0; i < bricks.len; ++i) {
+			const int16_t *gpu = values + i * Volume::brick_voxels;
+			const vec3i brick_start = getBrickStart(volume, bricks[i]);
+			// bricks at the edge of the volume can be partially outside of it
+			const vec3i brick_end = math::min(brick_start + Volume::brick_size, volume.size);
+			bool is_different = false;
+
+			for (int z = brick_start.z; z < brick_end.z; ++z) {
+				for (int y = brick_start.y; y < brick_end.y; ++y) {
+					for (int x = brick_start.x; x < brick_end.x; ++x) {
+						const vec3i pos = vec3i(x, y, z);
+						const int difference = abs((int)volume.getRaw(pos) - (int)gpu[Volume::voxelIndex(pos)]);
+						if (difference <= tolerance) continue;
+
+						is_different = true;
+						if (difference > max_difference) {
+							max_difference = difference;
+							max_pos = pos;
+						}
+					}
+				}
+			}
+
+			if (is_different) {
+				++different_bricks;
+				volume.setBrick(bricks[i], gpu);
+			}
+		}
+
+		if (different_bricks) {
+			warn("cpu %s: %zu of %zu bricks differ from the gpu, biggest difference is %d (%.4f) at %d %d %d",
+				what, different_bricks, bricks.len, max_difference, (float)max_difference / 32767.f,
+				max_pos.x, max_pos.y, max_pos.z
+			);
+			return false;
+		}
+
+		debug("cpu %s matches the gpu (%zu bricks)", what, bricks.len);
+		return true;
+	}
+
+	bool compareVolume(Volume &volume, Texture3D &texture, const vec3i &start, const vec3i &end, const char *what, int tolerance) {
+		if (!checkTexture(volume, texture)) {
+			return false;
+		}
+
+		arr<uint32_t> bricks;
+		getRegionBricks(volume, start, end, bricks);
+		if (bricks.empty()) {
+			return true;
+		}
+
+		arr<uint8_t> data;
+		if (!texture.readBricks(bricks, Volume::brick_size, data)) {
+			return false;
+		}
+
+		return compareBricks(volume, bricks, (const int16_t *)data.buf, what, tolerance);
+	}
+
+	bool compareVolume(Volume &volume, GpuVolume &gpu_volume, const vec3i &start, const vec3i &end, const char *what, int tolerance) {
+		if (any(volume.size != gpu_volume.size)) {
+			err("volume is %dx%dx%d, but the gpu one is %dx%dx%d",
+				volume.size.x, volume.size.y, volume.size.z,
+				gpu_volume.size.x, gpu_volume.size.y, gpu_volume.size.z
+			);
+			return false;
+		}
+
+		arr<uint32_t> bricks;
+		getRegionBricks(volume, start, end, bricks);
+		if (bricks.empty()) {
+			return true;
+		}
+
+		arr<uint8_t> data;
+		if (!gpu_volume.readBricks(bricks, data)) {
+			return false;
+		}
+
+		return compareBricks(volume, bricks, (const int16_t *)data.buf, what, tolerance);
+	}
+} // namespace cpu
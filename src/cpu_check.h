@@ -0,0 +1,21 @@
+#pragma once
+
+#include "volume.h"
+
+struct Texture3D;
+struct GpuVolume;
+
+// debug checks for the cpu versions of the sculpting shaders (cpu_sculpt), the
+// gpu result is read back and compared brick by brick with the cpu one.
+// everything here waits for the gpu, so it's only used when "check cpu sculpt"
+// is enabled in the options
+namespace cpu {
+	// copies the whole r16_snorm texture in the volume
+	bool readVolume(Texture3D &texture, Volume &out);
+	// compares the bricks that overlap [start, end) with the texture and logs how many
+	// differ by more than tolerance snorm steps. the bricks that differ are copied from the
+	// texture, so the next check only reports new differences. returns false if any differ
+	bool compareVolume(Volume &volume, Texture3D &texture, const vec3i &start, const vec3i &end, const char *what, int tolerance = 1);
+	// same as above, but with the sculpture (see GpuVolume::readBricks)
+	bool compareVolume(Volume &volume, GpuVolume &gpu_volume, const vec3i &start, const vec3i &end, const char *what, int tolerance = 1);
+} // namespace cpu
@@ -0,0 +1,151 @@
+#include "cpu_denoise.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "thr.h"
+
+namespace cpu {
+	// b3 spline, same kernel as the paper
+	static constexpr float kernel[3] = { 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+	// used when a pixel doesn't have enough rays to know how noisy it is,
+	// the luminance then doesn't stop the blur at all
+	static constexpr float unknown_variance = 1e6f;
+
+	// first hit of the pixel, averaged over its rays
+	struct Feature {
+		// zero if the rays didn't hit anything
+		vec3 normal = 0;
+		float depth = 0;
+		vec3 albedo = 0;
+		// false if there is no first hit data (e.g. right after resuming a checkpoint)
+		bool is_valid = false;
+	};
+
+	// same as luminance in ray_tracing_cs.hlsl
+	static float luminance(const vec3 &colour) {
+		return colour.x * 0.2126f + colour.y * 0.7152f + colour.z * 0.0722f;
+	}
+
+	static float featureWeight(const Feature &p, const Feature &q, const DenoiseSettings &settings, float tap_distance) {
+		if (!p.is_valid || !q.is_valid) return 1.f;
+
+		// the background is never blurred with the scene
+		const bool p_hit = p.normal.mag2() > 0;
+		const bool q_hit = q.normal.mag2() > 0;
+		if (p_hit != q_hit) return 0.f;
+		if (!p_hit) return 1.f;
+
+		const float normal_weight = powf(math::max(dot(p.normal, q.normal), 0.f), settings.normal_power);
+		const float depth_weight = expf(-fabsf(p.depth - q.depth) / (settings.depth_sigma * p.depth * tap_distance + 1e-4f));
+		const float albedo_weight = expf(-(p.albedo - q.albedo).mag2() / (settings.albedo_sigma * settings.albedo_sigma));
+		return normal_weight * depth_weight * albedo_weight;
+	}
+
+	void denoise(const DenoiseInput &input, const DenoiseSettings &settings, arr<vec4> &out) {
+		const vec2i size = input.size;
+		const size_t pixel_count = (size_t)size.x * size.y;
+
+		out.destroy();
+
+		if (pixel_count == 0 || input.radiance.len < pixel_count || input.pixel_stats.len < pixel_count) {
+			return;
+		}
+
+		const bool has_features = input.albedo.len >= pixel_count && input.normal_depth.len >= pixel_count;
+
+		arr<Feature> features;
+		features.reserve(pixel_count);
+		features.len = pixel_count;
+
+		// rgb: colour, a: variance of its luminance. the variance goes down with
+		// every pass just like the noise does
+		arr<vec4> colours;
+		colours.reserve(pixel_count);
+		colours.len = pixel_count;
+
+		thr::parallelFor((size_t)size.y,
+			[&](size_t y) {
+				for (size_t i = y * size.x; i < (y + 1) * size.x; ++i) {
+					const vec4 &sum = input.radiance[i];
+					const vec4 &stats = input.pixel_stats[i];
+					const float rays = sum.w > 0 ? sum.w : 1.f;
+					// variance of the mean, not of a single ray
+					const float variance = stats.z > 1 ? stats.y / (stats.z - 1) / stats.z : unknown_variance;
+					colours[i] = vec4(sum.v / rays, variance);
+
+					Feature feature;
+					if (has_features && input.albedo[i].w > 0) {
+						const float count = input.albedo[i].w;
+						const vec3 normal = input.normal_depth[i].v / count;
+						feature.normal = normal.mag2() > 0 ? norm(normal) : vec3(0);
+						feature.depth = input.normal_depth[i].w / count;
+						feature.albedo = input.albedo[i].v / count;
+						feature.is_valid = true;
+					}
+					features[i] = feature;
+				}
+			}
+		);
+
+		arr<vec4> filtered;
+		filtered.reserve(pixel_count);
+		filtered.len = pixel_count;
+
+		for (int pass = 0; pass < settings.passes; ++pass) {
+			const int step = 1 << pass;
+
+			thr::parallelFor((size_t)size.y,
+				[&](size_t row) {
+					const int y = (int)row;
+					for (int x = 0; x < size.x; ++x) {
+						const size_t index = (size_t)x + (size_t)y * size.x;
+						const vec4 &centre = colours[index];
+						const Feature &feature = features[index];
+						const float centre_lum = luminance(centre.v);
+						const float lum_scale = settings.luminance_sigma * sqrtf(centre.w) + 1e-4f;
+
+						vec3 colour_sum = 0;
+						float variance_sum = 0;
+						float weight_sum = 0;
+
+						for (int dy = -2; dy <= 2; ++dy) {
+							const int ty = y + dy * step;
+							if (ty < 0 || ty >= size.y) continue;
+
+							for (int dx = -2; dx <= 2; ++dx) {
+								const int tx = x + dx * step;
+								if (tx < 0 || tx >= size.x) continue;
+
+								const size_t tap_index = (size_t)tx + (size_t)ty * size.x;
+								const vec4 &tap = colours[tap_index];
+								const float tap_distance = vec2((float)dx, (float)dy).mag() * (float)step;
+
+								const float lum_weight = expf(-fabsf(luminance(tap.v) - centre_lum) / lum_scale);
+								const float weight =
+									kernel[abs(dx)] * kernel[abs(dy)] *
+									lum_weight *
+									featureWeight(feature, features[tap_index], settings, tap_distance);
+
+								colour_sum += tap.v * weight;
+								variance_sum += tap.w * weight * weight;
+								weight_sum += weight;
+							}
+						}
+
+						// the centre always has a weight above zero
+						filtered[index] = vec4(colour_sum / weight_sum, variance_sum / (weight_sum * weight_sum));
+					}
+				}
+			);
+
+			mem::swap(colours, filtered);
+		}
+
+		out.reserve(pixel_count);
+		out.len = pixel_count;
+		for (size_t i = 0; i < pixel_count; ++i) {
+			out[i] = vec4(colours[i].v, 1.f);
+		}
+	}
+} // namespace cpu
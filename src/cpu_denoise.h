@@ -0,0 +1,42 @@
+#pragma once
+
+#include "common.h"
+#include "vec.h"
+#include "arr.h"
+#include "slice.h"
+
+namespace cpu {
+	struct DenoiseSettings {
+		// every pass doubles the distance between the taps, 5 passes cover about 60 pixels
+		int passes = 5;
+		// how many times the noise of a pixel two neighbours can differ in brightness
+		float luminance_sigma = 4.f;
+		// higher keeps the edges between different normals sharper
+		float normal_power = 64.f;
+		// relative difference in depth allowed for every pixel of distance
+		float depth_sigma = 0.02f;
+		float albedo_sigma = 0.1f;
+	};
+
+	// the buffers written by ray_tracing_cs.hlsl, all of them are sums over every ray
+	// of the pixel so they are averaged here
+	struct DenoiseInput {
+		vec2i size = 0;
+		// rgb: sum of the light, a: number of rays
+		Slice<vec4> radiance;
+		// x: mean luminance, y: sum of squared differences from the mean, z: number of rays
+		Slice<vec4> pixel_stats;
+		// rgb: sum of the albedo of the first hit, a: number of rays
+		Slice<vec4> albedo;
+		// xyz: sum of the normal of the first hit, w: sum of its distance from the camera
+		Slice<vec4> normal_depth;
+	};
+
+	// edge avoiding a-trous wavelet filter (dammertz et al.), every pass blurs with a
+	// 5x5 kernel with the taps further apart than the last one. a tap counts less the
+	// more its first hit differs from the one of the pixel (normal, depth and albedo)
+	// and the more its brightness differs compared to how noisy the pixel still is,
+	// so the edges are kept and the pixels that have converged are barely touched.
+	// out has the same layout as radiance (with 1 ray), top row first
+	void denoise(const DenoiseInput &input, const DenoiseSettings &settings, arr<vec4> &out);
+} // namespace cpu
@@ -0,0 +1,340 @@
+#include "cpu_render.h"
+
+#include <stb_image.h>
+
+#include "sdf.h"
+#include "thr.h"
+#include "tracelog.h"
+
+namespace cpu {
+	void MinMips::build(const Volume &volume) {
+		vec3i level_size = volume.size;
+
+		for (int i = 0; i < levels; ++i) {
+			level_size = (level_size + factor - 1) / factor;
+			size[i] = level_size;
+
+			const size_t count = (size_t)level_size.x * level_size.y * level_size.z;
+			data[i].destroy();
+			data[i].reserve(count);
+			data[i].len = count;
+
+			updateLevel(volume, i, vec3i(0), level_size);
+		}
+	}
+
+	void MinMips::update(const Volume &volume, const vec3 &brush_pos, const vec3 &brush_extent) {
+		// same region as the one sculpt_cs and min_mip_cs use
+		const vec3i region_start = sdf::brushRegionStart(brush_pos, brush_extent, volume.size);
+		const vec3i region_size = sdf::brushRegionGroups(brush_extent, volume.size) * 8;
+		int cell_size = 1;
+
+		for (int i = 0; i < levels; ++i) {
+			cell_size *= factor;
+			const vec3i count = math::min((region_size + cell_size - 1) / cell_size + 2, size[i]);
+			const vec3i start = math::clamp(region_start / cell_size - 1, vec3i(0), size[i] - count);
+			updateLevel(volume, i, start, count);
+		}
+	}
+
+	float MinMips::emptySpaceStep(const vec3 &tex_pos, const vec3 &dir) const {
+		for (int i = levels - 1; i >= 0; --i) {
+			const float step = levelStep(i, tex_pos, dir);
+			if (step > 0) return step;
+		}
+		return 0;
+	}
+
+	void MinMips::updateLevel(const Volume &volume, int level, const vec3i &start, const vec3i &count) {
+		const vec3i src_size = level == 0 ? volume.size : size[level - 1];
+
+		thr::parallelFor((size_t)count.z * count.y,
+			[&](size_t index) {
+				const int z = start.z + (int)(index / count.y);
+				const int y = start.y + (int)(index % count.y);
+
+				for (int x = start.x; x < start.x + count.x; ++x) {
+					const vec3i cell = vec3i(x, y, z);
+					const vec3i src_start = cell * factor;
+					const vec3i src_end = math::min(src_start + factor, src_size - 1);
+
+					int16_t min_dist = 32767;
+					for (int sz = src_start.z; sz <= src_end.z; ++sz) {
+						for (int sy = src_start.y; sy <= src_end.y; ++sy) {
+							for (int sx = src_start.x; sx <= src_end.x; ++sx) {
+								const vec3i src = vec3i(sx, sy, sz);
+								const int16_t value = level == 0 ? volume.getRaw(src) : get(level - 1, src);
+								min_dist = math::min(min_dist, value);
+							}
+						}
+					}
+
+					data[level][(size_t)x + (size_t)y * size[level].x + (size_t)z * size[level].x * size[level].y] = min_dist;
+				}
+			}
+		);
+	}
+
+	float MinMips::levelStep(int level, const vec3 &tex_pos, const vec3 &dir) const {
+		float cell_size = (float)factor;
+		for (int i = 0; i < level; ++i) cell_size *= factor;
+
+		const vec3 cell = floor(tex_pos / cell_size);
+		const float min_dist = snorm::toFloat(get(level, math::min(vec3i(cell), size[level] - 1))) * sdf::max_step;
+		if (min_dist <= sdf::rough_min_hit_distance + 1) return 0;
+
+		// same as cellExitDistance in common.hlsl
+		const vec3 cell_min = cell * cell_size;
+		float exit_dist = 1e20f;
+		for (int i = 0; i < 3; ++i) {
+			if (fabsf(dir[i]) < 1e-6f) continue;
+			const float exit_plane = cell_min[i] + (dir[i] > 0 ? cell_size : 0.f);
+			exit_dist = math::min(exit_dist, (exit_plane - tex_pos[i]) / dir[i]);
+		}
+
+		return math::max(exit_dist, 0.f) + min_dist;
+	}
+
+	vec3 calcNormal(const Volume &volume, const vec3 &tex_pos) {
+		const vec2 k = vec2(1, -1);
+		const vec3 a = vec3(k.x, k.y, k.y);
+		const vec3 b = vec3(k.y, k.y, k.x);
+		const vec3 c = vec3(k.y, k.x, k.y);
+		const vec3 d = vec3(k.x, k.x, k.x);
+
+		return norm(
+			a * volume.sample(tex_pos + a * sdf::normal_step) +
+			b * volume.sample(tex_pos + b * sdf::normal_step) +
+			c * volume.sample(tex_pos + c * sdf::normal_step) +
+			d * volume.sample(tex_pos + d * sdf::normal_step)
+		);
+	}
+
+	MarchResult rayMarch(const Volume &volume, const MinMips *mips, const vec3 &ray_origin, const vec3 &ray_dir) {
+		constexpr int max_steps = 500;
+
+		const vec3 size = vec3(volume.size);
+		const vec3 centre = size * 0.5f;
+		float distance_traveled = 0;
+		MarchResult result;
+
+		for (; result.steps < max_steps; ++result.steps) {
+			const vec3 current_pos = ray_origin + ray_dir * distance_traveled;
+			float closest = sdf::box(current_pos, vec3(0), size);
+
+			// we're at least inside the texture
+			if (closest < sdf::min_hit_distance) {
+				result.entered = true;
+				const vec3 tex_pos = math::clamp(current_pos + centre, vec3(0), size - 1.f);
+				closest = snorm::toFloat(volume.getRaw(vec3i(round(tex_pos)))) * sdf::max_step;
+
+				if (mips && closest > sdf::rough_min_hit_distance + 1) {
+					closest = math::max(closest, mips->emptySpaceStep(tex_pos, ray_dir));
+				}
+
+				if (closest < sdf::rough_min_hit_distance) {
+					closest = volume.sample(tex_pos) * sdf::max_step;
+
+					if (closest < sdf::min_hit_distance) {
+						result.hit = true;
+						result.pos = current_pos;
+						return result;
+					}
+				}
+			}
+
+			if (distance_traveled > sdf::max_trace_distance) {
+				break;
+			}
+
+			distance_traveled += closest;
+		}
+
+		return result;
+	}
+
+	// == IMAGE ==================================================================
+
+	Image::Image(const char *filename) {
+		load(filename);
+	}
+
+	bool Image::load(const char *filename) {
+		int channels = 0;
+		vec2i new_size = 0;
+		const bool is_hdr = stbi_is_hdr(filename);
+
+		// stbi_loadf would apply a gamma curve to ldr images, the gpu just reads them as unorm
+		void *pixels = is_hdr ?
+			(void *)stbi_loadf(filename, &new_size.x, &new_size.y, &channels, 3) :
+			(void *)stbi_load(filename, &new_size.x, &new_size.y, &channels, 3);
+
+		if (!pixels) {
+			err("stbi fail: %s", stbi_failure_reason());
+			return false;
+		}
+
+		const size_t count = (size_t)new_size.x * new_size.y;
+		data.destroy();
+		data.reserve(count);
+		data.len = count;
+		size = new_size;
+
+		for (size_t i = 0; i < count; ++i) {
+			if (is_hdr) {
+				const float *p = (const float *)pixels + i * 3;
+				data[i] = vec3(p[0], p[1], p[2]);
+			}
+			else {
+				const uint8_t *p = (const uint8_t *)pixels + i * 3;
+				data[i] = vec3(p[0], p[1], p[2]) / 255.f;
+			}
+		}
+
+		stbi_image_free(pixels);
+		return true;
+	}
+
+	vec3 Image::sample(const vec2 &uv) const {
+		if (data.empty()) return 0;
+
+		// texel centres are at half coordinates
+		const vec2 pos = uv * vec2(size) - 0.5f;
+		const vec2 start = floor(pos);
+		const vec2 delta = pos - start;
+
+		const auto &wrap = [](int v, int s) {
+			v %= s;
+			return v < 0 ? v + s : v;
+		};
+
+		const int x0 = wrap((int)start.x, size.x);
+		const int y0 = wrap((int)start.y, size.y);
+		const int x1 = wrap(x0 + 1, size.x);
+		const int y1 = wrap(y0 + 1, size.y);
+
+		const vec3 c0 = get(x0, y0) * (1.f - delta.x) + get(x1, y0) * delta.x;
+		const vec3 c1 = get(x0, y1) * (1.f - delta.x) + get(x1, y1) * delta.x;
+		return c0 * (1.f - delta.y) + c1 * delta.y;
+	}
+
+	// == SHADING ================================================================
+
+	vec3 triplanarBlend(const Image &material, const vec3 &tex_pos, const vec3 &normal, const vec3 &size) {
+		const vec3 blend = abs(normal);
+		const vec3 weights = blend / (blend.x + blend.y + blend.z);
+		const vec3 tex_coords = tex_pos / size;
+
+		return
+			material.sample(vec2(tex_coords.z, tex_coords.y)) * weights.x +
+			material.sample(vec2(tex_coords.x, tex_coords.z)) * weights.y +
+			material.sample(vec2(tex_coords.x, tex_coords.y)) * weights.z;
+	}
+
+	vec3 environmentColour(const Image *background, const vec3 &dir) {
+		if (!background) return 1;
+
+		vec2 uv;
+		uv.x = 0.5f + atan2f(dir.z, dir.x) / math::pi2;
+		uv.y = 0.5f - asinf(math::clamp(dir.y, -1.f, 1.f)) / math::pi;
+		return background->sample(uv);
+	}
+
+	vec3 toneMapping(vec3 colour, float exposure_bias) {
+		const auto &uncharted2 = [](const vec3 &x) {
+			constexpr float A = 0.15f;
+			constexpr float B = 0.50f;
+			constexpr float C = 0.10f;
+			constexpr float D = 0.20f;
+			constexpr float E = 0.02f;
+			constexpr float F = 0.30f;
+			return ((x * (x * A + C * B) + D * E) / (x * (x * A + B) + D * F)) - E / F;
+		};
+
+		constexpr float W = 11.2f;
+		colour = uncharted2(colour * exposure_bias);
+		colour = colour / uncharted2(vec3(W));
+		return vec3(
+			powf(math::max(colour.x, 0.f), 1.f / 2.2f),
+			powf(math::max(colour.y, 0.f), 1.f / 2.2f),
+			powf(math::max(colour.z, 0.f), 1.f / 2.2f)
+		);
+	}
+
+	vec3 shadePixel(const Volume &volume, const RenderSettings &settings, const vec2 &uv, float one_over_aspect_ratio) {
+		// convert to range (-1, 1)
+		vec2 screen = uv * 2.f - 1.f;
+		screen.y *= one_over_aspect_ratio;
+
+		const vec3 ray_dir = norm(settings.cam_fwd + settings.cam_right * screen.x + settings.cam_up * screen.y);
+		const vec3 ray_origin = settings.cam_pos + settings.cam_fwd * settings.cam_zoom;
+
+		const MarchResult march = rayMarch(volume, settings.mips, ray_origin, ray_dir);
+		vec3 colour = 1;
+
+		if (march.hit) {
+			const vec3 light_pos = vec3(sinf(settings.time) * 2.f, -5.f, cosf(settings.time) * 2.f) * 20.f;
+			const vec3 light_dir = norm(vec3(0) - light_pos);
+
+			const vec3 size = vec3(volume.size);
+			const vec3 tex_pos = math::clamp(march.pos + size * 0.5f, vec3(0), size - 1.f);
+			const vec3 normal = calcNormal(volume, tex_pos);
+
+			vec3 albedo = settings.albedo;
+			if (settings.material) {
+				albedo *= triplanarBlend(*settings.material, tex_pos, normal, size);
+			}
+
+			const float diffuse_intensity = math::max(0.f, dot(normal, light_dir));
+			const float ambient_intensity = 0.35f;
+			colour = albedo * saturate(diffuse_intensity + ambient_intensity);
+		}
+		else {
+			colour = environmentColour(settings.background, ray_dir);
+			// remove some opacity if it is outside the texture
+			if (!march.entered) {
+				colour = colour * 0.5f + 0.5f;
+			}
+		}
+
+		return settings.use_tonemapping ? toneMapping(colour, settings.exposure_bias) : colour;
+	}
+
+	void render(const Volume &volume, const RenderSettings &settings, const vec2i &size, arr<uint8_t> &out_rgba) {
+		// small tiles so that the expensive parts of the image (the ones close
+		// to the surface) are spread over all the threads
+		constexpr int tile_size = 16;
+
+		const size_t pixel_count = (size_t)size.x * size.y;
+		out_rgba.destroy();
+		out_rgba.reserve(pixel_count * 4);
+		out_rgba.len = pixel_count * 4;
+
+		const vec2i tile_count = (size + tile_size - 1) / tile_size;
+		const float one_over_aspect_ratio = (float)size.y / (float)size.x;
+
+		thr::parallelFor((size_t)tile_count.x * tile_count.y,
+			[&](size_t index) {
+				const vec2i tile_start = vec2i((int)(index % tile_count.x), (int)(index / tile_count.x)) * tile_size;
+				const vec2i tile_end = vec2i(math::min(tile_start.x + tile_size, size.x), math::min(tile_start.y + tile_size, size.y));
+
+				for (int y = tile_start.y; y < tile_end.y; ++y) {
+					for (int x = tile_start.x; x < tile_end.x; ++x) {
+						// the uvs of the full screen triangle start from the bottom left
+						const vec2 uv = vec2(
+							((float)x + 0.5f) / (float)size.x,
+							1.f - ((float)y + 0.5f) / (float)size.y
+						);
+						const vec3 colour = saturate(shadePixel(volume, settings, uv, one_over_aspect_ratio));
+
+						uint8_t *pixel = out_rgba.buf + ((size_t)x + (size_t)y * size.x) * 4;
+						pixel[0] = (uint8_t)(colour.x * 255.f + 0.5f);
+						pixel[1] = (uint8_t)(colour.y * 255.f + 0.5f);
+						pixel[2] = (uint8_t)(colour.z * 255.f + 0.5f);
+						pixel[3] = 255;
+					}
+				}
+			}
+		);
+	}
+} // namespace cpu
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "volume.h"
+
+namespace cpu {
+	// cpu version of the min-distance mips in common.hlsl, each level is 4 times
+	// smaller than the previous one and every cell stores the smallest distance
+	// inside of it (including the first voxel of the next cell)
+	struct MinMips {
+		static constexpr int levels = 3;
+		static constexpr int factor = 4;
+
+		void build(const Volume &volume);
+		// only updates the cells that a sculpt operation could have changed
+		void update(const Volume &volume, const vec3 &brush_pos, const vec3 &brush_extent);
+		// same as emptySpaceStep in common.hlsl
+		float emptySpaceStep(const vec3 &tex_pos, const vec3 &dir) const;
+
+		int16_t get(int level, const vec3i &cell) const {
+			return data[level][(size_t)cell.x + (size_t)cell.y * size[level].x + (size_t)cell.z * size[level].x * size[level].y];
+		}
+
+		vec3i size[levels];
+		arr<int16_t> data[levels];
+
+	private:
+		void updateLevel(const Volume &volume, int level, const vec3i &start, const vec3i &count);
+		float levelStep(int level, const vec3 &tex_pos, const vec3 &dir) const;
+	};
+
+	// same as calcNormal in main_ps.hlsl, tex_pos is in texture space
+	vec3 calcNormal(const Volume &volume, const vec3 &tex_pos);
+
+	struct MarchResult {
+		bool hit = false;
+		// if the ray ever got inside the volume's bounding box
+		bool entered = false;
+		vec3 pos = 0;
+		int steps = 0;
+	};
+
+	// reference ray marcher, same as rayMarch in main_ps.hlsl (without the lights).
+	// if mips is not null it uses them to skip empty space
+	MarchResult rayMarch(const Volume &volume, const MinMips *mips, const vec3 &ray_origin, const vec3 &ray_dir);
+
+	// rgb image that is sampled the same way as a Texture2D with the default
+	// sampler (linear filtering, wrap addressing)
+	struct Image {
+		Image() = default;
+		Image(const char *filename);
+
+		// hdr files are kept as they are, everything else is mapped to [0, 1]
+		bool load(const char *filename);
+		vec3 sample(const vec2 &uv) const;
+
+		vec3 get(int x, int y) const {
+			return data[(size_t)x + (size_t)y * size.x];
+		}
+
+		vec2i size = 0;
+		arr<vec3> data;
+	};
+
+	// same as getTriplanarBlend in main_ps.hlsl, tex_pos is in texture space
+	vec3 triplanarBlend(const Image &material, const vec3 &tex_pos, const vec3 &normal, const vec3 &size);
+	// same as getBackground in main_ps.hlsl, white if there is no background
+	vec3 environmentColour(const Image *background, const vec3 &dir);
+	// same as toneMapping in common.hlsl
+	vec3 toneMapping(vec3 colour, float exposure_bias);
+
+	// same values as the ones main_ps.hlsl gets through its constant buffers
+	struct RenderSettings {
+		vec3 cam_pos = 0;
+		vec3 cam_fwd = vec3(0, 0, 1);
+		vec3 cam_right = vec3(1, 0, 0);
+		vec3 cam_up = vec3(0, 1, 0);
+		float cam_zoom = 0;
+		// the light moves with time
+		float time = 0;
+		bool use_tonemapping = true;
+		float exposure_bias = 1.f;
+
+		vec3 albedo = 1;
+		// if not null it's mapped over the volume using triplanar mapping
+		const Image *material = nullptr;
+		// if null, everything that doesn't hit the volume is white
+		const Image *background = nullptr;
+		// optional, only used to skip empty space
+		const MinMips *mips = nullptr;
+	};
+
+	// colour of a single pixel, same as rayMarch in main_ps.hlsl without the
+	// lights and the brush preview. the result is already tonemapped if
+	// use_tonemapping is true
+	vec3 shadePixel(const Volume &volume, const RenderSettings &settings, const vec2 &uv, float one_over_aspect_ratio);
+
+	// renders the whole image in rgba8 (top row first), the image is split in
+	// tiles that are rendered in parallel
+	void render(const Volume &volume, const RenderSettings &settings, const vec2i &size, arr<uint8_t> &out_rgba);
+} // namespace cpu
\ No newline at end of file
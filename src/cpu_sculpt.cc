@@ -0,0 +1,218 @@
+#include "cpu_sculpt.h"
+
+#include "sdf.h"
+#include "thr.h"
+
+// each tile is exactly one brick, this way threads never write to the same brick
+constexpr int tile_size = Volume::brick_size;
+static_assert(tile_size == DirtyTracker::brick_size);
+
+// == PRIVATE FUNCTIONS ========================================================
+
+struct SculptData {
+	Volume &volume;
+	const Volume &brush;
+	const OperationData &oper;
+	const BrushData &brush_data;
+	vec3 volume_size;
+	vec3 brush_size;
+};
+
+static float lerp(float a, float b, float t) {
+	return a + t * (b - a);
+}
+
+// region of the volume split in tiles, [start, end)
+struct TileRegion {
+	// start gets aligned down to the tile size
+	TileRegion(const vec3i &start, const vec3i &end)
+		: start((start / tile_size) * tile_size), end(end), tiles((end - this->start + tile_size - 1) / tile_size) {}
+
+	size_t count() const {
+		if (any(tiles <= 0)) return 0;
+		return (size_t)tiles.x * tiles.y * tiles.z;
+	}
+
+	vec3i start;
+	vec3i end;
+	vec3i tiles;
+};
+
+static vec3i getTileStart(const TileRegion &region, size_t tile_index) {
+	const vec3i tile = vec3i(
+		(int)(tile_index % region.tiles.x),
+		(int)((tile_index / region.tiles.x) % region.tiles.y),
+		(int)(tile_index / ((size_t)region.tiles.x * region.tiles.y))
+	);
+	return region.start + tile * tile_size;
+}
+
+template<typename TFn>
+static void forEachInTile(const TileRegion &region, const vec3i &start, TFn &&fn) {
+	const vec3i end = math::min(start + tile_size, region.end);
+
+	for (int z = start.z; z < end.z; ++z) {
+		for (int y = start.y; y < end.y; ++y) {
+			for (int x = start.x; x < end.x; ++x) {
+				fn(vec3i(x, y, z));
+			}
+		}
+	}
+}
+
+static float sampleBrush(const SculptData &s, const vec3 &position) {
+	return s.brush.sample(position / s.oper.scale);
+}
+
+// returns true if the voxel has changed
+static bool setVolume(const SculptData &s, const vec3i &id, float new_value) {
+	const int16_t old_raw = s.volume.getRaw(id);
+	const float old_value = snorm::toFloat(old_raw);
+	// the smooth formulas don't work if the values are <1, so premultiply them by
+	// max_step and then divide it again at the end
+	const float vold = old_value * sdf::max_step;
+	const float vnew = new_value * sdf::max_step;
+	const float k = s.oper.smooth_k;
+
+	switch ((Operations)s.oper.operation) {
+		case Operations::Union:
+			if (new_value < old_value) {
+				s.volume.set(id, new_value);
+			}
+			break;
+		case Operations::Subtraction:
+			if (-new_value > old_value) {
+				s.volume.set(id, -new_value);
+			}
+			break;
+		case Operations::SmoothUnion:
+		{
+			const float h = math::clamp(0.5f + 0.5f * (vnew - vold) / k, 0.f, 1.f);
+			const float result = lerp(vnew, vold, h) - k * h * (1.f - h);
+			s.volume.set(id, result / sdf::max_step);
+			break;
+		}
+		case Operations::SmoothSubtraction:
+		{
+			const float h = math::clamp(0.5f - 0.5f * (vold + vnew) / k, 0.f, 1.f);
+			const float result = lerp(vold, -vnew, h) + k * h * (1.f - h);
+			s.volume.set(id, result / sdf::max_step);
+			break;
+		}
+		default: break;
+	}
+
+	return s.volume.getRaw(id) != old_raw;
+}
+
+static bool writeApproximateDistance(const SculptData &s, const vec3 &pos, const vec3i &id) {
+	// look at writeApproximateDistance in sculpt_cs.hlsl for an explanation
+	const vec3 edge_pos = math::clamp(pos, vec3(0), s.brush_size * s.oper.scale);
+	float distance = sampleBrush(s, edge_pos) * sdf::max_step;
+	distance = math::max(distance, 0.f);
+	distance += (pos - edge_pos).mag();
+	distance *= 0.9f;
+	distance = saturate(distance / sdf::max_step);
+
+	return setVolume(s, id, distance);
+}
+
+static bool sculptVoxel(const SculptData &s, const vec3i &id) {
+	vec3 pos = vec3(id) - s.volume_size * 0.5f;
+	const float dist_from_tex = sdf::box(pos, s.brush_data.position, s.brush_size * s.oper.scale);
+	pos = pos - s.brush_data.position + s.brush_size * s.oper.scale * 0.5f;
+
+	if (dist_from_tex > 0) {
+		if (dist_from_tex < sdf::max_step) {
+			return writeApproximateDistance(s, pos, id);
+		}
+		return false;
+	}
+
+	return setVolume(s, id, sampleBrush(s, pos));
+}
+
+// == PUBLIC FUNCTIONS =========================================================
+
+namespace cpu {
+	void sculpt(Volume &volume, const Volume &brush, const OperationData &oper, const BrushData &brush_data, DirtyTracker *dirty) {
+		const SculptData s = { volume, brush, oper, brush_data, vec3(volume.size), vec3(brush.size) };
+
+		const bool is_smooth = oper.operation & (uint32_t)Operations::Smooth;
+		const bool is_union = oper.operation & (uint32_t)Operations::Union;
+
+		// only the voxels inside the brush bounding box plus max_step on each side can change.
+		// the approximate distance written outside of the brush is always at least 0.9 times
+		// the distance from it, so in narrow band mode the voxels further away than
+		// band / 0.9 would only be clamped back to the band. this isn't true for the smooth
+		// operations as they can also lower values that are already at the band
+		float falloff = sdf::max_step;
+		if (!is_smooth) {
+			falloff = math::min(falloff, volume.getBandWidth() / 0.9f);
+		}
+
+		const vec3 half_region = s.brush_size * oper.scale * 0.5f + falloff;
+		const vec3 centre = brush_data.position + s.volume_size * 0.5f;
+		const TileRegion region = {
+			math::max(vec3i(floor(centre - half_region)), vec3i(0)),
+			math::min(vec3i(ceil(centre + half_region)) + 1, volume.size)
+		};
+
+		// (smooth) union can only lower values and (smooth) subtraction can only raise them,
+		// so bricks that are already fully inside/outside the band can't change
+		const int16_t skip_value = volume.getBandValue(is_union);
+
+		thr::parallelFor(region.count(),
+			[&s, &region, skip_value, dirty](size_t tile_index) {
+				const vec3i start = getTileStart(region, tile_index);
+				const size_t brick = s.volume.brickIndex(start);
+				if (s.volume.isUniform(brick, skip_value)) {
+					return;
+				}
+
+				bool has_changed = false;
+				forEachInTile(region, start,
+					[&s, &has_changed](const vec3i &id) {
+						has_changed |= sculptVoxel(s, id);
+					}
+				);
+				// sculpting often leaves bricks completely full or empty
+				s.volume.compactBrick(brick);
+
+				// tiles and bricks are the same size, so only this thread touches it
+				if (dirty && has_changed) {
+					dirty->mark(dirty->brickIndex(start / DirtyTracker::brick_size));
+				}
+			}
+		);
+	}
+
+	void fill(Volume &volume, Shapes shape, const ShapeData &data, DirtyTracker *dirty) {
+		const vec3 size = vec3(volume.size);
+		const TileRegion region = { vec3i(0), volume.size };
+
+		thr::parallelFor(region.count(),
+			[&](size_t tile_index) {
+				const vec3i start = getTileStart(region, tile_index);
+				forEachInTile(region, start,
+					[&](const vec3i &id) {
+						const vec3 pos = vec3(id) - size * 0.5f;
+						float value = 1.f;
+						switch (shape) {
+							case Shapes::Sphere:   value = sdf::sphere(pos, data.position, data.sphere.radius); break;
+							case Shapes::Box:      value = sdf::box(pos, data.position, data.box.size); break;
+							case Shapes::Cylinder: value = sdf::cylinder(pos, data.position, data.cylinder.radius, data.cylinder.height); break;
+							default:               value = sdf::max_step; break;
+						}
+						volume.set(id, math::min(value / sdf::max_step, 1.f));
+					}
+				);
+				volume.compactBrick(volume.brickIndex(start));
+			}
+		);
+
+		if (dirty) {
+			dirty->markAll();
+		}
+	}
+} // namespace cpu
\ No newline at end of file
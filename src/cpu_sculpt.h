@@ -0,0 +1,17 @@
+#pragma once
+
+#include "volume.h"
+#include "brush_editor.h"
+#include "dirty_tracker.h"
+
+// CPU versions of the sculpting compute shaders, they work on the same data
+// layout so their results match the GPU ones (within snorm rounding).
+// the work is split in 8x8x8 tiles, the same as the thread groups in the shaders,
+// and spread over all the cores
+namespace cpu {
+	// same as shaders/sculpt_cs.hlsl, only the tiles that the brush can reach are processed.
+	// if dirty is not null, the bricks that actually changed are marked in it
+	void sculpt(Volume &volume, const Volume &brush, const OperationData &oper, const BrushData &brush_data, DirtyTracker *dirty = nullptr);
+	// same as shaders/fill_texture_cs.hlsl
+	void fill(Volume &volume, Shapes shape, const ShapeData &data, DirtyTracker *dirty = nullptr);
+} // namespace cpu
\ No newline at end of file
@@ -0,0 +1,283 @@
+#include "cpu_trace.h"
+
+#include <stb_image_write.h>
+
+#include "sdf.h"
+#include "thr.h"
+#include "tracelog.h"
+
+namespace cpu {
+	// == RANDOM =================================================================
+	// same as the random functions in ray_tracing_cs.hlsl
+
+	static float random(uint &state) {
+		state = state * 747796405u + 2891336453u;
+		uint result = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+		result = (result >> 22) ^ result;
+		return (float)(result / 4294967295.0);
+	}
+
+	static float randomNormDistribution(uint &state) {
+		const float theta = math::pi2 * random(state);
+		// avoid log(0), the shader would just get an infinity
+		const float rho = sqrtf(-2.f * logf(math::max(random(state), 1e-10f)));
+		return rho * cosf(theta);
+	}
+
+	static vec3 randomDir(uint &state) {
+		return norm(vec3(
+			randomNormDistribution(state),
+			randomNormDistribution(state),
+			randomNormDistribution(state)
+		));
+	}
+
+	static vec2 randomPointInCircle(uint &state) {
+		const float angle = random(state) * math::pi2;
+		const vec2 point_on_circle = vec2(cosf(angle), sinf(angle));
+		return point_on_circle * sqrtf(random(state));
+	}
+
+	// == RAY TRACING ============================================================
+
+	struct HitInfo {
+		bool hit = false;
+		vec3 normal = 0;
+		vec3 position = 0;
+		vec3 albedo = 0;
+		vec3 light = 0;
+	};
+
+	// same as lightDistance in ray_tracing_cs.hlsl
+	static float lightDistance(const TraceSettings &settings, const vec3 &pos, uint bounce, size_t &light_id) {
+		float dist = sdf::max_step;
+
+		if (settings.light_bvh) {
+			settings.light_bvh->traverse(pos, dist, [&](uint i) {
+				const TraceLight &light = settings.lights[i];
+				if (light.render || bounce) {
+					const float light_dist = sdf::sphere(pos, light.pos, light.radius);
+					if (light_dist < dist) {
+						dist = light_dist;
+						light_id = i;
+					}
+				}
+				return dist;
+			});
+			return dist;
+		}
+
+		for (size_t i = 0; i < settings.lights.len; ++i) {
+			const TraceLight &light = settings.lights[i];
+			if (light.render || bounce) {
+				const float light_dist = sdf::sphere(pos, light.pos, light.radius);
+				if (light_dist < dist) {
+					dist = light_dist;
+					light_id = i;
+				}
+			}
+		}
+		return dist;
+	}
+
+	// same as rayMarch in ray_tracing_cs.hlsl
+	static HitInfo marchScene(const Volume &volume, const TraceSettings &settings, const vec3 &ro, const vec3 &rd, uint bounce) {
+		constexpr int max_steps = 500;
+
+		const vec3 size = vec3(volume.size);
+		const vec3 centre = size * 0.5f;
+		float distance_traveled = 0;
+		HitInfo info;
+
+		for (int step_count = 0; step_count < max_steps; ++step_count) {
+			const vec3 current_pos = ro + rd * distance_traveled;
+			float closest = sdf::box(current_pos, vec3(0), size);
+			size_t light_id = settings.lights.len;
+			const float light_dist = lightDistance(settings, current_pos, bounce, light_id);
+
+			if (light_dist < sdf::min_hit_distance) {
+				const TraceLight &light = settings.lights[light_id];
+				info.hit = true;
+				info.normal = norm(current_pos - light.pos);
+				info.position = current_pos;
+				info.light = light.colour;
+				break;
+			}
+
+			// we're at least inside the texture
+			if (closest < sdf::min_hit_distance) {
+				const vec3 tex_pos = math::clamp(current_pos + centre, vec3(0), size - 1.f);
+				closest = snorm::toFloat(volume.getRaw(vec3i(round(tex_pos)))) * sdf::max_step;
+
+				if (settings.mips && closest > sdf::rough_min_hit_distance + 1) {
+					closest = math::max(closest, settings.mips->emptySpaceStep(tex_pos, rd));
+				}
+
+				if (closest < sdf::rough_min_hit_distance) {
+					closest = volume.sample(tex_pos) * sdf::max_step;
+
+					if (closest < sdf::min_hit_distance) {
+						const TraceMaterial &material = settings.material;
+						info.hit = true;
+						info.normal = calcNormal(volume, tex_pos);
+						info.position = current_pos;
+						info.albedo = material.albedo;
+						if (material.diffuse) {
+							info.albedo *= triplanarBlend(*material.diffuse, tex_pos, info.normal, size);
+						}
+						info.light = material.emissive_colour;
+						break;
+					}
+				}
+			}
+
+			if (distance_traveled > settings.maximum_trace_dist) {
+				break;
+			}
+
+			distance_traveled += math::min(closest, light_dist);
+		}
+
+		return info;
+	}
+
+	// same as rayTrace in ray_tracing_cs.hlsl, but without sampling the lights and
+	// the background directly, and with white noise instead of the sample sequence.
+	// it converges to the same image, just more slowly
+	static vec3 rayTrace(const Volume &volume, const TraceSettings &settings, vec3 ro, vec3 rd, uint &state) {
+		const TraceMaterial &material = settings.material;
+		vec3 incoming_light = 0;
+		vec3 ray_colour = 1;
+
+		for (uint bounce = 0; bounce <= settings.maximum_bounces; ++bounce) {
+			const HitInfo info = marchScene(volume, settings, ro, rd, bounce);
+
+			// no hit
+			if (!info.hit) {
+				incoming_light += environmentColour(settings.background, rd) * ray_colour;
+				break;
+			}
+
+			ro = info.position + info.normal;
+			const vec3 diffuse_dir = norm(info.normal + randomDir(state));
+			const vec3 specular_dir = rd - info.normal * 2.f * dot(rd, info.normal);
+			const bool is_specular_bounce = material.specular_probability >= random(state);
+			const float specular_amount = is_specular_bounce ? material.smoothness : 0.f;
+			rd = diffuse_dir + (specular_dir - diffuse_dir) * specular_amount;
+
+			incoming_light += info.light * ray_colour;
+			ray_colour *= is_specular_bounce ? material.specular_colour : info.albedo;
+		}
+
+		return incoming_light;
+	}
+
+	// == PATH TRACER ============================================================
+
+	void PathTracer::resize(const vec2i &new_size) {
+		size = new_size;
+		const size_t count = (size_t)size.x * size.y;
+		accumulated.destroy();
+		accumulated.reserve(count);
+		accumulated.len = count;
+		reset();
+	}
+
+	void PathTracer::reset() {
+		num_rendered_frames = 0;
+		accumulated.fill(vec3(0));
+	}
+
+	void PathTracer::renderFrame(const Volume &volume, const TraceSettings &settings) {
+		// the shader goes over 128x128 pixels per dispatch, here smaller tiles
+		// spread the work more evenly between threads
+		constexpr int tile_size = 16;
+
+		if (accumulated.empty()) return;
+
+		const vec2i tile_count = (size + tile_size - 1) / tile_size;
+		const float one_over_aspect_ratio = (float)size.y / (float)size.x;
+		const vec3 ray_origin = settings.cam_pos + settings.cam_fwd * settings.cam_zoom;
+		const float jitter = settings.jitter_amount / 1000.f;
+		const uint ray_count = math::max(settings.maximum_rays, 1u);
+		// running average, same as the lerp at the end of ray_tracing_cs.hlsl
+		const float blend = 1.f / (float)(num_rendered_frames + 1);
+
+		thr::parallelFor((size_t)tile_count.x * tile_count.y,
+			[&](size_t index) {
+				const vec2i tile_start = vec2i((int)(index % tile_count.x), (int)(index / tile_count.x)) * tile_size;
+				const vec2i tile_end = vec2i(math::min(tile_start.x + tile_size, size.x), math::min(tile_start.y + tile_size, size.y));
+
+				for (int y = tile_start.y; y < tile_end.y; ++y) {
+					for (int x = tile_start.x; x < tile_end.x; ++x) {
+						vec2 uv = vec2((float)x / size.x, 1.f - (float)y / size.y);
+						// convert to range (-1, 1)
+						uv = uv * 2.f - 1.f;
+						uv.y *= one_over_aspect_ratio;
+
+						uint rng_state = (uint)y * size.x + (uint)x + num_rendered_frames * 12345u;
+						const vec3 focus_point = settings.cam_fwd + settings.cam_right * uv.x + settings.cam_up * uv.y;
+
+						vec3 total_light = 0;
+						for (uint ray = 0; ray < ray_count; ++ray) {
+							const vec2 aa_jitter = randomPointInCircle(rng_state) * jitter;
+							const vec3 aa_focus_point = focus_point + settings.cam_right * aa_jitter.x + settings.cam_up * aa_jitter.y;
+							total_light += rayTrace(volume, settings, ray_origin, norm(aa_focus_point), rng_state);
+						}
+
+						vec3 &pixel = accumulated[(size_t)x + (size_t)y * size.x];
+						const vec3 colour = total_light / (float)ray_count;
+						pixel = pixel + (colour - pixel) * blend;
+					}
+				}
+			}
+		);
+
+		++num_rendered_frames;
+	}
+
+	void PathTracer::getImage(const TraceSettings &settings, arr<uint8_t> &out_rgba) const {
+		out_rgba.destroy();
+		out_rgba.reserve(accumulated.len * 4);
+		out_rgba.len = accumulated.len * 4;
+
+		for (size_t i = 0; i < accumulated.len; ++i) {
+			vec3 colour = accumulated[i];
+			if (settings.use_tonemapping) {
+				colour = toneMapping(colour, settings.exposure_bias);
+			}
+			colour = saturate(colour);
+
+			uint8_t *pixel = out_rgba.buf + i * 4;
+			pixel[0] = (uint8_t)(colour.x * 255.f + 0.5f);
+			pixel[1] = (uint8_t)(colour.y * 255.f + 0.5f);
+			pixel[2] = (uint8_t)(colour.z * 255.f + 0.5f);
+			pixel[3] = 255;
+		}
+	}
+
+	bool PathTracer::savePng(const char *filename, const TraceSettings &settings) const {
+		arr<uint8_t> rgba;
+		getImage(settings, rgba);
+
+		if (!stbi_write_png(filename, size.x, size.y, 4, rgba.buf, size.x * 4)) {
+			err("couldn't save path traced image to %s", filename);
+			return false;
+		}
+
+		info("saved path traced image to %s (%u frames)", filename, num_rendered_frames);
+		return true;
+	}
+
+	bool PathTracer::saveHdr(const char *filename) const {
+		static_assert(sizeof(vec3) == sizeof(float) * 3, "vec3 must be tightly packed");
+
+		if (!stbi_write_hdr(filename, size.x, size.y, 3, (const float *)accumulated.buf)) {
+			err("couldn't save path traced image to %s", filename);
+			return false;
+		}
+
+		info("saved path traced image to %s (%u frames)", filename, num_rendered_frames);
+		return true;
+	}
+} // namespace cpu
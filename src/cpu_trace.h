@@ -0,0 +1,79 @@
+#pragma once
+
+#include "cpu_render.h"
+#include "slice.h"
+#include "light_bvh.h"
+
+namespace cpu {
+	// same as Material in ray_tracing_cs.hlsl
+	struct TraceMaterial {
+		vec3 albedo = 1;
+		// if not null it's mapped over the volume using triplanar mapping
+		const Image *diffuse = nullptr;
+		vec3 specular_colour = 1;
+		float smoothness = 0;
+		vec3 emissive_colour = 0;
+		float specular_probability = 0;
+	};
+
+	// same as LightData in common.hlsl
+	struct TraceLight {
+		vec3 pos = 0;
+		float radius = 1;
+		vec3 colour = 1;
+		// if false the light is only visible in the bounces
+		bool render = true;
+	};
+
+	// same values as the ones ray_tracing_cs.hlsl gets through its constant buffers
+	struct TraceSettings {
+		vec3 cam_pos = 0;
+		vec3 cam_fwd = vec3(0, 0, 1);
+		vec3 cam_right = vec3(1, 0, 0);
+		vec3 cam_up = vec3(0, 1, 0);
+		float cam_zoom = 0;
+		bool use_tonemapping = true;
+		float exposure_bias = 2.f;
+
+		uint maximum_bounces = 10;
+		uint maximum_rays = 10;
+		float maximum_trace_dist = 3000.f;
+		float jitter_amount = 1.f;
+
+		TraceMaterial material;
+		Slice<TraceLight> lights;
+		// optional, built from lights (in the same order), only used to skip the lights far away
+		const LightBVH *light_bvh = nullptr;
+		// if null the environment is white
+		const Image *background = nullptr;
+		// optional, only used to skip empty space
+		const MinMips *mips = nullptr;
+	};
+
+	// CPU version of the progressive path tracer in ray_tracing_cs.hlsl.
+	// every call to renderFrame shoots maximum_rays rays per pixel and blends
+	// them with the previous frames, the image is split in tiles that are
+	// rendered in parallel.
+	// it's a reference, not a copy: it only samples the bsdf, with white noise.
+	// there is no next event estimation, no importance sampling of the
+	// environment and no adaptive sampling, so it converges to the same image
+	// as the shader but needs a lot more frames to get there.
+	// unlike the shader, the image is accumulated before tonemapping so that
+	// it can also be saved as an hdr file. used by the headless trace command
+	struct PathTracer {
+		void resize(const vec2i &new_size);
+		void reset();
+		void renderFrame(const Volume &volume, const TraceSettings &settings);
+
+		// tonemapped (if use_tonemapping is true) rgba8, top row first
+		void getImage(const TraceSettings &settings, arr<uint8_t> &out_rgba) const;
+		bool savePng(const char *filename, const TraceSettings &settings) const;
+		// linear colours, without tonemapping
+		bool saveHdr(const char *filename) const;
+
+		vec2i size = 0;
+		// running average of every frame rendered, top row first
+		arr<vec3> accumulated;
+		uint num_rendered_frames = 0;
+	};
+} // namespace cpu
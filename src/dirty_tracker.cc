@@ -0,0 +1,91 @@
+#include "dirty_tracker.h"
+
+void DirtyTracker::init(const vec3i &new_volume_size) {
+	cleanup();
+	volume_size = new_volume_size;
+	brick_count = (volume_size + brick_size - 1) / brick_size;
+
+	const size_t count = (size_t)brick_count.x * brick_count.y * brick_count.z;
+	// calloc'd memory, so every brick starts at version 0 (clean)
+	brick_version.reserve(count);
+	brick_version.len = count;
+}
+
+void DirtyTracker::cleanup() {
+	brick_version.destroy();
+	volume_size = 0;
+	brick_count = 0;
+}
+
+void DirtyTracker::markRegion(const vec3i &start, const vec3i &end) {
+	const vec3i first = math::max(start, vec3i(0)) / brick_size;
+	const vec3i last = math::min((end + brick_size - 1) / brick_size, brick_count);
+
+	for (int z = first.z; z < last.z; ++z) {
+		for (int y = first.y; y < last.y; ++y) {
+			for (int x = first.x; x < last.x; ++x) {
+				mark(brickIndex(vec3i(x, y, z)));
+			}
+		}
+	}
+}
+
+void DirtyTracker::markAll() {
+	brick_version.fill(version);
+}
+
+void DirtyTracker::markMask(const uint32_t *mask, size_t word_count) {
+	word_count = math::min(word_count, (brick_version.len + 31) / 32);
+
+	for (size_t w = 0; w < word_count; ++w) {
+		// most of the mask is usually empty
+		if (!mask[w]) continue;
+
+		for (size_t b = 0; b < 32; ++b) {
+			const size_t index = w * 32 + b;
+			if ((mask[w] & (1u << b)) && index < brick_version.len) {
+				mark(index);
+			}
+		}
+	}
+}
+
+uint32_t DirtyTracker::snapshot() {
+	return version++;
+}
+
+bool DirtyTracker::hasChanged(uint32_t since) const {
+	for (uint32_t v : brick_version) {
+		if (v > since) return true;
+	}
+	return false;
+}
+
+size_t DirtyTracker::getDirtyCount(uint32_t since) const {
+	size_t count = 0;
+	for (uint32_t v : brick_version) {
+		if (v > since) ++count;
+	}
+	return count;
+}
+
+bool DirtyTracker::getBounds(uint32_t since, vec3i &out_start, vec3i &out_end) const {
+	vec3i first = brick_count;
+	vec3i last = -1;
+
+	forEachDirty(since,
+		[&](size_t brick) {
+			const vec3i pos = getBrickPos(brick);
+			first = math::min(first, pos);
+			last = math::max(last, pos);
+		}
+	);
+
+	if (any(last < 0)) {
+		return false;
+	}
+
+	out_start = first * brick_size;
+	out_end = math::min((last + 1) * brick_size, volume_size);
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "common.h"
+#include "vec.h"
+#include "arr.h"
+
+// keeps track of which parts of a volume have changed, the volume is split in
+// 8x8x8 bricks (same as the thread groups of the shaders and Volume's bricks).
+// instead of a single dirty flag every brick stores the version it was last
+// changed in, this way different users (saving, caches, etc) can each keep
+// the version they last looked at and ask what changed since then without
+// clearing it for everyone else:
+//     uint32_t seen = tracker.snapshot();
+//     ... (sculpting)
+//     tracker.forEachDirty(seen, [](size_t brick) { ... });
+// bricks can be marked from different threads as long as each brick is only
+// marked by one thread at a time
+struct DirtyTracker {
+	static constexpr int brick_size = 8;
+
+	// keeps the current version, so versions saved before calling this are still valid
+	void init(const vec3i &volume_size);
+	void cleanup();
+
+	void mark(size_t brick) {
+		brick_version[brick] = version;
+	}
+
+	// marks every brick that overlaps [start, end), in voxels
+	void markRegion(const vec3i &start, const vec3i &end);
+	void markAll();
+	// one bit per brick, same layout as the dirty mask written by sculpt_cs.hlsl
+	void markMask(const uint32_t *mask, size_t word_count);
+
+	// returns the current version and starts a new one, every brick marked
+	// after this will be dirty when compared to the returned version
+	uint32_t snapshot();
+
+	bool isDirty(size_t brick, uint32_t since) const {
+		return brick_version[brick] > since;
+	}
+
+	bool hasChanged(uint32_t since) const;
+	size_t getDirtyCount(uint32_t since) const;
+	// bounds of all the bricks changed after since, in voxels [start, end).
+	// returns false if nothing has changed
+	bool getBounds(uint32_t since, vec3i &out_start, vec3i &out_end) const;
+
+	template<typename TFn>
+	void forEachDirty(uint32_t since, TFn &&fn) const {
+		for (size_t i = 0; i < brick_version.len; ++i) {
+			if (brick_version[i] > since) {
+				fn(i);
+			}
+		}
+	}
+
+	size_t brickIndex(const vec3i &brick) const {
+		return (size_t)brick.x + (size_t)brick.y * brick_count.x + (size_t)brick.z * brick_count.x * brick_count.y;
+	}
+
+	vec3i getBrickPos(size_t brick) const {
+		return vec3i(
+			(int)(brick % brick_count.x),
+			(int)((brick / brick_count.x) % brick_count.y),
+			(int)(brick / ((size_t)brick_count.x * brick_count.y))
+		);
+	}
+
+	vec3i volume_size = 0;
+	vec3i brick_count = 0;
+	arr<uint32_t> brick_version;
+	// version 0 is used for bricks that never changed
+	uint32_t version = 1;
+};
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "env_map.h"
+
+#include <math.h>
+#include <atomic>
+
+#include "maths.h"
+
+namespace envmap {
+	// textures can be loaded in the background, so more than one table can be built at once
+	static std::atomic<uint64_t> last_generation = 0;
+
+	void Table::build(const float *rgba, const vec2i &image_size) {
+		destroy();
+
+		if (!rgba || image_size.x <= 0 || image_size.y <= 0) {
+			return;
+		}
+
+		// how many pixels (on each side) go in one cell
+		const int cell_size = (image_size.x + max_table_width - 1) / max_table_width;
+		const vec2i table_size = (image_size + cell_size - 1) / cell_size;
+		const size_t count = (size_t)table_size.x * table_size.y;
+
+		arr<float> weights;
+		weights.reserve(count);
+		weights.len = count;
+
+		double total = 0;
+
+		for (int y = 0; y < table_size.y; ++y) {
+			// solid angle covered by the row, the rows at the poles are squashed together
+			const float sin_theta = sinf(math::pi * ((float)y + 0.5f) / (float)table_size.y);
+
+			for (int x = 0; x < table_size.x; ++x) {
+				const int start_x = x * cell_size;
+				const int start_y = y * cell_size;
+				const int end_x = math::min(start_x + cell_size, image_size.x);
+				const int end_y = math::min(start_y + cell_size, image_size.y);
+
+				float luminance = 0;
+				for (int py = start_y; py < end_y; ++py) {
+					for (int px = start_x; px < end_x; ++px) {
+						const float *pixel = rgba + ((size_t)px + (size_t)py * image_size.x) * 4;
+						// same as luminance in ray_tracing_cs.hlsl
+						luminance += math::max(pixel[0] * 0.2126f + pixel[1] * 0.7152f + pixel[2] * 0.0722f, 0.f);
+					}
+				}
+				luminance /= (float)((end_x - start_x) * (end_y - start_y));
+
+				const float weight = luminance * sin_theta;
+				weights[(size_t)x + (size_t)y * table_size.x] = weight;
+				total += weight;
+			}
+		}
+
+		// completely black, there is nothing to importance sample
+		if (total <= 0) {
+			return;
+		}
+
+		size = table_size;
+		entries.reserve(count);
+		entries.len = count;
+
+		// vose's alias method: every cell is scaled so the average is 1, then the
+		// cells below 1 are filled up with what's left of the ones above 1
+		arr<uint> small;
+		arr<uint> large;
+		arr<float> scaled;
+		scaled.reserve(count);
+		scaled.len = count;
+
+		for (size_t i = 0; i < count; ++i) {
+			const float pdf = (float)(weights[i] / total);
+			entries[i].pdf = pdf;
+			scaled[i] = pdf * (float)count;
+			if (scaled[i] < 1.f) small.push((uint)i);
+			else                 large.push((uint)i);
+		}
+
+		while (!small.empty() && !large.empty()) {
+			const uint less = small.back();
+			small.pop();
+			const uint more = large.back();
+
+			entries[less].prob = scaled[less];
+			entries[less].alias = more;
+
+			scaled[more] -= 1.f - scaled[less];
+			if (scaled[more] < 1.f) {
+				large.pop();
+				small.push(more);
+			}
+		}
+
+		// whatever is left is 1, give or take some rounding error
+		for (uint i : small) {
+			entries[i].prob = 1.f;
+			entries[i].alias = i;
+		}
+
+		for (uint i : large) {
+			entries[i].prob = 1.f;
+			entries[i].alias = i;
+		}
+	}
+
+	void Table::destroy() {
+		entries.destroy();
+		size = 0;
+		generation = ++last_generation;
+	}
+} // namespace envmap
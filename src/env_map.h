@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.h"
+#include "vec.h"
+#include "arr.h"
+
+// importance sampling of an equirectangular environment map, with the same
+// mapping as getEnvironment in ray_tracing_cs.hlsl.
+// the map is split in cells, each one is picked with a probability proportional
+// to its luminance times the solid angle it covers. the cells are picked with
+// an alias table, so the shader can do it in constant time
+namespace envmap {
+	// the table is never wider than this, big maps are averaged down to it
+	constexpr int max_table_width = 512;
+
+	// same as EnvSample in ray_tracing_cs.hlsl
+	struct Entry {
+		// probability of keeping this cell instead of using its alias
+		float prob = 0;
+		uint alias = 0;
+		// probability of picking this cell
+		float pdf = 0;
+		float padding = 0;
+	};
+
+	struct Table {
+		void build(const float *rgba, const vec2i &image_size);
+		void destroy();
+		bool empty() const { return entries.empty(); }
+
+		vec2i size = 0;
+		arr<Entry> entries;
+		// changes every time a table is built (or destroyed), unique between all the
+		// tables, so users can tell if they need to upload it again. 0 if it was never built
+		uint64_t generation = 0;
+	};
+} // namespace envmap
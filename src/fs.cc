@@ -68,6 +68,61 @@ namespace fs {
 		return true;
 	}
 
+	bool append(const char *filename, const void *data, size_t len) {
+		file fp = file(filename, "ab");
+		if (!fp) {
+			return false;
+		}
+
+		if (!fp.write(data, len)) {
+			err("couldn't append everything to file");
+			return false;
+		}
+
+		return true;
+	}
+
+	bool remove(const char *filename) {
+		return DeleteFileA(filename) != 0;
+	}
+
+	bool replace(const char *from, const char *to) {
+		return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+	}
+
+	size_t getSize(const char *filename) {
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &data)) {
+			return 0;
+		}
+		return ((size_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	}
+
+	FileId getFileId(const char *filename) {
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &data)) {
+			return {};
+		}
+
+		FileId id;
+		id.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		id.write_time = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+		return id;
+	}
+
+	bool truncate(const char *filename, size_t size) {
+		HANDLE fp = CreateFileA(filename, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (fp == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		LARGE_INTEGER offset;
+		offset.QuadPart = (LONGLONG)size;
+		const bool result = SetFilePointerEx(fp, offset, NULL, FILE_BEGIN) && SetEndOfFile(fp);
+		CloseHandle(fp);
+		return result;
+	}
+
 	mem::ptr<char[]> findFirstAvailable(const char *dir, const char *name_fmt) {
 		char fmt[256];
 		mem::zero(fmt);
@@ -412,6 +467,10 @@ namespace fs {
 		return fwrite(data, 1, len, (FILE *)fptr) == len;
 	}
 
+	bool file::seek(uint64_t offset) {
+		return _fseeki64((FILE *)fptr, (long long)offset, SEEK_SET) == 0;
+	}
+
 	bool file::puts(const char *msg) {
 		return fputs(msg, (FILE *)fptr) > EOF;
 	}
@@ -424,6 +483,72 @@ namespace fs {
 		return written > EOF;
 	}
 
+	MappedFile::MappedFile(MappedFile &&m) {
+		*this = mem::move(m);
+	}
+
+	MappedFile::~MappedFile() {
+		close();
+	}
+
+	MappedFile &MappedFile::operator=(MappedFile &&m) {
+		if (this != &m) {
+			mem::swap(data, m.data);
+			mem::swap(size, m.size);
+			mem::swap(file, m.file);
+			mem::swap(mapping, m.mapping);
+		}
+		return *this;
+	}
+
+	bool MappedFile::open(const char *filename) {
+		close();
+
+		HANDLE fp = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (fp == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		// can't map empty files
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(fp, &file_size) || file_size.QuadPart == 0) {
+			CloseHandle(fp);
+			return false;
+		}
+
+		HANDLE map = CreateFileMappingA(fp, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!map) {
+			CloseHandle(fp);
+			return false;
+		}
+
+		void *view = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+		if (!view) {
+			CloseHandle(map);
+			CloseHandle(fp);
+			return false;
+		}
+
+		file = fp;
+		mapping = map;
+		data = (const uint8_t *)view;
+		size = (size_t)file_size.QuadPart;
+		return true;
+	}
+
+	void MappedFile::close() {
+		if (data)    UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+		if (file)    CloseHandle(file);
+		data = nullptr;
+		size = 0;
+		file = mapping = nullptr;
+	}
+
+	MappedFile::operator bool() const {
+		return data != nullptr;
+	}
+
 	uint8_t *StreamOut::getData() {
 		return buf.data();
 	}
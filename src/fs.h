@@ -81,6 +81,8 @@ namespace fs {
 
 		bool read(void *data, size_t len);
 		bool write(const void *data, size_t len);
+		// offset from the start of the file
+		bool seek(uint64_t offset);
 
 		bool puts(const char *msg);
 		bool print(const char *fmt, ...);
@@ -88,6 +90,38 @@ namespace fs {
 		void *fptr = nullptr;
 	};
 
+	// read-only view of a whole file, the pages are only read from disk when they're
+	// touched and different views of the same file share the os page cache
+	struct MappedFile {
+		MappedFile() = default;
+		MappedFile(const MappedFile &m) = delete;
+		MappedFile(MappedFile &&m);
+		~MappedFile();
+
+		MappedFile &operator=(MappedFile &&m);
+
+		bool open(const char *filename);
+		void close();
+
+		operator bool() const;
+
+		const uint8_t *data = nullptr;
+		size_t size = 0;
+		win32_handle_t file = nullptr;
+		win32_handle_t mapping = nullptr;
+	};
+
+	// size and last write time of a file, enough to tell if it has changed without reading it.
+	// it's all zero if the file doesn't exist
+	struct FileId {
+		bool operator==(const FileId &id) const { return size == id.size && write_time == id.write_time; }
+		bool operator!=(const FileId &id) const { return !(*this == id); }
+
+		uint64_t size = 0;
+		// 100ns intervals since 1601 (FILETIME)
+		uint64_t write_time = 0;
+	};
+
 	struct StreamOut {
 		uint8_t *getData();
 		size_t getLen() const;
@@ -124,6 +158,15 @@ namespace fs {
 	bool exists(const char *filename);
 	MemoryBuf read(const char *filename);
 	bool write(const char *filename, const void *data, size_t len);
+	// appends to the end of the file, creates it if it doesn't exist
+	bool append(const char *filename, const void *data, size_t len);
+	bool remove(const char *filename);
+	// moves from to to, overwriting it if it already exists
+	bool replace(const char *from, const char *to);
+	size_t getSize(const char *filename);
+	FileId getFileId(const char *filename);
+	// cuts the file down to size bytes
+	bool truncate(const char *filename, size_t size);
 	mem::ptr<char[]> findFirstAvailable(const char *dir = ".", const char *name_fmt = "name_%d.txt");
 	str::view getFilename(str::view path);
 	str::view getDir(str::view path);
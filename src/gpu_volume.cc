@@ -0,0 +1,414 @@
+#include "gpu_volume.h"
+
+#include <string.h>
+
+#include "texture.h"
+#include "buffer.h"
+#include "shader.h"
+#include "volume.h"
+#include "thr.h"
+#include "system.h"
+#include "tracelog.h"
+
+static_assert(GpuVolume::brick_size == Volume::brick_size);
+static_assert(GpuVolume::atlas_width * GpuVolume::brick_size <= 2048);
+
+// same as BRICK_UNIFORM in common.hlsl
+constexpr uint32_t brick_uniform = 1u << 31;
+// same as FREE_BRICKS_COUNTER and RELEASED_BRICKS_COUNTER in common.hlsl
+constexpr int free_counter = 0;
+constexpr int released_counter = 1;
+constexpr int counter_count = 2;
+// the bricks are copied to and from the gpu in batches so they're never all in memory twice
+constexpr size_t brick_batch = 4096;
+
+static uint32_t atlasEntry(size_t slot) {
+	const uint32_t x = (uint32_t)(slot % GpuVolume::atlas_width);
+	const uint32_t y = (uint32_t)((slot / GpuVolume::atlas_width) % GpuVolume::atlas_width);
+	const uint32_t z = (uint32_t)(slot / GpuVolume::layer_bricks);
+	return x | (y << 10) | (z << 20);
+}
+
+// index of the brick in the atlas, the same one Texture3D::readBricks/writeBricks use
+static uint32_t atlasSlot(uint32_t entry) {
+	const uint32_t x = entry & 0x3ff;
+	const uint32_t y = (entry >> 10) & 0x3ff;
+	const uint32_t z = (entry >> 20) & 0x3ff;
+	return x + y * GpuVolume::atlas_width + z * (uint32_t)GpuVolume::layer_bricks;
+}
+
+static bool isUniform(uint32_t entry) {
+	return entry & brick_uniform;
+}
+
+static uint32_t uniformEntry(int16_t value) {
+	return brick_uniform | (uint16_t)value;
+}
+
+static int16_t uniformValue(uint32_t entry) {
+	return (int16_t)(entry & 0xffff);
+}
+
+static vec3u atlasSize(int layers) {
+	return vec3u(GpuVolume::atlas_width, GpuVolume::atlas_width, layers) * GpuVolume::brick_size;
+}
+
+bool GpuVolume::upload(Volume &volume) {
+	if (any(volume.size % brick_size != 0)) {
+		err("the sculpture size must be a multiple of %d, instead it is %dx%dx%d", brick_size, volume.size.x, volume.size.y, volume.size.z);
+		return false;
+	}
+
+	if (!release_shader) {
+		release_shader = Shader::compile("release_bricks_cs.hlsl", ShaderType::Compute);
+		if (!release_shader) {
+			err("could not compile release bricks shader");
+			return false;
+		}
+	}
+
+	volume.releaseSource();
+	volume.compact();
+
+	// the bricks that are not uniform go in the atlas in the same order as in the volume
+	const size_t count = volume.bricks.len;
+	arr<uint32_t> entries;
+	arr<uint32_t> used;
+	entries.reserve(count);
+	entries.len = count;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (volume.bricks[i]) {
+			entries[i] = atlasEntry(used.len);
+			used.push((uint32_t)i);
+		}
+		else {
+			entries[i] = uniformEntry(volume.uniform[i]);
+		}
+	}
+
+	// leave some room, so the first sculpts don't have to grow it straight away
+	const size_t wanted = used.len + used.len / 4 + layer_bricks;
+	const int new_layers = (int)math::min((wanted + layer_bricks - 1) / layer_bricks, (size_t)max_layers);
+	const size_t capacity = new_layers * layer_bricks;
+
+	if (used.len > capacity) {
+		err("the sculpture needs %zu bricks, but at most %zu fit in the atlas", used.len, capacity);
+		return false;
+	}
+
+	if (!table) {
+		table = Texture3D::make();
+		atlas = Texture3D::make();
+		normals = Texture3D::make();
+	}
+
+	size = volume.size;
+	brick_count = volume.brick_count;
+	layers = new_layers;
+
+	if (!table->init(vec3u(brick_count), Texture3D::Type::uint32, entries.buf) ||
+		!atlas->init(atlasSize(layers), Texture3D::Type::r16_snorm)
+	) {
+		err("could not create the sculpture textures");
+		return false;
+	}
+
+	if (hasNormals() && !normals->init(atlasSize(layers), Texture3D::Type::r16g16_snorm)) {
+		err("could not create the normal atlas");
+		normals->cleanup();
+	}
+
+	arr<uint32_t> slots;
+	arr<int16_t> data;
+	data.reserve(brick_batch * brick_voxels);
+
+	for (size_t first = 0; first < used.len; first += brick_batch) {
+		const size_t last = math::min(first + brick_batch, used.len);
+
+		slots.clear();
+		for (size_t i = first; i < last; ++i) {
+			memcpy(data.buf + slots.len * brick_voxels, volume.bricks[used[i]]->data, sizeof(Volume::Brick));
+			slots.push((uint32_t)i);
+		}
+
+		atlas->writeBricks(slots, brick_size, data.buf);
+	}
+
+	// the sculpt shader takes them from the end of the list
+	const size_t free_count = capacity - used.len;
+	arr<uint32_t> free_list;
+	free_list.reserve(free_count);
+	for (size_t i = 0; i < free_count; ++i) {
+		free_list.push(atlasEntry(used.len + i));
+	}
+
+	const uint32_t counter_values[counter_count] = { (uint32_t)free_count, 0 };
+
+	if (!free_bricks) {
+		free_bricks = Buffer::makeStructured<uint32_t>(capacity, Bind::GpuReadWrite);
+		released_bricks = Buffer::makeStructured<uint32_t>(capacity, Bind::GpuReadWrite);
+		counters = Buffer::makeStructured<uint32_t>(counter_count, Bind::GpuReadWrite);
+		for (Handle<Buffer> &readback : readbacks) {
+			readback = Buffer::makeStructured<uint32_t>(counter_count, Bind::CpuRead);
+			if (!readback) gfx::errorExit("could not create brick counter readback");
+		}
+		if (!free_bricks || !released_bricks || !counters) gfx::errorExit("could not create brick lists");
+	}
+	else {
+		// resize only grows them, the extra entries are never used
+		free_bricks->resize(capacity);
+		released_bricks->resize(capacity);
+	}
+
+	free_bricks->update(free_list.buf, free_list.len * sizeof(uint32_t));
+	counters->update(counter_values, sizeof(counter_values));
+
+	for (bool &is_copied : is_readback_copied) {
+		is_copied = false;
+	}
+	known_free = free_count;
+	known_reserved = reserved_total;
+
+	info("sculpture is %dx%dx%d, %zu/%zu bricks are in the atlas (%.1f MB)",
+		size.x, size.y, size.z, used.len, count, (double)getMemoryUsage() / (1024.0 * 1024.0)
+	);
+	return true;
+}
+
+bool GpuVolume::download(Volume &out) {
+	arr<uint8_t> table_data;
+	if (!table->read(table_data) || !out.init(size)) {
+		return false;
+	}
+
+	const uint32_t *entries = (const uint32_t *)table_data.buf;
+	const size_t count = table_data.len / sizeof(uint32_t);
+	arr<uint32_t> bricks;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (isUniform(entries[i])) {
+			out.uniform[i] = uniformValue(entries[i]);
+		}
+		else {
+			bricks.push((uint32_t)i);
+		}
+	}
+
+	arr<uint32_t> slots;
+	arr<uint8_t> data;
+
+	for (size_t first = 0; first < bricks.len; first += brick_batch) {
+		const size_t last = math::min(first + brick_batch, bricks.len);
+
+		slots.clear();
+		for (size_t i = first; i < last; ++i) {
+			slots.push(atlasSlot(entries[bricks[i]]));
+		}
+
+		if (!atlas->readBricks(slots, brick_size, data)) {
+			return false;
+		}
+
+		const int16_t *values = (const int16_t *)data.buf;
+		thr::parallelFor(slots.len,
+			[&](size_t i) {
+				out.setBrick(bricks[first + i], values + i * brick_voxels);
+			}
+		);
+	}
+
+	return true;
+}
+
+bool GpuVolume::readBricks(Slice<uint32_t> bricks, arr<uint8_t> &out) {
+	arr<uint8_t> table_data;
+	if (!table->read(table_data)) {
+		return false;
+	}
+
+	const uint32_t *entries = (const uint32_t *)table_data.buf;
+	arr<uint32_t> slots;
+	for (uint32_t brick : bricks) {
+		if (!isUniform(entries[brick])) {
+			slots.push(atlasSlot(entries[brick]));
+		}
+	}
+
+	arr<uint8_t> atlas_data;
+	if (!slots.empty() && !atlas->readBricks(slots, brick_size, atlas_data)) {
+		return false;
+	}
+
+	const size_t brick_bytes = brick_voxels * sizeof(int16_t);
+	out.destroy();
+	out.reserve(bricks.len * brick_bytes);
+	out.len = bricks.len * brick_bytes;
+
+	const uint8_t *next = atlas_data.buf;
+	for (size_t i = 0; i < bricks.len; ++i) {
+		int16_t *dst = (int16_t *)out.buf + i * brick_voxels;
+		const uint32_t entry = entries[bricks[i]];
+
+		if (isUniform(entry)) {
+			for (int v = 0; v < brick_voxels; ++v) {
+				dst[v] = uniformValue(entry);
+			}
+		}
+		else {
+			memcpy(dst, next, brick_bytes);
+			next += brick_bytes;
+		}
+	}
+
+	return true;
+}
+
+void GpuVolume::reserve(size_t count) {
+	readFreeCount(false);
+
+	const uint64_t reserved_since = reserved_total - known_reserved;
+	size_t free_count = reserved_since < known_free ? known_free - (size_t)reserved_since : 0;
+
+	// the estimate assumes that every dispatch took all it reserved,
+	// check how many are actually left before growing
+	if (free_count < count) {
+		readFreeCount(true);
+		free_count = known_free;
+	}
+
+	if (free_count < count) {
+		grow(free_count, count);
+	}
+
+	reserved_total += count;
+}
+
+void GpuVolume::releaseBricks() {
+	release_shader->dispatch(1, {}, {}, { free_bricks->uav, released_bricks->uav, counters->uav });
+
+	readbacks[next_readback]->copyFrom(*counters.get());
+	readback_reserved[next_readback] = reserved_total;
+	is_readback_copied[next_readback] = true;
+	next_readback = (next_readback + 1) % readback_count;
+}
+
+bool GpuVolume::setNormals(bool enabled) {
+	if (!enabled) {
+		normals->cleanup();
+		return true;
+	}
+
+	if (hasNormals()) {
+		return true;
+	}
+
+	return normals->init(atlasSize(layers), Texture3D::Type::r16g16_snorm);
+}
+
+bool GpuVolume::hasNormals() const {
+	return normals && normals->texture;
+}
+
+size_t GpuVolume::getCapacity() const {
+	return layers * layer_bricks;
+}
+
+size_t GpuVolume::getMemoryUsage() const {
+	const size_t voxel_bytes = sizeof(int16_t) + (hasNormals() ? sizeof(uint32_t) : 0);
+	const size_t table_bytes = (size_t)brick_count.x * brick_count.y * brick_count.z * sizeof(uint32_t);
+	// free_bricks and released_bricks
+	const size_t list_bytes = getCapacity() * sizeof(uint32_t) * 2;
+	return getCapacity() * brick_voxels * voxel_bytes + table_bytes + list_bytes;
+}
+
+void GpuVolume::readFreeCount(bool wait) {
+	if (wait) {
+		// everything dispatched so far is in this copy, so the older ones are not needed anymore
+		Buffer *readback = readbacks[next_readback].get();
+		readback->copyFrom(*counters.get());
+
+		if (const uint32_t *values = readback->mapRead<uint32_t>()) {
+			known_free = values[free_counter];
+			known_reserved = reserved_total;
+			readback->unmap();
+		}
+
+		for (bool &is_copied : is_readback_copied) {
+			is_copied = false;
+		}
+		return;
+	}
+
+	// from the oldest to the newest, so the newest one that is ready wins
+	for (int i = 0; i < readback_count; ++i) {
+		const int index = (next_readback + i) % readback_count;
+		if (!is_readback_copied[index]) continue;
+
+		const uint32_t *values = readbacks[index]->tryMapRead<uint32_t>();
+		if (!values) break;
+
+		known_free = values[free_counter];
+		known_reserved = readback_reserved[index];
+		readbacks[index]->unmap();
+		is_readback_copied[index] = false;
+	}
+}
+
+bool GpuVolume::grow(size_t free_count, size_t count) {
+	// grow by a bit more than needed, so it doesn't have to grow again on the next sculpt
+	const size_t capacity = getCapacity();
+	const size_t wanted = capacity + (count - free_count) + capacity / 4;
+	const int new_layers = (int)math::min((wanted + layer_bricks - 1) / layer_bricks, (size_t)max_layers);
+
+	if (new_layers <= layers) {
+		err("the sculpture atlas is full (%zu bricks), some bricks won't be sculpted", capacity);
+		return false;
+	}
+
+	Handle<Texture3D> new_atlas = Texture3D::create(atlasSize(new_layers), Texture3D::Type::r16_snorm);
+	if (!new_atlas) {
+		err("could not grow the sculpture atlas, some bricks won't be sculpted");
+		return false;
+	}
+
+	// moved in the same handle, so the srvs/uavs taken from it after this are the new ones
+	atlas->copyInto(new_atlas);
+	*atlas.get() = mem::move(*new_atlas.get());
+
+	if (hasNormals()) {
+		Handle<Texture3D> new_normals = Texture3D::create(atlasSize(new_layers), Texture3D::Type::r16g16_snorm);
+		if (new_normals) {
+			normals->copyInto(new_normals);
+			*normals.get() = mem::move(*new_normals.get());
+		}
+		else {
+			// the sculpture turns the option off when it can't make it again
+			err("could not grow the normal atlas");
+			normals->cleanup();
+		}
+	}
+
+	// the new bricks go after the ones that are already in the free list
+	const size_t added = (new_layers - layers) * layer_bricks;
+	arr<uint32_t> new_free;
+	new_free.reserve(added);
+	for (size_t i = 0; i < added; ++i) {
+		new_free.push(atlasEntry(capacity + i));
+	}
+
+	free_bricks->resize(capacity + added);
+	released_bricks->resize(capacity + added);
+	free_bricks->update(new_free.buf, added * sizeof(uint32_t), free_count * sizeof(uint32_t));
+
+	// release_bricks_cs has already emptied the released list
+	const uint32_t new_free_count = (uint32_t)(free_count + added);
+	counters->update(&new_free_count, sizeof(new_free_count));
+
+	layers = new_layers;
+	known_free = new_free_count;
+	known_reserved = reserved_total;
+
+	info("grew the sculpture atlas to %zu bricks (%.1f MB)", getCapacity(), (double)getMemoryUsage() / (1024.0 * 1024.0));
+	return true;
+}
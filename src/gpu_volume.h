@@ -0,0 +1,86 @@
+#pragma once
+
+#include "handle.h"
+#include "vec.h"
+#include "arr.h"
+#include "slice.h"
+
+struct Texture3D;
+struct Buffer;
+struct Shader;
+struct Volume;
+
+// GPU version of Volume, this is how the sculpture is stored.
+// the volume is split in 8x8x8 bricks and the table has one entry per brick: bricks
+// where every voxel has the same value (most of them, they're either empty or solid)
+// only store that value in their entry, the others point to where they are in the atlas.
+// sculpt_cs takes bricks from the free list when it writes to a uniform brick and gives
+// them back when they become uniform again, so the memory used depends on how much of
+// the volume is close to the surface instead of on its size.
+// see "sparse volume" in shaders/common.hlsl for the entries
+struct GpuVolume {
+	// same as BRICK_SIZE in common.hlsl
+	static constexpr int brick_size = 8;
+	static constexpr int brick_voxels = brick_size * brick_size * brick_size;
+	// the atlas is atlas_width x atlas_width bricks and grows in depth one layer of bricks at a time
+	static constexpr int atlas_width = 128;
+	static constexpr size_t layer_bricks = (size_t)atlas_width * atlas_width;
+	// 3D textures can be at most 2048 voxels deep. d3d11 also limits a resource to a
+	// fraction of the video memory, so growing can fail before this (grow logs it)
+	static constexpr int max_layers = 2048 / brick_size;
+
+	// replaces the whole volume, its size must be a multiple of brick_size.
+	// the volume is compacted and its mapped file (if it has one) is released first
+	bool upload(Volume &volume);
+	// copies the whole volume to the cpu, waits for the gpu
+	bool download(Volume &out);
+	// same as Texture3D::readBricks with brick_size bricks
+	bool readBricks(Slice<uint32_t> bricks, arr<uint8_t> &out);
+	// makes sure the next dispatch of sculpt_cs can take up to count bricks from the free list,
+	// the atlas grows if they could run out. if it can't grow, the bricks that don't fit are
+	// left as they are by the shader
+	void reserve(size_t count);
+	// moves the bricks released by sculpt_cs back to the free list, call it after every dispatch
+	void releaseBricks();
+	// the normal atlas has the same layout as the volume one, the uniform bricks have no normals
+	bool setNormals(bool enabled);
+	bool hasNormals() const;
+
+	size_t getCapacity() const;
+	size_t getMemoryUsage() const;
+
+	vec3i size = 0;
+	vec3i brick_count = 0;
+	// r32_uint, one entry per brick
+	Handle<Texture3D> table;
+	// r16_snorm, atlas_width x atlas_width x layers bricks
+	Handle<Texture3D> atlas;
+	// optional octahedral encoded normals (r16g16_snorm), empty if disabled
+	Handle<Texture3D> normals;
+	// table entries of the bricks of the atlas that are not used
+	Handle<Buffer> free_bricks;
+	// bricks that sculpt_cs doesn't need anymore, release_bricks_cs moves them to free_bricks
+	Handle<Buffer> released_bricks;
+	// how many entries free_bricks and released_bricks have, same as FREE_BRICKS_COUNTER
+	// and RELEASED_BRICKS_COUNTER in common.hlsl
+	Handle<Buffer> counters;
+
+private:
+	void readFreeCount(bool wait);
+	bool grow(size_t free_count, size_t count);
+
+	// the counters are copied after every release and read back a couple of dispatches later,
+	// so we don't wait for the gpu. what was reserved after the copy is subtracted from them
+	static constexpr int readback_count = 3;
+
+	Handle<Shader> release_shader;
+	Handle<Buffer> readbacks[readback_count];
+	uint64_t readback_reserved[readback_count] = {};
+	bool is_readback_copied[readback_count] = {};
+	int next_readback = 0;
+	// free bricks when reserved_total was known_reserved
+	size_t known_free = 0;
+	uint64_t known_reserved = 0;
+	uint64_t reserved_total = 0;
+	int layers = 0;
+};
\ No newline at end of file
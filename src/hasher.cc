@@ -0,0 +1,26 @@
+#include "hasher.h"
+
+#include <string.h>
+
+#include "fs.h"
+
+void Hasher::add(const void *data, size_t len) {
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (size_t i = 0; i < len; ++i) {
+		value ^= bytes[i];
+		value *= 1099511628211ull;
+	}
+}
+
+void Hasher::addStr(const char *str) {
+	if (str) add(str, strlen(str));
+	// so that "ab" + "c" is not the same as "a" + "bc"
+	add((uint8_t)0);
+}
+
+bool Hasher::addFileId(const char *filename) {
+	const fs::FileId id = fs::getFileId(filename);
+	add(id.size);
+	add(id.write_time);
+	return id != fs::FileId();
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "common.h"
+
+// fnv-1a, used to tell if something has changed (e.g. the scene of a render checkpoint).
+// files are identified by their size and write time (fs::getFileId) instead of
+// their content, so it stays cheap for sculptures of a few GB
+struct Hasher {
+	void add(const void *data, size_t len);
+	template<typename T>
+	void add(const T &data) { add(&data, sizeof(T)); }
+	void addStr(const char *str);
+	// returns false if the file doesn't exist
+	bool addFileId(const char *filename);
+
+	uint64_t value = 14695981039346656037ull;
+};
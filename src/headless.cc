@@ -0,0 +1,340 @@
+#include "headless.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <stb_image.h>
+#include <stb_image_write.h>
+
+#include "tracelog.h"
+#include "options.h"
+#include "timer.h"
+#include "thr.h"
+#include "str.h"
+#include "fs.h"
+#include "camera.h"
+#include "volume.h"
+#include "journal.h"
+#include "cpu_render.h"
+#include "cpu_trace.h"
+
+namespace headless {
+	// a pixel counts as different if one of its channels is further than this
+	constexpr float visible_difference = 0.1f;
+
+	struct Args {
+		const char *command = nullptr;
+		const char *sculpture = nullptr;
+		const char *output = nullptr;
+		// 0 uses the resolution in the options, same as the main view
+		vec2i size = 0;
+		// same as the time in main_ps.hlsl, it moves the light
+		float time = 0;
+		const char *background = nullptr;
+		const char *diffuse = nullptr;
+		const char *compare = nullptr;
+		// biggest mean difference allowed between the two images
+		float tolerance = 0.02f;
+
+		// only used by trace
+		int frames = 64;
+		uint rays = 10;
+		uint bounces = 10;
+	};
+
+	// everything the renderers need apart from the camera
+	struct Scene {
+		Volume volume;
+		cpu::MinMips mips;
+		cpu::Image background;
+		cpu::Image diffuse;
+	};
+
+	static void printUsage() {
+		printf(
+			"usage: SDF_RayMarching render <sculpture> <out.png> [options]\n"
+			"  renders the sculpture on the cpu (same as main_ps.hlsl, without the lights and the brush)\n"
+			"usage: SDF_RayMarching trace <sculpture> <out.png|out.hdr> [options]\n"
+			"  path traces the sculpture on the cpu (reference for ray_tracing_cs.hlsl, without any lights)\n"
+			"options:\n"
+			"  --size <w> <h>       size of the image, by default the resolution in options.ini\n"
+			"  --time <seconds>     moves the light, same as the time in main_ps.hlsl\n"
+			"  --background <file>  environment image, white if there isn't one\n"
+			"  --diffuse <file>     texture mapped over the sculpture\n"
+			"  --compare <file>     image rendered by the gpu with the default camera and the same size\n"
+			"                       (e.g. a screenshot of the main view), fails if they're too different\n"
+			"  --tolerance <t>      biggest mean difference allowed by --compare, default 0.02\n"
+			"trace options:\n"
+			"  --frames <n>         number of frames to accumulate, default 64\n"
+			"  --rays <n>           rays per pixel every frame, default 10\n"
+			"  --bounces <n>        maximum number of bounces, default 10\n"
+			"an hdr image given to --compare is tonemapped first, same as the png output\n"
+		);
+	}
+
+	static bool parseArgs(int argc, char **argv, Args &args) {
+		if (argc < 4) {
+			return false;
+		}
+
+		args.command = argv[1];
+		args.sculpture = argv[2];
+		args.output = argv[3];
+
+		const bool is_trace = str::cmp(args.command, "trace");
+
+		for (int i = 4; i < argc; ++i) {
+			const char *arg = argv[i];
+			const int left = argc - i - 1;
+
+			if (str::cmp(arg, "--size") && left >= 2) {
+				args.size.x = str::toInt(argv[++i]);
+				args.size.y = str::toInt(argv[++i]);
+			}
+			else if (str::cmp(arg, "--time") && left >= 1) {
+				args.time = (float)str::toNum(argv[++i]);
+			}
+			else if (str::cmp(arg, "--background") && left >= 1) {
+				args.background = argv[++i];
+			}
+			else if (str::cmp(arg, "--diffuse") && left >= 1) {
+				args.diffuse = argv[++i];
+			}
+			else if (str::cmp(arg, "--compare") && left >= 1) {
+				args.compare = argv[++i];
+			}
+			else if (str::cmp(arg, "--tolerance") && left >= 1) {
+				args.tolerance = (float)str::toNum(argv[++i]);
+			}
+			else if (is_trace && str::cmp(arg, "--frames") && left >= 1) {
+				args.frames = str::toInt(argv[++i]);
+			}
+			else if (is_trace && str::cmp(arg, "--rays") && left >= 1) {
+				args.rays = (uint)math::max(str::toInt(argv[++i]), 1);
+			}
+			else if (is_trace && str::cmp(arg, "--bounces") && left >= 1) {
+				args.bounces = (uint)math::max(str::toInt(argv[++i]), 0);
+			}
+			else {
+				err("unknown option (%s)", arg);
+				return false;
+			}
+		}
+
+		if (args.size.x == 0 && args.size.y == 0) {
+			args.size = vec2i(Options::get().resolution);
+		}
+
+		if (any(args.size <= 0)) {
+			err("invalid image size %dx%d", args.size.x, args.size.y);
+			return false;
+		}
+
+		if (args.frames <= 0) {
+			err("invalid number of frames (%d)", args.frames);
+			return false;
+		}
+
+		return true;
+	}
+
+	// same as Sculpture::load, the journal is applied on top of the file
+	static bool loadSculpture(const char *path, Volume &volume) {
+		if (!volume.loadFromFile(path)) {
+			err("could not load sculpture (%s)", path);
+			return false;
+		}
+
+		journal::replay(path, volume.size,
+			[&volume](Slice<uint32_t> bricks, const int16_t *data) {
+				for (size_t i = 0; i < bricks.len; ++i) {
+					volume.setBrick(bricks[i], data + i * journal::brick_size * journal::brick_size * journal::brick_size);
+				}
+			}
+		);
+
+		return true;
+	}
+
+	static bool loadScene(const Args &args, Scene &scene) {
+		if (!loadSculpture(args.sculpture, scene.volume)) return false;
+		if (args.background && !scene.background.load(args.background)) return false;
+		if (args.diffuse && !scene.diffuse.load(args.diffuse)) return false;
+		scene.mips.build(scene.volume);
+		return true;
+	}
+
+	// works with both cpu::RenderSettings and cpu::TraceSettings
+	template<typename Settings>
+	static void setCamera(const Camera &cam, Settings &settings) {
+		settings.cam_pos = cam.pos;
+		settings.cam_fwd = cam.fwd;
+		settings.cam_right = cam.right;
+		settings.cam_up = cam.up;
+		settings.cam_zoom = cam.getZoom();
+	}
+
+	// rgba8 to [0, 1] rgb, the same as cpu::Image loads a png
+	static void toImage(const arr<uint8_t> &rgba, const vec2i &size, cpu::Image &out) {
+		const size_t count = (size_t)size.x * size.y;
+		out.size = size;
+		out.data.destroy();
+		out.data.reserve(count);
+		out.data.len = count;
+
+		for (size_t i = 0; i < count; ++i) {
+			const uint8_t *p = rgba.buf + i * 4;
+			out.data[i] = vec3(p[0], p[1], p[2]) / 255.f;
+		}
+	}
+
+	// hdr images are tonemapped, so that they can be compared with the tonemapped output
+	static bool compareImages(const cpu::Image &image, const char *filename, float tolerance, float exposure_bias) {
+		cpu::Image other;
+		if (!other.load(filename)) {
+			err("could not load the image to compare with (%s)", filename);
+			return false;
+		}
+
+		if (stbi_is_hdr(filename)) {
+			for (vec3 &colour : other.data) {
+				colour = saturate(cpu::toneMapping(colour, exposure_bias));
+			}
+		}
+
+		if (any(other.size != image.size)) {
+			err("%s is %dx%d, but the render is %dx%d", filename, other.size.x, other.size.y, image.size.x, image.size.y);
+			return false;
+		}
+
+		double sum = 0;
+		float max_difference = 0;
+		size_t different = 0;
+
+		for (size_t i = 0; i < image.data.len; ++i) {
+			const vec3 delta = image.data[i] - other.data[i];
+			const float difference = math::max(fabsf(delta.x), math::max(fabsf(delta.y), fabsf(delta.z)));
+			sum += difference;
+			max_difference = math::max(max_difference, difference);
+			if (difference > visible_difference) ++different;
+		}
+
+		const double mean = image.data.len ? sum / (double)image.data.len : 0.0;
+		const double different_percent = image.data.len ? (double)different / image.data.len * 100.0 : 0.0;
+		const bool is_same = mean <= tolerance;
+
+		logMessage(
+			is_same ? LogLevel::Info : LogLevel::Error,
+			"compared with %s: mean difference %.4f (tolerance %.4f), max %.4f, %.2f%% of the pixels differ by more than %.2f",
+			filename, mean, tolerance, max_difference, different_percent, visible_difference
+		);
+
+		return is_same;
+	}
+
+	static bool compareRgba(const Args &args, const arr<uint8_t> &rgba, float exposure_bias) {
+		cpu::Image image;
+		toImage(rgba, args.size, image);
+		return compareImages(image, args.compare, args.tolerance, exposure_bias);
+	}
+
+	static int render(const Args &args) {
+		Scene scene;
+		if (!loadScene(args, scene)) {
+			return 1;
+		}
+
+		// the camera the application starts with
+		Camera cam;
+
+		cpu::RenderSettings settings;
+		setCamera(cam, settings);
+		settings.time = args.time;
+		settings.mips = &scene.mips;
+		settings.background = args.background ? &scene.background : nullptr;
+		settings.material = args.diffuse ? &scene.diffuse : nullptr;
+
+		CPUClock clock = "cpu render";
+		arr<uint8_t> rgba;
+		cpu::render(scene.volume, settings, args.size, rgba);
+		clock.print();
+
+		if (!stbi_write_png(args.output, args.size.x, args.size.y, 4, rgba.buf, args.size.x * 4)) {
+			err("couldn't save the render to %s", args.output);
+			return 1;
+		}
+		info("saved render to %s", args.output);
+
+		if (args.compare && !compareRgba(args, rgba, settings.exposure_bias)) {
+			return 1;
+		}
+
+		return 0;
+	}
+
+	// the lights of the scene aren't saved with the sculpture, so only the
+	// environment lights it. to compare it with the gpu, remove every light
+	// in the editor before rendering
+	static int trace(const Args &args) {
+		Scene scene;
+		if (!loadScene(args, scene)) {
+			return 1;
+		}
+
+		Camera cam;
+
+		cpu::TraceSettings settings;
+		setCamera(cam, settings);
+		settings.maximum_rays = args.rays;
+		settings.maximum_bounces = args.bounces;
+		settings.mips = &scene.mips;
+		settings.background = args.background ? &scene.background : nullptr;
+		settings.material.diffuse = args.diffuse ? &scene.diffuse : nullptr;
+
+		cpu::PathTracer tracer;
+		tracer.resize(args.size);
+
+		CPUClock clock = "cpu path tracer";
+		for (int frame = 0; frame < args.frames; ++frame) {
+			tracer.renderFrame(scene.volume, settings);
+			if ((frame + 1) % 16 == 0) {
+				info("traced %d/%d frames", frame + 1, args.frames);
+			}
+		}
+		clock.print();
+
+		const bool is_hdr = str::cmp(fs::getExtension(args.output), "hdr");
+		if (!(is_hdr ? tracer.saveHdr(args.output) : tracer.savePng(args.output, settings))) {
+			return 1;
+		}
+
+		if (args.compare) {
+			arr<uint8_t> rgba;
+			tracer.getImage(settings, rgba);
+			if (!compareRgba(args, rgba, settings.exposure_bias)) {
+				return 1;
+			}
+		}
+
+		return 0;
+	}
+
+	bool isCommand(int argc, char **argv) {
+		return argc > 1 && (str::cmp(argv[1], "render") || str::cmp(argv[1], "trace"));
+	}
+
+	int run(int argc, char **argv) {
+		timerInit();
+		Options::get().load();
+
+		Args args;
+		if (!parseArgs(argc, argv, args)) {
+			printUsage();
+			return 1;
+		}
+
+		const int result = str::cmp(args.command, "trace") ? trace(args) : render(args);
+
+		thr::cleanupJobs();
+		return result;
+	}
+} // namespace headless
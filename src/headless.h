@@ -0,0 +1,17 @@
+#pragma once
+
+// command line mode, it doesn't open a window or create a d3d device.
+// it loads a sculpture (and its journal) in a Volume and renders it on the cpu
+// with the default camera, the result can be compared with an image rendered
+// by the gpu (e.g. a screenshot of the main view) to check that they match.
+//   SDF_RayMarching render <sculpture> <out.png> [options]
+//   SDF_RayMarching trace <sculpture> <out.png|out.hdr> [options]
+// render uses cpu_render (main_ps.hlsl), trace uses the cpu PathTracer
+// (ray_tracing_cs.hlsl)
+// running a command without any arguments prints its options
+namespace headless {
+	// true if the first argument is one of the commands
+	bool isCommand(int argc, char **argv);
+	// returns the exit code: 0 if everything went fine (and the images match)
+	int run(int argc, char **argv);
+} // namespace headless
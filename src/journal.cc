@@ -0,0 +1,274 @@
+#include "journal.h"
+
+#include <string.h>
+#include <zstd.hpp>
+
+#include "tracelog.h"
+#include "fs.h"
+#include "str.h"
+#include "arr.h"
+#include "volume.h"
+#include "tex3d_file.h"
+
+// file layout:
+//   header: "tex3dj" | version (u32) | volume size (vec3i) | base file size (u64) | base file write time (u64)
+//   then any number of records:
+//     "jrec" | brick count (u32) | compressed size (u64) | zstd(brick indices (u32) + brick data (i16))
+// records are only ever appended, if the application closes while writing one
+// the broken record at the end is cut off the next time the journal is replayed
+
+constexpr uint32_t journal_version = 2;
+
+struct JournalHeader {
+	char magic[6];
+	uint32_t version;
+	vec3i size;
+	fs::FileId base_id;
+};
+
+struct RecordHeader {
+	char magic[4];
+	uint32_t brick_count;
+	uint64_t compressed_size;
+};
+
+// == PRIVATE FUNCTIONS ========================================================
+
+static bool readHeader(fs::StreamIn &stream, JournalHeader &header) {
+	if (!stream.read(header.magic))               return false;
+	if (!stream.read(header.version))             return false;
+	if (!stream.read(header.size))                return false;
+	if (!stream.read(header.base_id.size))        return false;
+	if (!stream.read(header.base_id.write_time))  return false;
+	return memcmp(header.magic, "tex3dj", sizeof(header.magic)) == 0;
+}
+
+// only reads the header, so it's cheap to call before every append
+static bool isJournalFor(const char *path, const char *base_path, const vec3i &volume_size) {
+	uint8_t buf[sizeof(JournalHeader)];
+	fs::file fp = fs::file(path, "rb");
+	const size_t header_len = 6 + sizeof(uint32_t) + sizeof(vec3i) + sizeof(uint64_t) * 2;
+	if (!fp || !fp.read(buf, header_len)) {
+		return false;
+	}
+
+	fs::StreamIn stream = fs::StreamIn(buf, header_len);
+	JournalHeader header;
+	return
+		readHeader(stream, header) &&
+		header.version == journal_version &&
+		all(header.size == volume_size) &&
+		header.base_id == fs::getFileId(base_path);
+}
+
+// == PUBLIC FUNCTIONS =========================================================
+
+namespace journal {
+	mem::ptr<char[]> getPath(const char *base_path) {
+		return str::formatStr("%s.journal", base_path);
+	}
+
+	size_t getSize(const char *base_path) {
+		return fs::getSize(getPath(base_path).get());
+	}
+
+	bool remove(const char *base_path) {
+		mem::ptr<char[]> path = getPath(base_path);
+		if (!fs::exists(path.get())) {
+			return true;
+		}
+		return fs::remove(path.get());
+	}
+
+	bool append(const char *base_path, const vec3i &volume_size, Slice<uint32_t> bricks, const int16_t *data) {
+		if (bricks.empty()) {
+			return true;
+		}
+
+		mem::ptr<char[]> path = getPath(base_path);
+		fs::StreamOut stream;
+
+		// first record after a full save, start a new journal for this base file.
+		// a journal for a different base file would never be replayed, so it's replaced
+		const bool is_new = !isJournalFor(path.get(), base_path, volume_size);
+		if (is_new) {
+			const fs::FileId base_id = fs::getFileId(base_path);
+			stream.write("tex3dj", 6);
+			stream.write(journal_version);
+			stream.write(volume_size);
+			stream.write(base_id.size);
+			stream.write(base_id.write_time);
+		}
+
+		fs::StreamOut payload;
+		payload.write(bricks.data, bricks.byteSize());
+		payload.write(data, bricks.len * brick_voxels * sizeof(int16_t));
+
+		zstd::Buf compressed = zstd::compress(payload.getData(), payload.getLen());
+		if (!compressed) {
+			err("could not compress journal record: %s", compressed.getErrorString());
+			return false;
+		}
+
+		stream.write("jrec", 4);
+		stream.write((uint32_t)bricks.len);
+		stream.write((uint64_t)compressed.len);
+		stream.write(compressed.data, compressed.len);
+
+		if (is_new) {
+			if (!fs::write(path.get(), stream.getData(), stream.getLen())) {
+				err("could not write to journal (%s)", path.get());
+				fs::remove(path.get());
+				return false;
+			}
+		}
+		else {
+			const size_t old_size = fs::getSize(path.get());
+			if (!fs::append(path.get(), stream.getData(), stream.getLen())) {
+				err("could not write to journal (%s)", path.get());
+				// don't leave half a record behind, the next ones would be stuck after it
+				fs::truncate(path.get(), old_size);
+				return false;
+			}
+		}
+
+		info("appended %zu bricks to %s (%zu bytes)", bricks.len, path.get(), stream.getLen());
+		return true;
+	}
+
+	bool replay(const char *base_path, const vec3i &volume_size, void (*fn)(void *udata, Slice<uint32_t> bricks, const int16_t *data), void *udata) {
+		mem::ptr<char[]> path = getPath(base_path);
+		if (!fs::exists(path.get())) {
+			return false;
+		}
+
+		fs::MemoryBuf file = fs::read(path.get());
+		fs::StreamIn stream = file;
+
+		JournalHeader header;
+		if (!readHeader(stream, header) || header.version != journal_version) {
+			warn("journal (%s) is not valid, ignoring it", path.get());
+			return false;
+		}
+
+		if (any(header.size != volume_size)) {
+			warn("journal (%s) is for a %dx%dx%d volume, ignoring it", path.get(), header.size.x, header.size.y, header.size.z);
+			return false;
+		}
+
+		if (header.base_id != fs::getFileId(base_path)) {
+			warn("journal (%s) is from an older version of the file, ignoring it", path.get());
+			return false;
+		}
+
+		const vec3i brick_count = (volume_size + brick_size - 1) / brick_size;
+		const size_t max_bricks = (size_t)brick_count.x * brick_count.y * brick_count.z;
+		size_t record_count = 0;
+		// end of the last record that was read correctly
+		size_t valid_len = stream.cur - stream.start;
+		bool is_broken = false;
+
+		while (!stream.isFinished()) {
+			RecordHeader record;
+			if (!stream.read(record.magic) || !stream.read(record.brick_count) || !stream.read(record.compressed_size)) {
+				is_broken = true;
+				break;
+			}
+
+			const size_t remaining = stream.len - (stream.cur - stream.start);
+			if (memcmp(record.magic, "jrec", sizeof(record.magic)) != 0 || record.compressed_size > remaining) {
+				is_broken = true;
+				break;
+			}
+
+			zstd::Buf decompressed = zstd::decompress(stream.cur, (size_t)record.compressed_size);
+			stream.cur += record.compressed_size;
+
+			const size_t expected = record.brick_count * (sizeof(uint32_t) + brick_voxels * sizeof(int16_t));
+			if (!decompressed || decompressed.len != expected) {
+				is_broken = true;
+				break;
+			}
+
+			const uint32_t *bricks = (const uint32_t *)decompressed.data;
+			const int16_t *data = (const int16_t *)(bricks + record.brick_count);
+
+			bool is_valid = true;
+			for (uint32_t i = 0; i < record.brick_count; ++i) {
+				is_valid &= bricks[i] < max_bricks;
+			}
+
+			if (!is_valid) {
+				is_broken = true;
+				break;
+			}
+
+			fn(udata, Slice<uint32_t>(bricks, record.brick_count), data);
+			++record_count;
+			valid_len = stream.cur - stream.start;
+		}
+
+		// the records after a broken one can't be trusted either, cut them off so
+		// that the next appends go right after the last good record
+		if (is_broken) {
+			warn(
+				"journal (%s) has a broken record after %zu good ones, dropping the last %zu bytes", 
+				path.get(), record_count, file.size - valid_len
+			);
+			if (!fs::truncate(path.get(), valid_len)) {
+				err("could not cut the broken records off the journal (%s)", path.get());
+			}
+		}
+
+		info("replayed %zu records from %s", record_count, path.get());
+		return true;
+	}
+
+	bool compact(const char *base_path) {
+		Volume volume;
+		if (!volume.loadFromFile(base_path)) {
+			err("could not compact journal, failed to load base file (%s)", base_path);
+			return false;
+		}
+
+		const bool has_journal = replay(base_path, volume.size,
+			[&volume](Slice<uint32_t> bricks, const int16_t *data) {
+				for (size_t i = 0; i < bricks.len; ++i) {
+					volume.setBrick(bricks[i], data + i * brick_voxels);
+				}
+			}
+		);
+
+		if (!has_journal) {
+			return remove(base_path);
+		}
+
+		// keep the base file compressed/uncompressed
+		bool compress = true;
+		{
+			tex3d::Reader reader;
+			if (reader.open(base_path, [](uint8_t) -> size_t { return sizeof(int16_t); })) {
+				compress = !(reader.header.flags & tex3d::flag_uncompressed);
+			}
+		}
+
+		// write to a temporary file first, this way if something goes wrong the
+		// base file and the journal are still valid
+		mem::ptr<char[]> temp_path = str::formatStr("%s.tmp", base_path);
+		if (!volume.save(temp_path.get(), true, compress)) {
+			return false;
+		}
+
+		// the base file can still be mapped by the volume, which would stop it from being replaced
+		volume.cleanup();
+
+		if (!fs::replace(temp_path.get(), base_path)) {
+			err("could not replace %s with the compacted file", base_path);
+			fs::remove(temp_path.get());
+			return false;
+		}
+
+		// if this fails, the journal is still ignored as the base file has changed
+		return remove(base_path);
+	}
+} // namespace journal
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "common.h"
+#include "vec.h"
+#include "mem.h"
+#include "slice.h"
+
+// sidecar log (<base file>.journal) of the bricks that changed since a tex3d
+// file was saved. autosaves only append the bricks that changed instead of
+// writing the whole file again, loading replays the journal on top of the base
+// file and once it gets too big it's merged back into the base file (compact).
+// bricks are 8x8x8 r16_snorm blocks, indexed like DirtyTracker.
+// the journal stores the size and write time of the base file it was started
+// from, if the base file changes (e.g. full save) an old journal is ignored
+namespace journal {
+	constexpr int brick_size = 8;
+	constexpr int brick_voxels = brick_size * brick_size * brick_size;
+
+	mem::ptr<char[]> getPath(const char *base_path);
+	size_t getSize(const char *base_path);
+	bool remove(const char *base_path);
+
+	// appends one record, data has brick_voxels values for each brick one after the other.
+	// starts a new journal if the current one is for a different base file
+	bool append(const char *base_path, const vec3i &volume_size, Slice<uint32_t> bricks, const int16_t *data);
+
+	// calls fn(udata, bricks, data) for every record in the order they were written,
+	// returns false if there is no valid journal for this base file.
+	// if a record is broken, it and everything after it is cut off the journal
+	bool replay(const char *base_path, const vec3i &volume_size, void (*fn)(void *udata, Slice<uint32_t> bricks, const int16_t *data), void *udata);
+
+	template<typename TFn>
+	bool replay(const char *base_path, const vec3i &volume_size, TFn &&fn) {
+		return replay(
+			base_path,
+			volume_size,
+			[](void *udata, Slice<uint32_t> bricks, const int16_t *data) { (*(mem::RemRefT<TFn> *)udata)(bricks, data); },
+			(void *)&fn
+		);
+	}
+
+	// merges the journal into the base file and deletes it. this is done on
+	// the cpu (with Volume) so it can run in the background
+	bool compact(const char *base_path);
+} // namespace journal
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "light_bvh.h"
+
+#include <float.h>
+#include <math.h>
+
+void LightBVH::build(Slice<vec4> spheres) {
+	nodes.clear();
+	order.clear();
+
+	if (spheres.empty()) {
+		return;
+	}
+
+	order.reserve(spheres.len);
+	for (uint i = 0; i < (uint)spheres.len; ++i) {
+		order.push(i);
+	}
+
+	nodes.push();
+	buildNode(spheres, 0, 0, (uint)spheres.len);
+}
+
+float LightBVH::boxDistance(const Node &node, const vec3 &pos) {
+	const vec3 outside = math::max(math::max(node.bounds_min - pos, pos - node.bounds_max), vec3(0));
+	return outside.mag();
+}
+
+void LightBVH::buildNode(Slice<vec4> spheres, uint index, uint begin, uint end) {
+	vec3 bounds_min = FLT_MAX;
+	vec3 bounds_max = -FLT_MAX;
+	vec3 centre_min = FLT_MAX;
+	vec3 centre_max = -FLT_MAX;
+
+	for (uint i = begin; i < end; ++i) {
+		const vec4 &sphere = spheres[order[i]];
+		bounds_min = math::min(bounds_min, sphere.v - sphere.w);
+		bounds_max = math::max(bounds_max, sphere.v + sphere.w);
+		centre_min = math::min(centre_min, sphere.v);
+		centre_max = math::max(centre_max, sphere.v);
+	}
+
+	// nodes can be reallocated while building the children, so don't keep a reference
+	nodes[index].bounds_min = bounds_min;
+	nodes[index].bounds_max = bounds_max;
+
+	if (end - begin <= max_leaf_size) {
+		nodes[index].first = begin;
+		nodes[index].count = end - begin;
+		return;
+	}
+
+	// split in half along the longest side, with the lights sorted by their centre
+	const vec3 extent = centre_max - centre_min;
+	int axis = 0;
+	if (extent.y > extent.data[axis]) axis = 1;
+	if (extent.z > extent.data[axis]) axis = 2;
+
+	// insertion sort, there are at most a few hundred lights
+	for (uint i = begin + 1; i < end; ++i) {
+		const uint light = order[i];
+		const float key = spheres[light].v.data[axis];
+		uint j = i;
+		for (; j > begin && spheres[order[j - 1]].v.data[axis] > key; --j) {
+			order[j] = order[j - 1];
+		}
+		order[j] = light;
+	}
+
+	const uint mid = begin + (end - begin) / 2;
+	const uint left = (uint)nodes.len;
+	nodes.push();
+	nodes.push();
+
+	nodes[index].first = left;
+	nodes[index].count = 0;
+
+	buildNode(spheres, left, begin, mid);
+	buildNode(spheres, left + 1, mid, end);
+}
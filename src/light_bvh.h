@@ -0,0 +1,68 @@
+#pragma once
+
+#include "common.h"
+#include "vec.h"
+#include "arr.h"
+#include "slice.h"
+
+// bounding volume hierarchy over the lights, this way the ray marchers only look
+// at the lights close to them instead of going over all of them on every step.
+// the two children of a node are always next to each other, and the leaves
+// point to a range of order, so the lights can be uploaded in that order and
+// the leaves can index them directly
+struct LightBVH {
+	// same as LightNode in common.hlsl
+	struct Node {
+		vec3 bounds_min = 0;
+		// leaf: first index in order, otherwise: index of the left child (the right one is after it)
+		uint first = 0;
+		vec3 bounds_max = 0;
+		// number of lights in the leaf, 0 if it is not a leaf
+		uint count = 0;
+	};
+
+	static constexpr uint max_leaf_size = 4;
+	// same as LIGHT_BVH_STACK_SIZE in common.hlsl, way more than a few thousand lights need
+	static constexpr int max_depth = 32;
+
+	// xyz: centre, w: radius
+	void build(Slice<vec4> spheres);
+	// distance from pos to the bounds of the node, 0 if it's inside
+	static float boxDistance(const Node &node, const vec3 &pos);
+
+	// same as lightBVHDistance in common.hlsl. calls fn(sphere index) for the spheres
+	// in the nodes closer than max_dist, fn returns the new max_dist (e.g. the
+	// distance to the closest sphere so far)
+	template<typename TFn>
+	void traverse(const vec3 &pos, float max_dist, TFn &&fn) const {
+		if (nodes.empty()) return;
+
+		uint stack[max_depth];
+		int stack_size = 0;
+		stack[stack_size++] = 0;
+
+		while (stack_size > 0) {
+			const Node &node = nodes[stack[--stack_size]];
+			if (boxDistance(node, pos) >= max_dist) continue;
+
+			if (node.count > 0) {
+				for (uint i = node.first; i < node.first + node.count; ++i) {
+					max_dist = fn(order[i]);
+				}
+			}
+			else if (stack_size + 2 <= max_depth) {
+				// visit the closest child first so the other one is more likely to be skipped
+				const bool left_first = boxDistance(nodes[node.first], pos) <= boxDistance(nodes[node.first + 1], pos);
+				stack[stack_size++] = left_first ? node.first + 1 : node.first;
+				stack[stack_size++] = left_first ? node.first : node.first + 1;
+			}
+		}
+	}
+
+	arr<Node> nodes;
+	// indices of the spheres in the order of the leaves
+	arr<uint> order;
+
+private:
+	void buildNode(Slice<vec4> spheres, uint index, uint begin, uint end);
+};
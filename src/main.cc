@@ -17,6 +17,8 @@
 #include "texture.h"
 #include "ray_tracing_editor.h"
 #include "sculpture.h"
+#include "thr.h"
+#include "headless.h"
 
 #include <imgui.h>
 #include <d3d11.h>
@@ -32,7 +34,8 @@ struct PSShaderData {
 	uint num_of_lights;
 	uint use_tonemapping;
 	float exposure_bias;
-	vec2 padding__0;
+	uint use_normal_volume;
+	float padding__0;
 };
 
 GFX_CLASS_CHECK(PSShaderData);
@@ -40,7 +43,12 @@ GFX_CLASS_CHECK(PSShaderData);
 static Mesh makeFullScreenTriangle();
 static void setImGuiTheme();
 
-int main() {
+int main(int argc, char **argv) {
+	// render from the command line without opening the window
+	if (headless::isCommand(argc, argv)) {
+		return headless::run(argc, argv);
+	}
+
 	const char *base_name = "Honours Project";
 	win::create(base_name, 800, 600);
 
@@ -85,7 +93,7 @@ int main() {
 			}
 
 			if (rt_editor.update(material_editor)) {
-				rt_editor.step(material_editor, sculpture.texture, shader_data_handle);
+				rt_editor.step(material_editor, sculpture, cam, shader_data_handle);
 			}
 
 			is_dirty |= Shader::hasUpdated(rt_editor.getShader());
@@ -100,12 +108,13 @@ int main() {
 			}
 
 			if (gfx::isMainRTVActive()) {
-				brush_editor.findBrush(cam, sculpture.texture);
+				brush_editor.findBrush(cam, sculpture.volume);
 
 
 				if (cam.shouldSculpt()) {
-					is_dirty = true;
 					sculpture.runSculpt();
+					// only the part of the render around the brush needs to be redone
+					is_dirty |= !rt_editor.invalidateBrush(cam, brush_editor.getBrushExtent(), vec3(sculpture.volume.size));
 					win::setWindowName(str::format("%s - %s*", base_name, sculpture.getName()));
 				}
 			}
@@ -126,6 +135,7 @@ int main() {
 					data->num_of_lights = (uint)material_editor.getLightsCount();
 					data->use_tonemapping = (uint)material_editor.useTonemapping();
 					data->exposure_bias = material_editor.getExposure();
+					data->use_normal_volume = (uint)sculpture.hasNormalVolume();
 					buf->unmap();
 				}
 			}
@@ -137,14 +147,20 @@ int main() {
 				{ shader_data_handle, material_editor.getBuffer() },
 				{
 					brush_editor.getDataSRV(),
-					sculpture.texture->srv,
+					sculpture.volume.table->srv,
 					material_editor.getDiffuse(),
 					material_editor.getBackground(),
-					material_editor.getLights()->srv
+					material_editor.getLights()->srv,
+					sculpture.min_mips[0]->srv,
+					sculpture.min_mips[1]->srv,
+					sculpture.min_mips[2]->srv,
+					sculpture.volume.normals->srv,
+					material_editor.getLightNodes()->srv,
+					sculpture.volume.atlas->srv,
 				}
 			);
 			triangle.render();
-			main_ps->unbind(2, 5);
+			main_ps->unbind(2, 11);
 			main_ps->unbindCBuffers(2);
 
 			gfx::imgui_rtv->bind();
@@ -156,7 +172,7 @@ int main() {
 				widgets::keyRemapper();
 				widgets::controlsPage();
 				drawLogger();
-				brush_editor.drawWidget(sculpture.texture);
+				brush_editor.drawWidget(sculpture.volume);
 				material_editor.drawWidget();
 				options.drawWidget();
 			
@@ -172,6 +188,8 @@ int main() {
 		}
 	}
 
+	// the sculpture might have started a save while closing
+	thr::cleanupJobs();
 	win::cleanup();
 }
 
@@ -9,13 +9,19 @@
 #include "slice.h"
 #include "fs.h"
 #include "thr.h"
+#include "render_checkpoint.h"
+#include "hasher.h"
 
 MaterialEditor::MaterialEditor() {
 	mat_handle        = Buffer::makeConstant<MaterialPS>(Buffer::Usage::Dynamic);
 	lights_handle     = Buffer::makeStructured<LightData>(cur_lights_count, Bind::GpuRead | Bind::CpuWrite);
+	env_handle        = Buffer::makeStructured<envmap::Entry>(1, Bind::GpuRead);
+	light_nodes_handle = Buffer::makeStructured<LightBVH::Node>(cur_nodes_count, Bind::GpuRead | Bind::CpuWrite);
 
 	if (!lights_handle) gfx::errorExit();
 	if (!mat_handle)    gfx::errorExit();
+	if (!env_handle)    gfx::errorExit();
+	if (!light_nodes_handle) gfx::errorExit();
 
 	// add a few default textures
 	addTextureAsync("assets/ground texture.png", &diffuse_handle);
@@ -33,13 +39,7 @@ MaterialEditor::MaterialEditor() {
 
 	assert(cur_lights_count >= lights.len);
 
-	if (LightData *data = lights_handle->map<LightData>()) {
-		for (size_t i = 0; i < lights.len; ++i) {
-			data[i] = lights[i];
-			data[i].colour *= light_strengths[i];
-		}
-		lights_handle->unmap();
-	}
+	updateLightsBuffer();
 }
 
 void MaterialEditor::drawWidget() {
@@ -238,6 +238,8 @@ bool MaterialEditor::update() {
 		updateLightsBuffer();
 	}
 
+	has_changed |= updateEnvTable();
+
 	return has_changed;
 }
 
@@ -265,6 +267,18 @@ Handle<Buffer> MaterialEditor::getLights() const {
 	return lights_handle;
 }
 
+Handle<Buffer> MaterialEditor::getLightNodes() const {
+	return light_nodes_handle;
+}
+
+Handle<Buffer> MaterialEditor::getEnvTable() const {
+	return env_handle;
+}
+
+vec2i MaterialEditor::getEnvTableSize() const {
+	return env_size;
+}
+
 size_t MaterialEditor::getLightsCount() const {
 	return lights.len;
 }
@@ -279,6 +293,28 @@ ID3D11ShaderResourceView *MaterialEditor::getBackground() {
 	return nullptr;
 }
 
+bool MaterialEditor::hasPendingTextures() const {
+	return !async_textures.empty();
+}
+
+void MaterialEditor::hash(Hasher &hasher) const {
+	hasher.add(albedo);
+	hasher.add(use_texture);
+	hasher.add(specular);
+	hasher.add(smoothness);
+	hasher.add(emissive);
+	hasher.add(specular_probability);
+
+	hasher.add(lights.len);
+	for (size_t i = 0; i < lights.len; ++i) {
+		hasher.add(lights[i]);
+		hasher.add(light_strengths[i]);
+	}
+
+	hasher.addStr(diffuse_handle < textures.len ? textures[diffuse_handle].name.get() : nullptr);
+	hasher.addStr(background_handle < textures.len ? textures[background_handle].name.get() : nullptr);
+}
+
 Texture2D *MaterialEditor::get(size_t index) {
 	return index < textures.len ? textures[index].handle.get() : nullptr;
 }
@@ -339,13 +375,54 @@ void MaterialEditor::updateLightsBuffer() {
 		lights_handle->resize(cur_lights_count);
 	}
 
+	arr<vec4> spheres;
+	spheres.reserve(lights.len);
+	for (const LightData &light : lights) {
+		spheres.push(light.pos, light.radius);
+	}
+	light_bvh.build(spheres);
+
+	if (cur_nodes_count < light_bvh.nodes.len) {
+		cur_nodes_count = light_bvh.nodes.len * 2;
+		light_nodes_handle->resize(cur_nodes_count);
+	}
+
 	if (LightData *data = lights_handle->map<LightData>()) {
 		for (size_t i = 0; i < lights.len; ++i) {
-			data[i] = lights[i];
-			data[i].colour *= light_strengths[i];
+			const uint index = light_bvh.order[i];
+			data[i] = lights[index];
+			data[i].colour *= light_strengths[index];
 		}
 		lights_handle->unmap();
 	}
+
+	if (LightBVH::Node *nodes = light_nodes_handle->map<LightBVH::Node>()) {
+		for (size_t i = 0; i < light_bvh.nodes.len; ++i) {
+			nodes[i] = light_bvh.nodes[i];
+		}
+		light_nodes_handle->unmap();
+	}
+}
+
+bool MaterialEditor::updateEnvTable() {
+	Texture2D *background = get(background_handle);
+	const envmap::Table *table = background && !background->env_table.empty() ? &background->env_table : nullptr;
+	const uint64_t generation = table ? table->generation : 0;
+
+	if (generation == env_generation) {
+		return false;
+	}
+
+	env_generation = generation;
+	env_size = 0;
+
+	if (table) {
+		env_handle->resize(table->entries.len);
+		env_handle->update(table->entries.buf, table->entries.len * sizeof(envmap::Entry));
+		env_size = table->size;
+	}
+
+	return true;
 }
 
 bool MaterialEditor::texChooser(const char *label, size_t &handle, const char *tip) {
@@ -6,6 +6,9 @@
 #include "mem.h"
 #include "str.h"
 #include "arr.h"
+#include "light_bvh.h"
+
+struct Hasher;
 
 struct MaterialPS {
 	vec3 albedo;
@@ -18,6 +21,7 @@ struct MaterialPS {
 
 GFX_CLASS_CHECK(MaterialPS);
 
+// same as LightData in common.hlsl
 struct LightData {
 	LightData() = default;
 	LightData(const vec3 &p, float r, const vec3 &c, bool rl) : pos(p), radius(r), colour(c), render(rl) {}
@@ -39,10 +43,21 @@ struct MaterialEditor {
 	bool useTonemapping() const;
 	float getExposure() const;
 	Handle<Buffer> getBuffer() const;
+	// the lights are uploaded in the order of the leaves of the bvh
 	Handle<Buffer> getLights() const;
+	Handle<Buffer> getLightNodes() const;
+	// importance sampling table of the background (see env_map.h)
+	Handle<Buffer> getEnvTable() const;
+	// 0 if the background can't be importance sampled (e.g. it's not an hdr texture)
+	vec2i getEnvTableSize() const;
 	size_t getLightsCount() const;
 	ID3D11ShaderResourceView *getDiffuse();
 	ID3D11ShaderResourceView *getBackground();
+	// true while the default textures are still being loaded
+	bool hasPendingTextures() const;
+	// adds everything that changes the ray traced image, tonemapping is left out
+	// as it's only applied when the render is resolved
+	void hash(Hasher &hasher) const;
 
 private:
 	struct TexNamePair {
@@ -64,6 +79,8 @@ private:
 	size_t checkTextureAlreadyLoaded(str::view name);
 	void addLight(const vec3 &pos, float radius, float strength = 3, const vec3 &colour = 1, bool render = true);
 	void updateLightsBuffer();
+	// returns true if the table has changed
+	bool updateEnvTable();
 
 	bool texChooser(const char *label, size_t &handle, const char *tip = nullptr);
 
@@ -81,9 +98,17 @@ private:
 	Handle<Buffer> lights_handle;
 	// start with 10 lights so we don't need to allocate more for a while
 	size_t cur_lights_count = 10;
+	LightBVH light_bvh;
+	Handle<Buffer> light_nodes_handle;
+	size_t cur_nodes_count = 10;
 	
 	Handle<Buffer> mat_handle = nullptr;
 
+	Handle<Buffer> env_handle;
+	// generation of the table in env_handle (see envmap::Table), 0 if there is none
+	uint64_t env_generation = 0;
+	vec2i env_size = 0;
+
 	size_t diffuse_handle;
 	size_t background_handle;
 
@@ -17,8 +17,13 @@ void Options::load(const char *filename) {
 	if (auto gfx = doc.get("gfx")) {
 		gfx->get("vsync").trySet(vsync);
 		gfx->get("auto capture").trySet(auto_capture);
+		gfx->get("check cpu sculpt").trySet(check_cpu_sculpt);
 		gfx->get("show fps").trySet(show_fps);
 		gfx->get("autosave").trySet(auto_save_mins);
+		gfx->get("journal autosave").trySet(journal_autosave);
+		gfx->get("compress saves").trySet(compress_saves);
+		gfx->get("normal volume").trySet(normal_volume);
+		gfx->get("render checkpoint").trySet(render_checkpoint_mins);
 		if (ini::Value res = gfx->get("resolution")) {
 			arr<str::view> vec = res.asVec();
 			if (vec.size() == 2) {
@@ -38,6 +43,8 @@ void Options::load(const char *filename) {
 		log->get("print to console").trySet(print_to_console);
 		log->get("quit on fatal").trySet(quit_on_fatal);
 	}
+
+	logSetOutputs(print_to_console, print_to_file);
 }
 
 void Options::save(const char *filename) {
@@ -49,8 +56,13 @@ void Options::save(const char *filename) {
 	fp.print("vsync = %s\n", B(vsync));
 	fp.print("resolution = %u %u\n", resolution.x, resolution.y);
 	fp.print("auto capture = %s\n", B(auto_capture));
+	fp.print("check cpu sculpt = %s\n", B(check_cpu_sculpt));
 	fp.print("show fps = %s\n", B(show_fps));
 	fp.print("autosave = %.2f\n", auto_save_mins);
+	fp.print("journal autosave = %s\n", B(journal_autosave));
+	fp.print("compress saves = %s\n", B(compress_saves));
+	fp.print("normal volume = %s\n", B(normal_volume));
+	fp.print("render checkpoint = %.2f\n", render_checkpoint_mins);
 
 	fp.puts("\n[camera]\n");
 	fp.print("zoom = %.3f\n", zoom_sensitivity);
@@ -90,18 +102,33 @@ void Options::drawWidget() {
 
 	ImGui::Checkbox("Auto Capture", &auto_capture);
 	tooltip("(Debugging only) Captures the frame every time a sculpting operation happens, only useful if the application is being debugged with RenderDoc");
+	ImGui::Checkbox("Check CPU sculpt", &check_cpu_sculpt);
+	tooltip("(Debugging only) Runs every sculpt and fill on the CPU as well and logs where it differs from the GPU, this is very slow");
 	ImGui::Checkbox("Show FPS", &show_fps);
 
 	ImGui::DragFloat("Auto Save", &auto_save_mins, 0.1f, 0.f, 10.f, "%.3f minute(s)");
 	tooltip("How many minutes before the sculpture auto saves, keep in mind that you need to save it at least once first!");
+	ImGui::Checkbox("Journal autosave", &journal_autosave);
+	tooltip("Autosaves only write the parts of the sculpture that changed to a separate .journal file, which is merged into the save file once it gets too big");
+	ImGui::Checkbox("Compress saves", &compress_saves);
+	tooltip("Uncompressed save files are a lot bigger, but they open instantly as they're memory mapped instead of being decompressed");
+
+	ImGui::Checkbox("Normal volume", &normal_volume);
+	tooltip("Precompute the normals of the sculpture in a separate texture, this makes rendering faster but uses 4 bytes per voxel of video memory");
+
+	ImGui::DragFloat("Render checkpoint", &render_checkpoint_mins, 0.1f, 0.f, 60.f, "%.3f minute(s)");
+	tooltip("How often the progressive render is saved next to the sculpture file (as .render), so it can carry on if the application is closed. It's resumed when the same sculpture is opened again. 0 turns it off");
 
 	separatorText("Camera");
 	ImGui::DragFloat("Zoom sensitivity", &zoom_sensitivity, 1, 1, FLT_MAX);
 	ImGui::DragFloat("Look sensitivity", &look_sensitivity, 1, 1, FLT_MAX);
 
 	separatorText("Logger");
-	ImGui::Checkbox("Print to file", &print_to_file);
-	ImGui::Checkbox("Print to console", &print_to_console);
+	bool has_log_changed = ImGui::Checkbox("Print to file", &print_to_file);
+	has_log_changed |= ImGui::Checkbox("Print to console", &print_to_console);
+	if (has_log_changed) {
+		logSetOutputs(print_to_console, print_to_file);
+	}
 	ImGui::Checkbox("Quit on fatal", &quit_on_fatal);
 
 	ImGui::End();
@@ -8,8 +8,13 @@ struct Options {
 	bool vsync              = true;
 	vec2u resolution        = vec2u(1920, 1080);
 	bool auto_capture       = false;
+	bool check_cpu_sculpt   = false;
 	bool show_fps           = true;
 	float auto_save_mins    = 1.f;
+	bool journal_autosave   = true;
+	bool compress_saves     = true;
+	bool normal_volume      = true;
+	float render_checkpoint_mins = 5.f;
 
 	// camera
 	float zoom_sensitivity  = 20.f;
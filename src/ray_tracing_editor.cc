@@ -1,27 +1,76 @@
 #include "ray_tracing_editor.h"
 
+#include <string.h>
 #include <imgui.h>
+#include <stb_image_write.h>
 
 #include "system.h"
 #include "texture.h"
 #include "buffer.h"
 #include "shader.h"
 #include "material_editor.h"
+#include "sculpture.h"
 #include "widgets.h"
+#include "camera.h"
+#include "sdf.h"
+#include "fs.h"
+#include "str.h"
+#include "options.h"
+#include "hasher.h"
 
 constexpr int block_size = 16;
 constexpr int group_size = 8;
 constexpr int skip_size = block_size * group_size;
+// at most this many times maximum_rays are shot at the pixels that haven't converged
+constexpr float max_ray_scale = 4.f;
+// seconds between two denoises while rendering
+constexpr double denoise_interval = 2.0;
+
+static bool isSamePath(const char *a, const char *b) {
+	if (!a || !b) return a == b;
+	return strcmp(a, b) == 0;
+}
 
 RayTracingEditor::RayTracingEditor() {
 	image       = Texture2D::create(gfx::main_rtv->size, true);
 	data_handle = Buffer::makeConstant<RayTraceData>(Buffer::Usage::Dynamic);
 	shader      = Shader::compile("ray_tracing_cs.hlsl", ShaderType::Compute);
+	resolve_shader = Shader::compile("resolve_cs.hlsl", ShaderType::Compute);
+
+	const size_t pixel_count = (size_t)image->size.x * image->size.y;
+	radiance           = Buffer::makeStructured<vec4>(pixel_count, Bind::GpuReadWrite);
+	radiance_count     = pixel_count;
+	pixel_stats        = Buffer::makeStructured<vec4>(pixel_count, Bind::GpuReadWrite);
+	first_albedo       = Buffer::makeStructured<vec4>(pixel_count, Bind::GpuReadWrite);
+	first_normal       = Buffer::makeStructured<vec4>(pixel_count, Bind::GpuReadWrite);
+	denoised           = Buffer::makeStructured<vec4>(pixel_count, Bind::GpuRead);
+	converged_count    = Buffer::makeStructured<uint>(1, Bind::GpuReadWrite);
+	converged_readback = Buffer::makeStructured<uint>(1, Bind::CpuRead);
+	tile_noise          = Buffer::makeStructured<vec2u>(1, Bind::GpuReadWrite);
+	tile_noise_readback = Buffer::makeStructured<vec2u>(1, Bind::CpuRead);
 
 	if (!image)                gfx::errorExit();
 	if (!data_handle)          gfx::errorExit();
+	if (!resolve_shader)       gfx::errorExit();
+	if (!radiance)             gfx::errorExit();
+	if (!pixel_stats)          gfx::errorExit();
+	if (!first_albedo)         gfx::errorExit();
+	if (!first_normal)         gfx::errorExit();
+	if (!denoised)             gfx::errorExit();
+	if (!converged_count)      gfx::errorExit();
+	if (!converged_readback)   gfx::errorExit();
+	if (!tile_noise)           gfx::errorExit();
+	if (!tile_noise_readback)  gfx::errorExit();
 	if (!shader)               gfx::errorExit();
 	if (!shader->addSampler()) gfx::errorExit();
+
+	buildTiles();
+}
+
+RayTracingEditor::~RayTracingEditor() {
+	checkpoint_job.wait();
+	denoise_job.wait();
+	unmapDenoiseInput();
 }
 
 bool RayTracingEditor::update(const MaterialEditor &me) {
@@ -30,32 +79,21 @@ bool RayTracingEditor::update(const MaterialEditor &me) {
 		reset();
 	}
 
-	// don't update if the window is not even visible
-	if (!is_view_active) return false;
-
-	if (data.thread_loc.y >= (uint)image->size.y) {
-		// if we're not actively rendering, just do a rough first frame
-		if (!is_rendering) return false;
-		
-		data.num_rendered_frames++;
-		data.thread_loc = 0;
-		sum_frame_times += rough_clock.getTime();
-		rough_clock.begin();
+	// keep the frame time around the budget, this is the time of the whole
+	// frame so it also counts the gpu waiting for the dispatches to finish
+	const double frame_ms = last_update ? timerToMilli(timerSince(last_update)) : 0.0;
+	last_update = timerNow();
+	if (frame_ms > frame_budget_ms) {
+		tiles_per_step = math::max(tiles_per_step / 2, 1u);
 	}
-
-	if (RayTraceData *rt_data = data_handle->map<RayTraceData>()) {
-		*rt_data = data;
-		rt_data->num_of_lights = (uint)me.getLightsCount();
-		data_handle->unmap();
+	else {
+		tiles_per_step = math::min(tiles_per_step + 1, (uint)tiles.len);
 	}
 
-	data.thread_loc.x += skip_size;
-	if (data.thread_loc.x >= (uint)image->size.x) {
-		data.thread_loc.x = 0;
-		data.thread_loc.y += skip_size;
-	}
+	num_of_lights = (uint)me.getLightsCount();
 
-	return true;
+	// don't update if the window is not even visible
+	return is_view_active;
 }
 
 void RayTracingEditor::widget() {
@@ -68,6 +106,23 @@ void RayTracingEditor::reset() {
 	start_render = timerNow();
 	data.thread_loc = 0;
 	data.num_rendered_frames = 0;
+	for (Tile &tile : tiles) {
+		tile.frames = 0;
+		tile.last_pass = 0;
+		tile.ray_scale = 1.f;
+	}
+	dirty_tiles.clear();
+	pass = 1;
+	next_tile = 0;
+	converged_pixels = 0;
+	converged_count->clearUAV(0);
+	tile_noise->clearUAV(0);
+	radiance->clearUAV(0);
+	first_albedo->clearUAV(0);
+	first_normal->clearUAV(0);
+	denoise_generation++;
+	has_denoised = false;
+	needs_denoise = false;
 	sum_frame_times = 0;
 	rough_clock.begin();
 	image->clear(Colour::black);
@@ -75,20 +130,119 @@ void RayTracingEditor::reset() {
 
 void RayTracingEditor::resize(const vec2i &size) {
 	image->init(size, true);
+	// resize only grows it, the first frame doesn't read the old stats anyway
+	pixel_stats->resize((size_t)size.x * size.y);
+	radiance->resize((size_t)size.x * size.y);
+	first_albedo->resize((size_t)size.x * size.y);
+	first_normal->resize((size_t)size.x * size.y);
+	radiance_count = math::max(radiance_count, (size_t)size.x * size.y);
+	buildTiles();
 }
 
-void RayTracingEditor::step(MaterialEditor &me, Handle<Texture3D> main_tex, Handle<Buffer> shader_data) {
-	shader->dispatch(
-		vec3u(block_size, block_size, 1),
-		{ data_handle, shader_data, me.getBuffer() },
-			{
-				main_tex->srv,
-				me.getDiffuse(),
-				me.getBackground(),
-				me.getLights()->srv
-			},
-		{ image->uav }
-	);
+bool RayTracingEditor::invalidateBrush(const Camera &cam, const vec3 &brush_extent, const vec3 &volume_size) {
+	if (!refresh) return false;
+	if (tiles.empty()) return true;
+
+	// same projection as ray_tracing_cs.hlsl, going back from the ray to the pixel
+	const vec3 dir = cam.getMouseDir();
+	const float z = dot(dir, cam.fwd);
+	if (z <= 0) return true;
+
+	const vec2 size = vec2(image->size);
+	const float aspect_ratio = size.x / size.y;
+	const vec2 uv = vec2(dot(dir, cam.right), dot(dir, cam.up)) / z;
+	const vec2 centre = vec2(uv.x + 1.f, 1.f - uv.y * aspect_ratio) * 0.5f * size;
+
+	// the brush is somewhere along the ray, the closest it can be is the side of the
+	// volume closest to the camera, which is also where it's the biggest on screen.
+	// the margin covers the normals, which sample a few voxels around the surface
+	const vec3 ray_origin = cam.pos + cam.fwd * cam.getZoom();
+	const float distance = math::max(ray_origin.mag() - volume_size.mag() * 0.5f, 1.f);
+	const float world_radius = brush_extent.mag() * 0.5f + sdf::normal_step * 2.f;
+	const float radius = math::min(world_radius / distance, 2.f) * size.x * 0.5f;
+
+	const vec2i tile_min = vec2i(floor((centre - radius) / (float)skip_size));
+	const vec2i tile_max = vec2i(floor((centre + radius) / (float)skip_size));
+
+	for (int y = math::max(tile_min.y, 0); y <= math::min(tile_max.y, tile_count.y - 1); ++y) {
+		for (int x = math::max(tile_min.x, 0); x <= math::min(tile_max.x, tile_count.x - 1); ++x) {
+			const uint index = (uint)(x + y * tile_count.x);
+			Tile &tile = tiles[index];
+			if (tile.frames == 0) continue;
+			tile.frames = 0;
+			dirty_tiles.push(index);
+		}
+	}
+
+	return true;
+}
+
+void RayTracingEditor::step(MaterialEditor &me, Sculpture &sculpture, Camera &cam, Handle<Buffer> shader_data) {
+	// the shader data still has the old camera, so only show the resumed
+	// render and start rendering again from the next frame
+	if (updateCheckpoint(me, sculpture, cam)) {
+		resolve(shader_data);
+		return;
+	}
+
+	uint rendered = 0;
+
+	for (uint i = 0; i < tiles_per_step; ++i) {
+		const int index = pickTile();
+		if (index < 0) break;
+
+		Tile &tile = tiles[index];
+		data.thread_loc = tile.loc;
+		data.tile_frame = tile.frames;
+		data.tile_index = (uint)index;
+		data.ray_scale = tile.ray_scale;
+		data.num_of_lights = num_of_lights;
+		data.image_size = vec2u(image->size);
+		data.env_size = vec2u(me.getEnvTableSize());
+
+		if (RayTraceData *rt_data = data_handle->map<RayTraceData>()) {
+			*rt_data = data;
+			data_handle->unmap();
+		}
+
+		shader->dispatch(
+			vec3u(block_size, block_size, 1),
+			{ data_handle, shader_data, me.getBuffer() },
+				{
+					sculpture.volume.table->srv,
+					me.getDiffuse(),
+					me.getBackground(),
+					me.getLights()->srv,
+					sculpture.min_mips[0]->srv,
+					sculpture.min_mips[1]->srv,
+					sculpture.min_mips[2]->srv,
+					sculpture.volume.normals->srv,
+					me.getEnvTable()->srv,
+					me.getLightNodes()->srv,
+					sculpture.volume.atlas->srv,
+				},
+			{ radiance->uav, pixel_stats->uav, converged_count->uav, first_albedo->uav, first_normal->uav, tile_noise->uav }
+		);
+
+		tile.frames++;
+		tile.last_pass = pass;
+		rendered++;
+	}
+
+	if (rendered > 0) {
+		needs_denoise = true;
+	}
+
+	const bool has_new_image = updateDenoiser();
+
+	if (rendered > 0 || has_new_image) {
+		resolve(shader_data);
+	}
+
+	if (pending_screenshot && !needs_denoise && !is_denoise_copied && !denoise_job.isValid()) {
+		pending_screenshot = false;
+		image->takeScreenshot("ray_tracing_render");
+	}
 }
 
 bool RayTracingEditor::isEditorOpen() const {
@@ -123,6 +277,489 @@ Handle<Shader> RayTracingEditor::getShader() const {
 	return shader;
 }
 
+void RayTracingEditor::buildTiles() {
+	tile_count = (image->size + skip_size - 1) / skip_size;
+
+	tiles.clear();
+	tiles.reserve((size_t)tile_count.x * tile_count.y);
+	for (int y = 0; y < tile_count.y; ++y) {
+		for (int x = 0; x < tile_count.x; ++x) {
+			tiles.push(Tile{ vec2u(x, y) * skip_size });
+		}
+	}
+
+	dirty_tiles.clear();
+	tiles_per_step = math::min(tiles_per_step, math::max((uint)tiles.len, 1u));
+	sortTiles();
+
+	// resize only grows them, so they always have the same size
+	tile_noise->resize(math::max(tiles.len, (size_t)1));
+	tile_noise_readback->resize(math::max(tiles.len, (size_t)1));
+	tile_noise->clearUAV(0);
+}
+
+void RayTracingEditor::sortTiles() {
+	const vec2 image_centre = vec2(image->size) * 0.5f;
+	const vec2 target = order == TileOrder::MouseFocus && focus.x >= 0 ? focus : image_centre;
+
+	const auto &priority = [&](uint index) {
+		if (order == TileOrder::Raster) return (float)index;
+		const vec2 tile_centre = vec2(tiles[index].loc) + skip_size * 0.5f;
+		return (tile_centre - target).mag2();
+	};
+
+	tile_order.clear();
+	tile_order.reserve(tiles.len);
+	for (uint i = 0; i < tiles.len; ++i) {
+		tile_order.push(i);
+	}
+
+	// insertion sort, there are only a few hundred tiles at most
+	for (size_t i = 1; i < tile_order.len; ++i) {
+		const uint index = tile_order[i];
+		const float key = priority(index);
+		size_t j = i;
+		for (; j > 0 && priority(tile_order[j - 1]) > key; --j) {
+			tile_order[j] = tile_order[j - 1];
+		}
+		tile_order[j] = index;
+	}
+
+	// the tiles already rendered in this pass are skipped, so it's safe to start over
+	next_tile = 0;
+}
+
+int RayTracingEditor::pickTile() {
+	if (tiles.empty()) return -1;
+
+	// the tiles that have changed always go first
+	if (!dirty_tiles.empty()) {
+		const uint index = dirty_tiles[0];
+		dirty_tiles.removeSlow(0);
+		return (int)index;
+	}
+
+	while (true) {
+		for (; next_tile < tile_order.len; ++next_tile) {
+			const uint index = tile_order[next_tile];
+			if (tiles[index].last_pass < pass) {
+				return (int)index;
+			}
+		}
+
+		// every tile has been rendered in this pass
+		// if we're not actively rendering, just do a rough first frame
+		if (!is_rendering) return -1;
+
+		data.num_rendered_frames++;
+		pass++;
+		next_tile = 0;
+		readbackConverged();
+		sum_frame_times += rough_clock.getTime();
+		rough_clock.begin();
+	}
+}
+
+void RayTracingEditor::resolve(Handle<Buffer> shader_data) {
+	// the denoised image can be a few frames behind, it catches up once the denoiser is done
+	Handle<Buffer> source = use_denoiser && has_denoised ? denoised : radiance;
+
+	resolve_shader->dispatch(
+		vec3u((image->size.x + group_size - 1) / group_size, (image->size.y + group_size - 1) / group_size, 1),
+		{ shader_data },
+		{ source->srv },
+		{ image->uav }
+	);
+}
+
+bool RayTracingEditor::saveHdr(const char *base_name) {
+	const size_t pixel_count = (size_t)image->size.x * image->size.y;
+
+	arr<vec4> sums;
+	if (use_denoiser) {
+		// denoise the latest frame instead of using the preview, which could be behind
+		DenoiseState state;
+		if (!readbackDenoiseInput(state)) {
+			return false;
+		}
+		state.run(denoise_settings);
+		sums = mem::move(state.output);
+	}
+	else if (!readback(*radiance.get(), sums)) {
+		return false;
+	}
+
+	if (sums.len < pixel_count) {
+		err("couldn't denoise the render");
+		return false;
+	}
+
+	arr<float> pixels;
+	pixels.reserve(pixel_count * 3);
+	pixels.len = pixel_count * 3;
+
+	for (size_t i = 0; i < pixel_count; ++i) {
+		const vec4 &sum = sums[i];
+		const float rays = sum.w > 0 ? sum.w : 1.f;
+		pixels[i * 3 + 0] = sum.x / rays;
+		pixels[i * 3 + 1] = sum.y / rays;
+		pixels[i * 3 + 2] = sum.z / rays;
+	}
+
+	char base_fmt[64];
+	str::formatBuf(base_fmt, sizeof(base_fmt), "%s_%%03d.hdr", base_name);
+	mem::ptr<char[]> name = fs::findFirstAvailable("screenshots", base_fmt);
+	if (!stbi_write_hdr(name.get(), image->size.x, image->size.y, 3, pixels.buf)) {
+		err("couldn't save the render to %s", name.get());
+		return false;
+	}
+
+	info("saved render as %s", name.get());
+	widgets::addMessage(LogLevel::Info, str::format("saved render as %s", name.get()));
+	return true;
+}
+
+bool RayTracingEditor::readback(Buffer &source, arr<vec4> &out) {
+	if (!radiance_readback) {
+		radiance_readback = Buffer::makeStructured<vec4>(radiance_count, Bind::CpuRead);
+		if (!radiance_readback) {
+			err("couldn't create the buffer to read back the render");
+			return false;
+		}
+	}
+	// the copy needs both buffers to be the same size, the other per pixel
+	// buffers always have the same size as radiance
+	radiance_readback->resize(radiance_count);
+	radiance_readback->copyFrom(source);
+
+	const vec4 *values = radiance_readback->mapRead<vec4>();
+	if (!values) {
+		err("couldn't read back the render");
+		return false;
+	}
+
+	const size_t pixel_count = (size_t)image->size.x * image->size.y;
+	out.destroy();
+	out.reserve(pixel_count);
+	out.len = pixel_count;
+	memcpy(out.buf, values, pixel_count * sizeof(vec4));
+
+	radiance_readback->unmap();
+	return true;
+}
+
+bool RayTracingEditor::updateCheckpoint(const MaterialEditor &me, const Sculpture &sculpture, Camera &cam) {
+	// still loading or saving the last one
+	if (checkpoint_job.isValid() && !checkpoint_job.isFinished()) {
+		return false;
+	}
+
+	const char *source = sculpture.getSourcePath();
+
+	if (!isSamePath(source, checkpoint_source.get())) {
+		checkpoint_source.destroy();
+		sculpture_hash = 0;
+		has_checkpoint = false;
+
+		if (!source) {
+			return false;
+		}
+
+		// loading the checkpoint (if there is one) can take a while, so do it in the background
+		// together with hashing the sculpture file
+		checkpoint_source = str::dup(source);
+		checkpoint_job = thr::schedule(
+			[this]() {
+				sculpture_hash = checkpoint::hashSculpture(checkpoint_source.get());
+				has_checkpoint = checkpoint::load(checkpoint::getPath(checkpoint_source.get()).get(), checkpoint_state);
+			}
+		);
+		return false;
+	}
+
+	// the texture names are part of the scene hash, so wait for them to be loaded
+	if (has_checkpoint) {
+		if (me.hasPendingTextures()) {
+			return false;
+		}
+		has_checkpoint = false;
+		return resumeCheckpoint(me, cam);
+	}
+
+	const float interval = Options::get().render_checkpoint_mins * 60.f;
+	if (checkpoint_source && sculpture_hash && is_rendering && interval > 0) {
+		if (checkpoint_clock.every(interval)) {
+			saveCheckpoint(me, cam);
+		}
+	}
+
+	return false;
+}
+
+void RayTracingEditor::saveCheckpoint(const MaterialEditor &me, const Camera &cam) {
+	checkpoint::State &state = checkpoint_state;
+
+	if (!readback(*radiance.get(), state.radiance))    return;
+	if (!readback(*pixel_stats.get(), state.pixel_stats)) return;
+
+	state.scene_hash          = getSceneHash(me);
+	state.size                = image->size;
+	state.num_rendered_frames = data.num_rendered_frames;
+	state.pass                = pass;
+	state.render_time         = timerSince(start_render);
+	state.sum_frame_times     = sum_frame_times;
+	state.maximum_bounces     = data.maximum_bounces;
+	state.maximum_rays        = data.maximum_rays;
+	state.maximum_trace_dist  = data.maximum_trace_dist;
+	state.jitter_amount       = data.jitter_amount;
+	state.noise_threshold     = data.noise_threshold;
+	state.min_samples         = data.min_samples;
+	state.cam_angle           = cam.angle;
+	state.cam_zoom_exp        = cam.zoom_exp;
+
+	state.tile_frames.clear();
+	state.tile_passes.clear();
+	for (const Tile &tile : tiles) {
+		state.tile_frames.push(tile.frames);
+		state.tile_passes.push(tile.last_pass);
+	}
+
+	// compressing and writing a few hundred megabytes takes a while
+	checkpoint_job = thr::schedule(
+		[this]() {
+			checkpoint::save(checkpoint::getPath(checkpoint_source.get()).get(), checkpoint_state);
+		}
+	);
+}
+
+bool RayTracingEditor::resumeCheckpoint(const MaterialEditor &me, Camera &cam) {
+	checkpoint::State &state = checkpoint_state;
+
+	if (state.scene_hash != getSceneHash(me) || any(state.size != image->size) || state.tile_frames.len != tiles.len) {
+		info("render checkpoint is for a different scene or resolution, ignoring it");
+		return false;
+	}
+
+	// the current render has already gone further than the checkpoint
+	if (state.num_rendered_frames <= data.num_rendered_frames) {
+		return false;
+	}
+
+	reset();
+
+	// the buffers can be bigger than the image, only the start of them is used
+	radiance->update(state.radiance.buf, state.radiance.len * sizeof(vec4));
+	pixel_stats->update(state.pixel_stats.buf, state.pixel_stats.len * sizeof(vec4));
+
+	data.num_rendered_frames = state.num_rendered_frames;
+	data.maximum_bounces     = state.maximum_bounces;
+	data.maximum_rays        = state.maximum_rays;
+	data.maximum_trace_dist  = state.maximum_trace_dist;
+	data.jitter_amount       = state.jitter_amount;
+	data.noise_threshold     = state.noise_threshold;
+	data.min_samples         = state.min_samples;
+	pass                     = state.pass;
+	start_render             = timerNow() - state.render_time;
+	sum_frame_times          = state.sum_frame_times;
+
+	for (size_t i = 0; i < tiles.len; ++i) {
+		tiles[i].frames = state.tile_frames[i];
+		tiles[i].last_pass = state.tile_passes[i];
+	}
+
+	cam.angle = state.cam_angle;
+	cam.zoom_exp = state.cam_zoom_exp;
+	cam.updateVectors();
+
+	// it was rendering when the checkpoint was saved
+	is_rendering = true;
+
+	// only needed again for the next save
+	state.radiance.destroy();
+	state.pixel_stats.destroy();
+
+	info("resumed render from checkpoint (%u frames)", data.num_rendered_frames);
+	widgets::addMessage(LogLevel::Info, str::format("resumed render from checkpoint (%u frames)", data.num_rendered_frames));
+	return true;
+}
+
+uint64_t RayTracingEditor::getSceneHash(const MaterialEditor &me) const {
+	Hasher hasher;
+	hasher.add(sculpture_hash);
+	me.hash(hasher);
+	return hasher.value;
+}
+
+bool RayTracingEditor::updateDenoiser() {
+	bool has_new_image = false;
+
+	if (denoise_job.isValid()) {
+		if (!denoise_job.isFinished()) {
+			return false;
+		}
+		denoise_job = thr::Job();
+		unmapDenoiseInput();
+
+		// the render could have been reset while it was denoising
+		if (use_denoiser && denoise_state.generation == denoise_generation && !denoise_state.output.empty()) {
+			denoised->resize(denoise_state.output.len);
+			denoised->update(denoise_state.output.buf, denoise_state.output.len * sizeof(vec4));
+			has_denoised = true;
+			has_new_image = true;
+		}
+	}
+
+	// it has just been turned off, go back to the noisy image
+	if (!use_denoiser) {
+		has_new_image = has_denoised;
+		has_denoised = false;
+		needs_denoise = false;
+		force_denoise = false;
+		is_denoise_copied = false;
+		pending_screenshot = false;
+		return has_new_image;
+	}
+
+	// the copy was started last frame, so the gpu should be done with it by now
+	if (is_denoise_copied) {
+		is_denoise_copied = false;
+		if (mapDenoiseInput()) {
+			const cpu::DenoiseSettings settings = denoise_settings;
+			denoise_job = thr::schedule(
+				[this, settings]() {
+					denoise_state.run(settings);
+				}
+			);
+		}
+		return has_new_image;
+	}
+
+	const bool is_interval_over = !last_denoise || timerToSec(timerSince(last_denoise)) >= denoise_interval;
+	const bool should_denoise = force_denoise || (needs_denoise && (is_interval_over || pending_screenshot));
+	if (should_denoise && copyDenoiseInput()) {
+		needs_denoise = false;
+		force_denoise = false;
+		last_denoise = timerNow();
+		is_denoise_copied = true;
+	}
+
+	return has_new_image;
+}
+
+bool RayTracingEditor::copyDenoiseInput() {
+	Buffer *sources[4] = { radiance.get(), pixel_stats.get(), first_albedo.get(), first_normal.get() };
+
+	for (int i = 0; i < 4; ++i) {
+		Handle<Buffer> &readback = denoise_readback[i];
+		if (!readback) {
+			readback = Buffer::makeStructured<vec4>(radiance_count, Bind::CpuRead);
+			if (!readback) {
+				err("couldn't create the buffers to read back the render for the denoiser");
+				return false;
+			}
+		}
+		// same as in readback, the per pixel buffers always have the same size as radiance
+		readback->resize(radiance_count);
+		readback->copyFrom(*sources[i]);
+	}
+
+	denoise_state.input.size = image->size;
+	denoise_state.generation = denoise_generation;
+	return true;
+}
+
+bool RayTracingEditor::mapDenoiseInput() {
+	const size_t pixel_count = (size_t)denoise_state.input.size.x * denoise_state.input.size.y;
+	const vec4 *values[4] = {};
+
+	for (int i = 0; i < 4; ++i) {
+		values[i] = denoise_readback[i]->mapRead<vec4>();
+		if (!values[i]) {
+			for (int j = 0; j < i; ++j) {
+				denoise_readback[j]->unmap();
+			}
+			err("couldn't read back the render for the denoiser");
+			return false;
+		}
+	}
+
+	is_denoise_mapped = true;
+	denoise_state.input.radiance     = Slice<vec4>(values[0], pixel_count);
+	denoise_state.input.pixel_stats  = Slice<vec4>(values[1], pixel_count);
+	denoise_state.input.albedo       = Slice<vec4>(values[2], pixel_count);
+	denoise_state.input.normal_depth = Slice<vec4>(values[3], pixel_count);
+	return true;
+}
+
+void RayTracingEditor::unmapDenoiseInput() {
+	if (!is_denoise_mapped) return;
+	is_denoise_mapped = false;
+
+	for (Handle<Buffer> &readback : denoise_readback) {
+		readback->unmap();
+	}
+	// the job has finished, nothing reads them anymore
+	denoise_state.input.radiance     = Slice<vec4>();
+	denoise_state.input.pixel_stats  = Slice<vec4>();
+	denoise_state.input.albedo       = Slice<vec4>();
+	denoise_state.input.normal_depth = Slice<vec4>();
+}
+
+bool RayTracingEditor::readbackDenoiseInput(DenoiseState &state) {
+	if (!readback(*radiance.get(), state.radiance))         return false;
+	if (!readback(*pixel_stats.get(), state.pixel_stats))   return false;
+	if (!readback(*first_albedo.get(), state.albedo))       return false;
+	if (!readback(*first_normal.get(), state.normal_depth)) return false;
+	state.input.size         = image->size;
+	state.input.radiance     = state.radiance;
+	state.input.pixel_stats  = state.pixel_stats;
+	state.input.albedo       = state.albedo;
+	state.input.normal_depth = state.normal_depth;
+	state.generation = denoise_generation;
+	return true;
+}
+
+void RayTracingEditor::DenoiseState::run(const cpu::DenoiseSettings &settings) {
+	cpu::denoise(input, settings, output);
+}
+
+void RayTracingEditor::readbackConverged() {
+	converged_readback->copyFrom(*converged_count.get());
+	if (const uint *count = converged_readback->mapRead<uint>()) {
+		converged_pixels = *count;
+		converged_readback->unmap();
+	}
+	converged_count->clearUAV(0);
+
+	tile_noise_readback->copyFrom(*tile_noise.get());
+	const vec2u *noise = tile_noise_readback->mapRead<vec2u>();
+	if (!noise) return;
+
+	// keep the number of rays per pass about the same, moving the ones that the
+	// converged pixels don't need anymore to the noisy ones. every pixel left gets
+	// a share proportional to how noisy its tile is on average, so the tiles that
+	// are still far from converging get more rays than the ones that are almost done
+	const size_t pixel_count = (size_t)image->size.x * image->size.y;
+	double noise_sum = 0;
+	for (size_t i = 0; i < tiles.len; ++i) {
+		noise_sum += noise[i].x / 256.0;
+	}
+
+	for (size_t i = 0; i < tiles.len; ++i) {
+		Tile &tile = tiles[i];
+		// the tile has converged (or adaptive sampling is off)
+		if (noise[i].y == 0 || noise_sum <= 0) {
+			tile.ray_scale = 1.f;
+			continue;
+		}
+		const double mean_noise = noise[i].x / 256.0 / noise[i].y;
+		tile.ray_scale = (float)math::min(mean_noise * pixel_count / noise_sum, (double)max_ray_scale);
+	}
+
+	tile_noise_readback->unmap();
+	tile_noise->clearUAV(0);
+}
+
 void RayTracingEditor::imageWidget() {
 	if (!is_view_open) return;
 	if (!ImGui::Begin("Render", &is_view_open)) {
@@ -133,7 +770,19 @@ void RayTracingEditor::imageWidget() {
 
 	is_view_active = true;
 
-	widgets::imageView(image);
+	vec4 bounds;
+	widgets::imageView(image, &bounds);
+
+	// render where the user is looking at first
+	if (order == TileOrder::MouseFocus && ImGui::IsItemHovered()) {
+		const vec2 mouse = vec2(ImGui::GetMousePos()) - bounds.pos;
+		const vec2 new_focus = mouse / bounds.size * vec2(image->size);
+		const vec2 old_tile = floor(focus / (float)skip_size);
+		focus = new_focus;
+		if (any(floor(focus / (float)skip_size) != old_tile)) {
+			sortTiles();
+		}
+	}
 
 	ImGui::End();
 }
@@ -159,6 +808,8 @@ void RayTracingEditor::timeWidget() {
 		ImGui::Text("Rendering time: %s", timerFormat(timerSince(start_render)));
 		ImGui::Text("Frames rendered: %d", data.num_rendered_frames);
 		ImGui::Text("Average time per frame: %s", data.num_rendered_frames ? timerFormat(sum_frame_times / data.num_rendered_frames) : "n/a");
+		const size_t pixel_count = (size_t)image->size.x * image->size.y;
+		ImGui::Text("Converged pixels: %.1f%%", pixel_count ? (double)converged_pixels / pixel_count * 100.0 : 0.0);
 	ImGui::End();
 }
 
@@ -203,6 +854,46 @@ void RayTracingEditor::editorWidget() {
 	);
 	should_redraw |= inputUint("##max_rays", data.maximum_rays);
 
+	ImGui::Text("Noise threshold");
+	tooltip(
+		"Once the noise in a pixel is below this (relative to its brightness) "
+		"it stops being rendered, and its rays are used on the pixels that are "
+		"still noisy. 0 renders every pixel every frame"
+	);
+	should_redraw |= filledSlider("##noise_threshold", &data.noise_threshold, 0.f, 0.1f);
+
+	ImGui::Text("Denoise");
+	tooltip(
+		"Smooth out the noise while keeping the edges of the sculpture, it runs "
+		"on the cpu in the background so the preview can be a few frames behind. "
+		"The saved images are denoised too"
+	);
+	ImGui::SameLine();
+	force_denoise |= ImGui::Checkbox("##denoise", &use_denoiser);
+
+	if (use_denoiser) {
+		ImGui::Text("Denoiser passes");
+		tooltip("Every pass blurs twice as far as the last one, more passes get rid of bigger blotches");
+		force_denoise |= ImGui::SliderInt("##denoise_passes", &denoise_settings.passes, 1, 8);
+
+		ImGui::Text("Denoiser strength");
+		tooltip("How different (compared to their noise) two pixels can be and still be blurred together");
+		force_denoise |= filledSlider("##denoise_strength", &denoise_settings.luminance_sigma, 0.5f, 16.f);
+	}
+
+	ImGui::Text("Tile order");
+	tooltip(
+		"Which parts of the image are rendered first: top to bottom, "
+		"from the centre out, or from where the mouse is in the render view"
+	);
+	if (ImGui::Combo("##tile_order", (int *)&order, "Top to bottom\0From the centre\0Mouse focus\0")) {
+		sortTiles();
+	}
+
+	ImGui::Text("Frame time budget (ms)");
+	tooltip("More tiles are rendered every frame as long as a frame takes less than this");
+	ImGui::DragFloat("##frame_budget", &frame_budget_ms, 0.5f, 1.f, 100.f);
+
 	ImGui::Text("Trace distance");
 	tooltip("How far away is a ray allowed to go");
 	should_redraw |= ImGui::DragFloat("##trace_distance", &data.maximum_trace_dist, 10.f);
@@ -223,7 +914,19 @@ void RayTracingEditor::editorWidget() {
 
 	if (btnFillWidth("Save image", "Save the current frame to a file called \"ray_tracing_render_XYZ.png\" in the screenshots folder")) {
 		is_rendering = false;
-		image->takeScreenshot("ray_tracing_render");
+		// the preview is only updated while the render view is visible
+		if (use_denoiser && is_view_active) {
+			pending_screenshot = true;
+			needs_denoise = true;
+		}
+		else {
+			image->takeScreenshot("ray_tracing_render");
+		}
+	}
+
+	if (btnFillWidth("Save HDR image", "Save the render without tonemapping to a file called \"ray_tracing_render_XYZ.hdr\" in the screenshots folder")) {
+		is_rendering = false;
+		saveHdr("ray_tracing_render");
 	}
 
 	ImGui::PopItemWidth();
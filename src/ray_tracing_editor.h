@@ -5,6 +5,11 @@
 #include "vec.h"
 #include "timer.h"
 #include "handle.h"
+#include "arr.h"
+#include "mem.h"
+#include "thr.h"
+#include "render_checkpoint.h"
+#include "cpu_denoise.h"
 
 struct DynamicShader;
 struct MaterialEditor;
@@ -12,6 +17,8 @@ struct Shader;
 struct Texture2D;
 struct Texture3D;
 struct Buffer;
+struct Sculpture;
+struct Camera;
 
 struct RayTracingEditor {
 	struct RayTraceData {
@@ -23,17 +30,38 @@ struct RayTracingEditor {
 		uint maximum_rays        = 10;
 		float maximum_trace_dist = 3000.f;
 		float jitter_amount      = 1.f;
+		// relative noise below which a pixel stops being sampled, 0 turns it off
+		float noise_threshold    = 0.01f;
+		// multiplier of maximum_rays for the pixels of the current tile that haven't converged yet
+		float ray_scale          = 1.f;
+		uint min_samples         = 64;
+		// number of frames the current tile has already rendered
+		uint tile_frame          = 0;
+		vec2u image_size         = 0;
+		// size of the background's importance sampling table, 0 if it doesn't have one
+		vec2u env_size           = 0;
+		// index of the current tile in tile_noise
+		uint tile_index          = 0;
+		vec3u padding__2         = 0;
 	};
 
 	GFX_CLASS_CHECK(RayTraceData);
 
 	RayTracingEditor();
+	// waits for the checkpoint to finish saving and for the denoiser
+	~RayTracingEditor();
 
 	bool update(const MaterialEditor &me);
 	void widget();
 	void reset();
 	void resize(const vec2i &size);
-	void step(MaterialEditor &me, Handle<Texture3D> main_tex, Handle<Buffer> shader_data);
+	// can change the camera when it resumes a render from a checkpoint
+	void step(MaterialEditor &me, Sculpture &sculpture, Camera &cam, Handle<Buffer> shader_data);
+	// only re-renders the tiles around where the brush has sculpted, call it instead of
+	// reset when that's the only thing that changed. the light bouncing off the new
+	// shape is ignored until the next full reset, which is fine for a preview.
+	// returns false if the render is not refreshed automatically
+	bool invalidateBrush(const Camera &cam, const vec3 &brush_extent, const vec3 &volume_size);
 
 	bool isEditorOpen() const;
 	void setEditorOpen(bool is_open);
@@ -49,10 +77,94 @@ private:
 	void imageWidget();
 	void timeWidget();
 	void editorWidget();
+	void readbackConverged();
+	void resolve(Handle<Buffer> shader_data);
+	bool saveHdr(const char *base_name);
+	// copies one of the vec4 per pixel buffers (e.g. radiance or pixel_stats) to the cpu
+	bool readback(Buffer &source, arr<vec4> &out);
+	// returns true if the render has been resumed from a checkpoint
+	bool updateCheckpoint(const MaterialEditor &me, const Sculpture &sculpture, Camera &cam);
+	void saveCheckpoint(const MaterialEditor &me, const Camera &cam);
+	bool resumeCheckpoint(const MaterialEditor &me, Camera &cam);
+	uint64_t getSceneHash(const MaterialEditor &me) const;
+	// uploads the last denoised image once it's ready and starts denoising the
+	// new frames, returns true if the image has to be resolved again
+	bool updateDenoiser();
+	// starts copying the denoiser input to the staging buffers, they're mapped the next frame
+	bool copyDenoiseInput();
+	bool mapDenoiseInput();
+	void unmapDenoiseInput();
+	void buildTiles();
+	void sortTiles();
+	// index of the next tile to render, -1 if there is nothing to do
+	int pickTile();
+
+	enum class TileOrder : int { Raster, Spiral, MouseFocus };
+
+	// everything the denoiser needs, read back from the gpu
+	struct DenoiseState {
+		void run(const cpu::DenoiseSettings &settings);
+
+		// points either to the arrays below or to the mapped staging buffers
+		cpu::DenoiseInput input;
+		arr<vec4> radiance;
+		arr<vec4> pixel_stats;
+		arr<vec4> albedo;
+		arr<vec4> normal_depth;
+		// same layout as radiance
+		arr<vec4> output;
+		// denoise_generation when it was read back
+		uint generation = 0;
+	};
+
+	bool readbackDenoiseInput(DenoiseState &state);
+
+	// one block of block_size * block_size thread groups
+	struct Tile {
+		vec2u loc = 0;
+		// frames accumulated since it was last reset
+		uint frames = 0;
+		// last pass over the whole image it was rendered in
+		uint last_pass = 0;
+		// multiplier of maximum_rays, based on how noisy the tile was in the last pass
+		float ray_scale = 1.f;
+	};
 
 	Handle<Shader> shader;
 	Handle<Texture2D> image;
 	Handle<Buffer> data_handle;
+	Handle<Shader> resolve_shader;
+	// float sum of the light and number of rays of every pixel
+	Handle<Buffer> radiance;
+	Handle<Buffer> radiance_readback;
+	// radiance is only ever grown
+	size_t radiance_count = 0;
+	Handle<Buffer> pixel_stats;
+	// albedo, normal and depth of the first hit of every pixel, for the denoiser
+	Handle<Buffer> first_albedo;
+	Handle<Buffer> first_normal;
+	Handle<Buffer> converged_count;
+	Handle<Buffer> converged_readback;
+	uint converged_pixels = 0;
+	// per tile, x: sum of how noisy its pixels that haven't converged are (in 1/256ths),
+	// y: how many of them there are. cleared every pass
+	Handle<Buffer> tile_noise;
+	Handle<Buffer> tile_noise_readback;
+	arr<Tile> tiles;
+	// tile indices in the order they are rendered in
+	arr<uint> tile_order;
+	// tiles that have been invalidated, they are rendered before anything else
+	arr<uint> dirty_tiles;
+	vec2i tile_count = 0;
+	size_t next_tile = 0;
+	uint pass = 1;
+	TileOrder order = TileOrder::Spiral;
+	// where the mouse is in the render view, in pixels
+	vec2 focus = -1;
+	uint num_of_lights = 0;
+	uint tiles_per_step = 1;
+	float frame_budget_ms = 20.f;
+	uint64_t last_update = 0;
 	RayTraceData data;
 	uint64_t start_render = 0;
 	bool is_rendering = false;
@@ -63,4 +175,40 @@ private:
 	bool refresh = true;
 	CPUClock rough_clock = "ray tracing frame";
 	uint64_t sum_frame_times = 0;
+
+	// sculpture file the checkpoint is for, null if the sculpture is not the same as any file
+	mem::ptr<char[]> checkpoint_source;
+	// hash of the sculpture file, computed in the background when the source changes
+	uint64_t sculpture_hash = 0;
+	// loaded or being saved by checkpoint_job, don't touch it until the job has finished
+	checkpoint::State checkpoint_state;
+	thr::Job checkpoint_job;
+	// a checkpoint has been loaded and is waiting to be resumed
+	bool has_checkpoint = false;
+	IntervalClock checkpoint_clock;
+
+	cpu::DenoiseSettings denoise_settings;
+	bool use_denoiser = false;
+	// the last denoised image, same layout as radiance so it can be resolved the same way
+	Handle<Buffer> denoised;
+	// read back and denoised by denoise_job, don't touch it until the job has finished
+	DenoiseState denoise_state;
+	thr::Job denoise_job;
+	// goes up on every reset, so the images denoised before it are thrown away
+	uint denoise_generation = 0;
+	// denoised has an image of the current render, so it's shown instead of radiance
+	bool has_denoised = false;
+	// new frames have been rendered since the last time it was denoised
+	bool needs_denoise = false;
+	// the settings have changed, denoise again without waiting for the interval
+	bool force_denoise = false;
+	// when the last denoise started, they're throttled as every one reads back the whole image
+	uint64_t last_denoise = 0;
+	// radiance, pixel_stats, albedo and normal_depth, copied one frame and mapped the next one
+	// so the cpu doesn't wait for the gpu. they stay mapped while denoise_job reads them
+	Handle<Buffer> denoise_readback[4];
+	bool is_denoise_copied = false;
+	bool is_denoise_mapped = false;
+	// save the image once the denoiser has caught up with the render
+	bool pending_screenshot = false;
 };
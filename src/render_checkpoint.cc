@@ -0,0 +1,163 @@
+#include "render_checkpoint.h"
+
+#include <string.h>
+#include <zstd.hpp>
+
+#include "tracelog.h"
+#include "fs.h"
+#include "str.h"
+#include "journal.h"
+#include "hasher.h"
+
+// file layout:
+//   header: "rchk" | version (u32) | scene hash (u64) | image size (vec2i)
+//           | rendered frames (u32) | pass (u32) | render time (u64) | sum of frame times (u64)
+//           | bounces (u32) | rays (u32) | trace distance (f32) | jitter (f32) | noise threshold (f32) | min samples (u32)
+//           | camera angle (vec2) | camera zoom (f32) | tile count (u32) | compressed size (u64)
+//   then zstd(tile frames (u32) + tile passes (u32) + radiance (vec4) + pixel stats (vec4))
+
+constexpr uint32_t checkpoint_version = 1;
+
+// == PRIVATE FUNCTIONS ========================================================
+
+template<typename T>
+static void readArr(const uint8_t *&cur, arr<T> &out, size_t count) {
+	out.destroy();
+	out.reserve(count);
+	out.len = count;
+	memcpy(out.buf, cur, count * sizeof(T));
+	cur += count * sizeof(T);
+}
+
+// == PUBLIC FUNCTIONS =========================================================
+
+namespace checkpoint {
+	mem::ptr<char[]> getPath(const char *sculpture_path) {
+		return str::formatStr("%s.render", sculpture_path);
+	}
+
+	uint64_t hashSculpture(const char *sculpture_path) {
+		Hasher hasher;
+		if (!hasher.addFileId(sculpture_path)) {
+			return 0;
+		}
+		// the journal is optional
+		hasher.addFileId(journal::getPath(sculpture_path).get());
+		return hasher.value;
+	}
+
+	bool save(const char *path, const State &state) {
+		const size_t pixel_count = (size_t)state.size.x * state.size.y;
+		if (state.tile_frames.len != state.tile_passes.len || state.radiance.len < pixel_count || state.pixel_stats.len < pixel_count) {
+			err("render checkpoint is not valid, not saving it");
+			return false;
+		}
+
+		fs::StreamOut payload;
+		payload.write(state.tile_frames.buf, state.tile_frames.len * sizeof(uint));
+		payload.write(state.tile_passes.buf, state.tile_passes.len * sizeof(uint));
+		payload.write(state.radiance.buf, pixel_count * sizeof(vec4));
+		payload.write(state.pixel_stats.buf, pixel_count * sizeof(vec4));
+
+		zstd::Buf compressed = zstd::compress(payload.getData(), payload.getLen());
+		if (!compressed) {
+			err("could not compress render checkpoint: %s", compressed.getErrorString());
+			return false;
+		}
+
+		fs::StreamOut stream;
+		stream.write("rchk", 4);
+		stream.write(checkpoint_version);
+		stream.write(state.scene_hash);
+		stream.write(state.size);
+		stream.write(state.num_rendered_frames);
+		stream.write(state.pass);
+		stream.write(state.render_time);
+		stream.write(state.sum_frame_times);
+		stream.write(state.maximum_bounces);
+		stream.write(state.maximum_rays);
+		stream.write(state.maximum_trace_dist);
+		stream.write(state.jitter_amount);
+		stream.write(state.noise_threshold);
+		stream.write(state.min_samples);
+		stream.write(state.cam_angle);
+		stream.write(state.cam_zoom_exp);
+		stream.write((uint32_t)state.tile_frames.len);
+		stream.write((uint64_t)compressed.len);
+		stream.write(compressed.data, compressed.len);
+
+		// if the application closes while writing, the last checkpoint is still there
+		mem::ptr<char[]> temp_path = str::formatStr("%s.tmp", path);
+		if (!fs::write(temp_path.get(), stream.getData(), stream.getLen())) {
+			err("could not write render checkpoint (%s)", temp_path.get());
+			return false;
+		}
+
+		if (!fs::replace(temp_path.get(), path)) {
+			err("could not replace %s with the new render checkpoint", path);
+			fs::remove(temp_path.get());
+			return false;
+		}
+
+		info("saved render checkpoint to %s (%u frames, %zu bytes)", path, state.num_rendered_frames, stream.getLen());
+		return true;
+	}
+
+	bool load(const char *path, State &state) {
+		if (!fs::exists(path)) {
+			return false;
+		}
+
+		fs::MemoryBuf file = fs::read(path);
+		fs::StreamIn stream = file;
+
+		char magic[4];
+		uint32_t version = 0;
+		uint32_t tile_count = 0;
+		uint64_t compressed_size = 0;
+
+		bool is_valid = stream.read(magic) && memcmp(magic, "rchk", sizeof(magic)) == 0;
+		is_valid = is_valid && stream.read(version) && version == checkpoint_version;
+		is_valid = is_valid &&
+			stream.read(state.scene_hash) &&
+			stream.read(state.size) &&
+			stream.read(state.num_rendered_frames) &&
+			stream.read(state.pass) &&
+			stream.read(state.render_time) &&
+			stream.read(state.sum_frame_times) &&
+			stream.read(state.maximum_bounces) &&
+			stream.read(state.maximum_rays) &&
+			stream.read(state.maximum_trace_dist) &&
+			stream.read(state.jitter_amount) &&
+			stream.read(state.noise_threshold) &&
+			stream.read(state.min_samples) &&
+			stream.read(state.cam_angle) &&
+			stream.read(state.cam_zoom_exp) &&
+			stream.read(tile_count) &&
+			stream.read(compressed_size);
+
+		const size_t remaining = stream.len - (stream.cur - stream.start);
+		if (!is_valid || compressed_size > remaining || any(state.size < 0)) {
+			warn("render checkpoint (%s) is not valid, ignoring it", path);
+			return false;
+		}
+
+		const size_t pixel_count = (size_t)state.size.x * state.size.y;
+		const size_t expected = tile_count * sizeof(uint) * 2 + pixel_count * sizeof(vec4) * 2;
+
+		zstd::Buf decompressed = zstd::decompress(stream.cur, (size_t)compressed_size);
+		if (!decompressed || decompressed.len != expected) {
+			warn("render checkpoint (%s) is broken, ignoring it", path);
+			return false;
+		}
+
+		const uint8_t *cur = (const uint8_t *)decompressed.data;
+		readArr(cur, state.tile_frames, tile_count);
+		readArr(cur, state.tile_passes, tile_count);
+		readArr(cur, state.radiance, pixel_count);
+		readArr(cur, state.pixel_stats, pixel_count);
+
+		info("loaded render checkpoint from %s (%u frames)", path, state.num_rendered_frames);
+		return true;
+	}
+} // namespace checkpoint
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common.h"
+#include "vec.h"
+#include "mem.h"
+#include "arr.h"
+
+// sidecar file (<sculpture file>.render) with the state of a progressive render
+// from RayTracingEditor, saved every few minutes so a long render can carry on
+// after the application is closed.
+// the render settings and camera are stored in the checkpoint and restored when
+// it's resumed, everything else that changes the image (the sculpture file,
+// material, lights, textures, image size) goes in the scene hash and the
+// checkpoint is only resumed if it's still the same
+namespace checkpoint {
+	struct State {
+		uint64_t scene_hash = 0;
+		vec2i size = 0;
+		// also the frame index used to seed the random numbers
+		uint num_rendered_frames = 0;
+		uint pass = 0;
+		uint64_t render_time = 0;
+		uint64_t sum_frame_times = 0;
+
+		// render settings
+		uint maximum_bounces = 0;
+		uint maximum_rays = 0;
+		float maximum_trace_dist = 0;
+		float jitter_amount = 0;
+		float noise_threshold = 0;
+		uint min_samples = 0;
+
+		// camera
+		vec2 cam_angle = 0;
+		float cam_zoom_exp = 0;
+
+		// frames and last pass of every tile
+		arr<uint> tile_frames;
+		arr<uint> tile_passes;
+		// one value for every pixel, radiance is the sum of the light (rgb) and the
+		// number of rays (a), pixel_stats are the values used for adaptive sampling
+		arr<vec4> radiance;
+		arr<vec4> pixel_stats;
+	};
+
+	mem::ptr<char[]> getPath(const char *sculpture_path);
+	// hash of the size and write time of the sculpture file and its journal, 0 if the file doesn't exist
+	uint64_t hashSculpture(const char *sculpture_path);
+
+	// writes to a temporary file first, so a broken save doesn't overwrite the last checkpoint
+	bool save(const char *path, const State &state);
+	// returns false if there is no valid checkpoint
+	bool load(const char *path, State &state);
+} // namespace checkpoint
@@ -9,20 +9,61 @@
 #include "brush_editor.h"
 #include "options.h"
 #include "widgets.h"
+#include "buffer.h"
+#include "sdf.h"
+#include "journal.h"
+#include "volume.h"
+#include "cpu_sculpt.h"
+#include "cpu_check.h"
 
-constexpr vec3u texture_size = 512;
-static_assert(all(texture_size % 8 == 0));
+constexpr vec3i default_size = 512;
+static_assert(all(default_size % GpuVolume::brick_size == 0));
+static_assert(journal::brick_size == DirtyTracker::brick_size);
+
+// once the journal is bigger than this, it's merged back into the save file
+constexpr size_t max_journal_size = 32 * 1024 * 1024;
+
+// same as MIN_MIP_FACTOR in common.hlsl
+constexpr int min_mip_factor = 4;
+
+struct MinMipData {
+	vec3 brush_extent;
+	uint cell_size;
+	vec3 vol_size;
+	uint from_volume;
+	vec3u cell_count;
+	uint padding__1;
+};
+
+GFX_CLASS_CHECK(MinMipData);
+
+struct NormalData {
+	vec3 brush_extent;
+	uint full_rebuild;
+	vec3 vol_size;
+	float padding__0;
+};
+
+GFX_CLASS_CHECK(NormalData);
 
 Sculpture::Sculpture(BrushEditor &be) : brush_editor(be) {
-	texture = Texture3D::create(texture_size, Texture3D::Type::r16_snorm);
 	scale   = Shader::compile("scale_cs.hlsl", ShaderType::Compute);
 	sculpt  = Shader::compile("sculpt_cs.hlsl", ShaderType::Compute);
+	min_mip = Shader::compile("min_mip_cs.hlsl", ShaderType::Compute);
+	min_mip_data = Buffer::makeConstant<MinMipData>(Buffer::Usage::Dynamic);
+	normal_shader = Shader::compile("normal_cs.hlsl", ShaderType::Compute);
+	normal_data = Buffer::makeConstant<NormalData>(Buffer::Usage::Dynamic);
 
-	if (!texture) gfx::errorExit("could not create main 3D texture");
-	if (!scale)   gfx::errorExit("could not compile scale shader");
-	if (!sculpt)  gfx::errorExit("could not compile sculpt shader");
+	if (!scale)        gfx::errorExit("could not compile scale shader");
+	if (!sculpt)       gfx::errorExit("could not compile sculpt shader");
+	if (!min_mip)      gfx::errorExit("could not compile min mip shader");
+	if (!min_mip_data) gfx::errorExit("could not create min mip buffer");
+	if (!normal_shader) gfx::errorExit("could not compile normal shader");
+	if (!normal_data)  gfx::errorExit("could not create normal buffer");
 
-	brush_editor.runFillShader(Shapes::Box, ShapeData(vec3(0), 150, 20, 150), texture);
+	if (!fill(Shapes::Box, ShapeData(vec3(0), 150, 20, 150), default_size)) {
+		gfx::errorExit("could not create the sculpture");
+	}
 }
 
 Sculpture::~Sculpture() {
@@ -44,21 +85,26 @@ Sculpture::~Sculpture() {
 			MB_YESNO | MB_ICONWARNING
 		);
 		if (result == IDYES) {
-			if (all(save_quality == 0)) save_quality = texture->size;
+			if (all(save_quality == 0)) save_quality = vec3u(volume.size);
 			save(save_quality, mem::move(save_name));
 		}
 	}
 
 	if (save_state == SaveState::Saving) {
 		save_promise.join();
+		onSaveFinished();
 	}
 }
 
 void Sculpture::update() {
+	// the normal volume can be turned on and off from the options
+	if (Options::get().normal_volume != hasNormalVolume()) {
+		updateNormals(true);
+	}
+
 	if (save_state == SaveState::Saving) {
 		if (save_promise.isFinished()) {
-			save_promise.reset();
-			save_state = save_promise.value ? SaveState::Saved : SaveState::Unsaved;
+			onSaveFinished();
 			updateWindowName();
 		}
 	}
@@ -67,7 +113,12 @@ void Sculpture::update() {
 		if (save_clock.every(Options::get().auto_save_mins * 60.f)) {
 			if (save_state != SaveState::Saved) {
 				widgets::addMessage(LogLevel::Info, "Autosaving...");
-				save(save_quality);
+				if (Options::get().journal_autosave) {
+					saveJournal();
+				}
+				else {
+					save(save_quality);
+				}
 			}
 		}
 	}
@@ -75,14 +126,139 @@ void Sculpture::update() {
 
 void Sculpture::runSculpt() {
 	if (save_state == SaveState::Saved) save_state = SaveState::Unsaved;
+	source_path.destroy();
 	if (Options::get().auto_capture)    gfx::captureFrame();
+
+	if (!Options::get().check_cpu_sculpt) {
+		cpu_volume.destroy();
+	}
+	else if (!cpu_volume) {
+		cpu_volume = mem::ptr<Volume>::make();
+		if (!volume.download(*cpu_volume.get())) {
+			cpu_volume.destroy();
+		}
+	}
 	
+	// only dispatch the groups that the brush can reach, the shader then offsets them
+	// using the brush position, this way we don't have to read it back from the gpu
+	const vec3i groups = sdf::brushRegionGroups(brush_editor.getBrushExtent(), volume.size);
+	// every group is a brick, in the worst case they all go from uniform to the atlas
+	volume.reserve((size_t)groups.x * groups.y * groups.z);
+
 	sculpt->dispatch(
-		texture->size / 8, 
+		groups,
 		{ brush_editor.getOperHandle() },
 		{ brush_editor.getBrushSRV(), brush_editor.getDataSRV() },
-		{ texture->uav }
+		{ volume.table->uav, volume.atlas->uav, dirty_mask->uav, volume.free_bricks->uav, volume.released_bricks->uav, volume.counters->uav }
 	);
+	volume.releaseBricks();
+	has_gpu_dirty = true;
+
+	if (cpu_volume) {
+		checkCpuSculpt();
+	}
+
+	updateMinMips(false);
+	updateNormals(false);
+}
+
+bool Sculpture::fill(Shapes shape, const ShapeData &data, const vec3i &size) {
+	// filled on the cpu as the gpu one would need the whole dense volume
+	Volume filled;
+	if (!filled.init(size)) {
+		return false;
+	}
+
+	cpu::fill(filled, shape, data);
+
+	if (!volume.upload(filled)) {
+		return false;
+	}
+
+	onVolumeChanged();
+	return true;
+}
+
+void Sculpture::onVolumeChanged() {
+	source_path.destroy();
+	cpu_volume.destroy();
+
+	if (any(dirty.volume_size != volume.size)) {
+		dirty.init(volume.size);
+
+		const size_t mask_words = (dirty.brick_version.len + 31) / 32;
+		if (!dirty_mask) {
+			dirty_mask = Buffer::makeStructured<uint32_t>(mask_words, Bind::GpuReadWrite);
+			dirty_readback = Buffer::makeStructured<uint32_t>(mask_words, Bind::CpuRead);
+			if (!dirty_mask || !dirty_readback) gfx::errorExit("could not create dirty mask buffers");
+		}
+		else {
+			// resize only grows them, the extra words are never set
+			dirty_mask->resize(mask_words);
+			dirty_readback->resize(mask_words);
+		}
+	}
+
+	// everything could have changed, no need to read back the mask
+	dirty_mask->clearUAV(0);
+	has_gpu_dirty = false;
+	dirty.markAll();
+
+	vec3i level_size = volume.size;
+
+	for (int i = 0; i < min_mip_levels; ++i) {
+		level_size = (level_size + min_mip_factor - 1) / min_mip_factor;
+
+		if (!min_mips[i]) {
+			min_mips[i] = Texture3D::create(level_size, Texture3D::Type::r16_snorm);
+			if (!min_mips[i]) gfx::errorExit("could not create min-distance mip");
+		}
+		else if (any(min_mips[i]->size != level_size)) {
+			min_mips[i]->init(level_size, Texture3D::Type::r16_snorm);
+		}
+	}
+
+	updateMinMips(true);
+	updateNormals(true);
+}
+
+bool Sculpture::load(const char *path) {
+	// the save would finish on top of the new sculpture
+	if (save_state == SaveState::Saving) {
+		save_promise.join();
+		onSaveFinished();
+	}
+
+	Volume loaded;
+	if (!loaded.loadFromFile(path)) {
+		return false;
+	}
+
+	// apply the bricks that were autosaved after the last full save
+	journal::replay(path, loaded.size,
+		[&loaded](Slice<uint32_t> bricks, const int16_t *data) {
+			for (size_t i = 0; i < bricks.len; ++i) {
+				loaded.setBrick(bricks[i], data + i * journal::brick_voxels);
+			}
+		}
+	);
+
+	if (!volume.upload(loaded)) {
+		return false;
+	}
+
+	onVolumeChanged();
+
+	// the sculpture is the same as the file, so the next autosave only has to
+	// append what changed after this to its journal
+	saved_version = getDirty().snapshot();
+	save_path = str::dup(path);
+	name = fs::getNameAndExt(save_path.get());
+	save_quality = vec3u(volume.size);
+	save_state = SaveState::Saved;
+	source_path = str::dup(path);
+	updateWindowName();
+	return true;
 }
 
 void Sculpture::save(const vec3u &quality) {
@@ -99,9 +275,39 @@ void Sculpture::save(const vec3u &quality) {
 	updateWindowName();
 	save_state = SaveState::Saving;
 	save_quality = quality;
-	Handle<Texture3D> out_text = Texture3D::create(quality, texture->getType());
-	scale->dispatch(quality / 8, {}, { texture->srv }, { out_text->uav });
-	out_text->save(save_path.get(), true, &save_promise);
+	// everything changed after this point will be dirty for the next save
+	saving_version = getDirty().snapshot();
+	is_journal_save = false;
+
+	// at full quality the bricks are saved as they are, the volume is never dense on the gpu
+	if (all(quality == vec3u(volume.size))) {
+		mem::ptr<Volume> saved = mem::ptr<Volume>::make();
+		if (!volume.download(*saved.get())) {
+			err("could not read the sculpture from the gpu");
+			save_promise.set(false);
+			return;
+		}
+
+		info("Saving sculpture in another thread");
+
+		thr::schedule(
+			[saved = mem::move(saved), path = str::dup(save_path.get()), compress = Options::get().compress_saves, promise = &save_promise]() {
+				const bool result = saved->save(path.get(), true, compress);
+				if (result) {
+					widgets::addMessage(LogLevel::Info, "Saved sculpture to file!");
+				}
+				else {
+					widgets::addMessage(LogLevel::Error, "Failed to save sculpture to file!");
+				}
+				promise->set(result);
+			}
+		);
+		return;
+	}
+
+	Handle<Texture3D> out_text = Texture3D::create(quality, Texture3D::Type::r16_snorm);
+	scale->dispatch(quality / 8, {}, { volume.table->srv, volume.atlas->srv }, { out_text->uav });
+	out_text->save(save_path.get(), true, &save_promise, Options::get().compress_saves);
 	out_text->cleanup();
 }
 
@@ -111,14 +317,127 @@ void Sculpture::save(const vec3u &quality, mem::ptr<char[]> &&path) {
 	save(quality);
 }
 
+void Sculpture::saveJournal() {
+	if (save_state == SaveState::Saving) {
+		widgets::addMessage(LogLevel::Error, "Can't save sculpture, still busy saving previous one");
+		return;
+	}
+
+	// the journal is in the same space as the volume, so the save file must be the same size
+	if (any(save_quality != vec3u(volume.size)) || !fs::exists(save_path.get())) {
+		save(save_quality);
+		return;
+	}
+
+	DirtyTracker &tracker = getDirty();
+	arr<uint32_t> bricks;
+	tracker.forEachDirty(saved_version, [&bricks](size_t brick) { bricks.push((uint32_t)brick); });
+
+	// if a lot has changed (e.g. a new sculpture was loaded) it's better to just save everything
+	if (bricks.len > tracker.brick_version.len / 4) {
+		save(save_quality);
+		return;
+	}
+
+	const uint32_t version = tracker.snapshot();
+
+	if (bricks.empty()) {
+		saved_version = version;
+		save_state = SaveState::Saved;
+		source_path = str::dup(save_path.get());
+		updateWindowName();
+		return;
+	}
+
+	arr<uint8_t> data;
+	if (!volume.readBricks(bricks, data)) {
+		err("could not read the changed bricks from the sculpture");
+		return;
+	}
+
+	updateWindowName();
+	save_state = SaveState::Saving;
+	saving_version = version;
+	is_journal_save = true;
+
+	thr::schedule(
+		[path = str::dup(save_path.get()), size = volume.size, bricks = mem::move(bricks), data = mem::move(data), promise = &save_promise]() {
+			const bool result = journal::append(path.get(), size, bricks, (const int16_t *)data.buf);
+			// the bricks are already saved, so if compacting fails we can just try again later
+			if (result && journal::getSize(path.get()) > max_journal_size) {
+				info("journal is too big, merging it into %s", path.get());
+				journal::compact(path.get());
+			}
+			promise->set(result);
+		}
+	);
+}
+
 const char *Sculpture::getPath() const {
 	return save_path.get();
 }
 
+const char *Sculpture::getSourcePath() const {
+	return source_path.get();
+}
+
 const char *Sculpture::getName() const {
 	return name.data ? name.data : "(no name)";
 }
 
+bool Sculpture::hasNormalVolume() const {
+	return volume.hasNormals();
+}
+
+DirtyTracker &Sculpture::getDirty() {
+	if (has_gpu_dirty) {
+		readbackDirty();
+	}
+	return dirty;
+}
+
+uint32_t Sculpture::getSavedVersion() const {
+	return saved_version;
+}
+
+void Sculpture::updateMinMips(bool full_rebuild) {
+	const vec3 brush_extent = brush_editor.getBrushExtent();
+	const vec3i region_size = sdf::brushRegionGroups(brush_extent, volume.size) * 8;
+	// the first level is built from the sculpture, the others from the previous level
+	ID3D11ShaderResourceView *source = nullptr;
+	int cell_size = 1;
+
+	for (int i = 0; i < min_mip_levels; ++i) {
+		Texture3D *level = min_mips[i].get();
+		cell_size *= min_mip_factor;
+
+		// one more cell as the region is not aligned to them, and one more
+		// before it as every cell also includes the first voxel of the next one
+		vec3i cell_count = level->size;
+		if (!full_rebuild) {
+			cell_count = math::min((region_size + cell_size - 1) / cell_size + 2, level->size);
+		}
+
+		if (MinMipData *data = min_mip_data->map<MinMipData>()) {
+			data->brush_extent = brush_extent;
+			data->cell_size = cell_size;
+			data->vol_size = vec3(volume.size);
+			data->from_volume = (uint)(i == 0);
+			data->cell_count = cell_count;
+			min_mip_data->unmap();
+		}
+
+		min_mip->dispatch(
+			(cell_count + 3) / 4,
+			{ min_mip_data },
+			{ source, brush_editor.getDataSRV(), volume.table->srv, volume.atlas->srv },
+			{ level->uav }
+		);
+
+		source = level->srv;
+	}
+}
+
 void Sculpture::updateWindowName() {
 	if (save_state == SaveState::Saving) return;
 
@@ -133,4 +452,86 @@ void Sculpture::updateWindowName() {
 		break;
 	}
 	
+}
+
+void Sculpture::updateNormals(bool full_rebuild) {
+	if (!Options::get().normal_volume) {
+		// it's as big as the brick atlas times two, so free it when it's not used
+		volume.setNormals(false);
+		return;
+	}
+
+	if (!hasNormalVolume()) {
+		if (!volume.setNormals(true)) {
+			err("could not create normal volume, falling back to computing the normals while rendering");
+			Options::get().normal_volume = false;
+			return;
+		}
+		full_rebuild = true;
+	}
+
+	if (NormalData *data = normal_data->map<NormalData>()) {
+		data->brush_extent = brush_editor.getBrushExtent();
+		data->full_rebuild = (uint)full_rebuild;
+		data->vol_size = vec3(volume.size);
+		normal_data->unmap();
+	}
+
+	normal_shader->dispatch(
+		full_rebuild ? volume.brick_count : sdf::brushRegionGroups(brush_editor.getBrushExtent(), volume.size),
+		{ normal_data },
+		{ volume.table->srv, brush_editor.getDataSRV(), volume.atlas->srv },
+		{ volume.normals->uav }
+	);
+}
+
+void Sculpture::onSaveFinished() {
+	save_promise.reset();
+	save_state = SaveState::Unsaved;
+
+	if (save_promise.value) {
+		saved_version = saving_version;
+		// a full save replaces the base file, so the old journal is not needed anymore
+		if (!is_journal_save) {
+			journal::remove(save_path.get());
+		}
+		// the sculpture could have changed while saving in the background
+		if (!getDirty().hasChanged(saved_version)) {
+			save_state = SaveState::Saved;
+			if (all(save_quality == vec3u(volume.size))) {
+				source_path = str::dup(save_path.get());
+			}
+		}
+	}
+}
+
+void Sculpture::readbackDirty() {
+	const size_t mask_words = (dirty.brick_version.len + 31) / 32;
+
+	dirty_readback->copyFrom(*dirty_mask.get());
+	if (const uint32_t *mask = dirty_readback->mapRead<uint32_t>()) {
+		dirty.markMask(mask, mask_words);
+		dirty_readback->unmap();
+	}
+	dirty_mask->clearUAV(0);
+	has_gpu_dirty = false;
+}
+
+void Sculpture::checkCpuSculpt() {
+	Handle<Texture3D> brush_texture = brush_editor.getBrushTexture();
+	BrushData brush_data;
+	Volume brush;
+
+	if (!brush_texture || !brush_editor.readBrushData(brush_data) || !cpu::readVolume(*brush_texture.get(), brush)) {
+		cpu_volume.destroy();
+		return;
+	}
+
+	cpu::sculpt(*cpu_volume.get(), brush, brush_editor.getOperationData(), brush_data);
+
+	// same groups the sculpt shader was dispatched over, nothing outside of them can change
+	const vec3 brush_extent = brush_editor.getBrushExtent();
+	const vec3i start = sdf::brushRegionStart(brush_data.position, brush_extent, volume.size);
+	const vec3i end = start + sdf::brushRegionGroups(brush_extent, volume.size) * 8;
+	cpu::compareVolume(*cpu_volume.get(), volume, start, end, "sculpt");
 }
\ No newline at end of file
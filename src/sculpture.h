@@ -6,37 +6,89 @@
 #include "mem.h"
 #include "str.h"
 #include "thr.h"
+#include "dirty_tracker.h"
+#include "gpu_volume.h"
 
 struct BrushEditor;
 struct Texture3D;
 struct Shader;
+struct Buffer;
+struct Volume;
+struct ShapeData;
+enum class Shapes : int;
 
 struct Sculpture {
+	// same as MIN_MIP_LEVELS in common.hlsl
+	static constexpr int min_mip_levels = 3;
+
 	Sculpture(BrushEditor &brush_editor);
 	~Sculpture();
 	void update();
 	void runSculpt();
+	// replaces the sculpture with a new one of the given size (a multiple of 8), filled with the shape
+	bool fill(Shapes shape, const ShapeData &data, const vec3i &size);
+	// call this when the volume has been changed outside of runSculpt (e.g. loaded from
+	// file or filled with a shape), it rebuilds everything that depends on it
+	void onVolumeChanged();
+	// loads the volume and applies its journal (if it has one), the next saves go to the same file
+	bool load(const char *path);
 	void save(const vec3u &quality);
 	void save(const vec3u &quality, mem::ptr<char[]> &&path);
+	// only appends the bricks that changed since the last save to the journal
+	// of the save file, falls back to a full save when it can't
+	void saveJournal();
 	const char *getPath() const;
+	// file the sculpture is exactly the same as (it was loaded from it or saved to it
+	// at full quality), null if it has been changed since
+	const char *getSourcePath() const;
 	const char *getName() const;
+	bool hasNormalVolume() const;
+	// bricks changed by sculpting/filling/loading, this reads back what the
+	// sculpt shader has marked so only call it when it's actually needed
+	DirtyTracker &getDirty();
+	// dirty tracker version of the last successful save
+	uint32_t getSavedVersion() const;
 
-	Handle<Texture3D> texture;
+	// the sculpture itself, its normals are in volume.normals (empty if disabled in the options)
+	GpuVolume volume;
 	Handle<Shader> scale;
 	Handle<Shader> sculpt;
+	// min-distance mips used by the ray marchers to skip empty space
+	Handle<Texture3D> min_mips[min_mip_levels];
 
 private:
 	void updateWindowName();
+	void updateMinMips(bool full_rebuild);
+	void updateNormals(bool full_rebuild);
+	void readbackDirty();
+	void checkCpuSculpt();
+	void onSaveFinished();
 
 	enum class SaveState {
 		Unsaved, Saving, Saved
 	};
 
 	mem::ptr<char[]> save_path;
+	mem::ptr<char[]> source_path;
 	thr::Promise<bool> save_promise;
 	str::view name;
 	BrushEditor &brush_editor;
 	SaveState save_state = SaveState::Unsaved;
 	IntervalClock save_clock;
 	vec3u save_quality = 0;
+	Handle<Shader> min_mip;
+	Handle<Buffer> min_mip_data;
+	Handle<Shader> normal_shader;
+	Handle<Buffer> normal_data;
+	DirtyTracker dirty;
+	// bit mask written by the sculpt shader and its cpu copy
+	Handle<Buffer> dirty_mask;
+	Handle<Buffer> dirty_readback;
+	bool has_gpu_dirty = false;
+	uint32_t saved_version = 0;
+	uint32_t saving_version = 0;
+	bool is_journal_save = false;
+	// copy of the volume that cpu::sculpt runs on when "check cpu sculpt" is enabled,
+	// read back again every time the volume changes outside of runSculpt
+	mem::ptr<Volume> cpu_volume;
 };
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "vec.h"
+
+// C++ version of the constants and helper functions in shaders/common.hlsl,
+// if you change anything here remember to also change it there (and vice versa)
+namespace sdf {
+	constexpr float max_step               = 128.f;
+	constexpr float rough_min_hit_distance = 1.f;
+	constexpr float min_hit_distance       = .005f;
+	constexpr float max_trace_distance     = 3000.f;
+	constexpr float normal_step            = 3.f;
+
+	inline float sphere(const vec3 &pos, const vec3 &centre, float r) {
+		return (pos - centre).mag() - r;
+	}
+
+	inline float box(const vec3 &pos, const vec3 &centre, const vec3 &s) {
+		vec3 q = abs(pos - centre) - s * 0.5f;
+		return math::max(q, vec3(0)).mag() + math::min(math::max(q.x, math::max(q.y, q.z)), 0.f);
+	}
+
+	inline float cylinder(vec3 pos, const vec3 &centre, float radius, float height) {
+		pos -= centre;
+		vec2 d = abs(vec2(vec2(pos.x, pos.z).mag(), pos.y)) - vec2(radius, height);
+		return math::min(math::max(d.x, d.y), 0.f) + vec2(math::max(d.x, 0.f), math::max(d.y, 0.f)).mag();
+	}
+
+	// same as octEncode/octDecode in common.hlsl, used to store normals in two snorm channels
+	inline vec2 octEncode(vec3 n) {
+		n /= fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+		if (n.z < 0) {
+			return vec2(
+				(1.f - fabsf(n.y)) * (n.x >= 0 ? 1.f : -1.f),
+				(1.f - fabsf(n.x)) * (n.y >= 0 ? 1.f : -1.f)
+			);
+		}
+		return vec2(n.x, n.y);
+	}
+
+	inline vec3 octDecode(const vec2 &f) {
+		vec3 n = vec3(f.x, f.y, 1.f - fabsf(f.x) - fabsf(f.y));
+		const float t = math::clamp(-n.z, 0.f, 1.f);
+		n.x += n.x >= 0 ? -t : t;
+		n.y += n.y >= 0 ? -t : t;
+		return norm(n);
+	}
+
+	// a sculpt operation can only change the voxels inside the brush bounding box
+	// plus max_step on each side (where the approximate distance is written), so we
+	// only run it over that region. the region is aligned to the 8x8x8 thread groups
+	inline vec3i brushRegionGroups(const vec3 &brush_extent, const vec3i &volume_size) {
+		const vec3 region_size = brush_extent + max_step * 2.f;
+		// one more group as the start of the region is aligned down
+		return math::min(vec3i(ceil(region_size / 8.f)) + 1, volume_size / 8);
+	}
+
+	inline vec3i brushRegionStart(const vec3 &brush_pos, const vec3 &brush_extent, const vec3i &volume_size) {
+		const vec3 region_size = brush_extent + max_step * 2.f;
+		const vec3i group_count = brushRegionGroups(brush_extent, volume_size);
+		const vec3i start = vec3i(floor((brush_pos + vec3(volume_size) * 0.5f - region_size * 0.5f) / 8.f)) * 8;
+		return math::clamp(start, vec3i(0), volume_size - group_count * 8);
+	}
+} // namespace sdf
\ No newline at end of file
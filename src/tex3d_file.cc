@@ -0,0 +1,450 @@
+#include "tex3d_file.h"
+
+#include <string.h>
+#include <atomic>
+
+#include "tracelog.h"
+#include "thr.h"
+#include "str.h"
+
+// == PRIVATE FUNCTIONS ========================================================
+
+// "tex3d" + size + type
+constexpr size_t v1_header_size = 5 + sizeof(vec3i) + sizeof(uint8_t);
+
+static bool readV1Header(fs::StreamIn &stream, tex3d::Header &header) {
+	char magic[5];
+	if (!stream.read(magic))       return false;
+	if (!stream.read(header.size)) return false;
+	if (!stream.read(header.type)) return false;
+	return memcmp(magic, "tex3d", sizeof(magic)) == 0;
+}
+
+// == PUBLIC FUNCTIONS =========================================================
+
+namespace tex3d {
+	bool writeSlabs(const char *filename, const vec3i &size, uint8_t type, size_t type_size, FillFn fn, void *udata, uint8_t flags, int level) {
+		if (any(size < 1) || type_size == 0 || type_size > UINT8_MAX) {
+			err("can't write texture (%s) of size %dx%dx%d and type size %zu", filename, size.x, size.y, size.z, type_size);
+			return false;
+		}
+
+		const bool is_compressed = !(flags & flag_uncompressed);
+		const size_t slice_size = (size_t)size.x * size.y * type_size;
+		const size_t chunk_count = (size.z + slab_depth - 1) / slab_depth;
+
+		const auto &getSlabDepth = [&](size_t i) {
+			return math::min(slab_depth, size.z - (int)i * slab_depth);
+		};
+
+		// calloc'd memory, so every chunk starts as an empty zstd::Buf
+		arr<zstd::Buf> chunks;
+		if (is_compressed) {
+			chunks.reserve(chunk_count);
+			chunks.len = chunk_count;
+
+			thr::parallelFor(chunk_count,
+				[&](size_t i) {
+					arr<uint8_t> slab;
+					slab.reserve(slice_size * getSlabDepth(i));
+					slab.len = slice_size * getSlabDepth(i);
+
+					fn(udata, (int)i * slab_depth, (int)i * slab_depth + getSlabDepth(i), slab.buf);
+					chunks[i] = zstd::compress(slab.buf, slab.len, level);
+				}
+			);
+
+			for (const zstd::Buf &chunk : chunks) {
+				if (!chunk) {
+					err("could not compress texture slab: %s", chunk.getErrorString());
+					return false;
+				}
+			}
+		}
+
+		// header + index, the chunks come right after
+		fs::StreamOut stream;
+		stream.write("tex3d", 5);
+		stream.write(version);
+		stream.write(size);
+		stream.write(type);
+		stream.write((uint8_t)type_size);
+		stream.write(flags);
+		stream.write((uint32_t)slab_depth);
+		stream.write((uint32_t)chunk_count);
+
+		uint64_t offset = stream.getLen() + chunk_count * sizeof(Chunk);
+		// uncompressed data starts at a page boundary so it can be mapped
+		if (!is_compressed) {
+			offset = (offset + page_size - 1) / page_size * page_size;
+		}
+
+		for (size_t i = 0; i < chunk_count; ++i) {
+			const uint64_t chunk_size = is_compressed ? chunks[i].len : slice_size * getSlabDepth(i);
+			stream.write(Chunk{ offset, chunk_size });
+			offset += chunk_size;
+		}
+
+		while (!is_compressed && stream.getLen() % page_size) {
+			stream.write((uint8_t)0);
+		}
+
+		fs::file fp;
+		if (!fp.open(filename, "wb")) {
+			err("could not open file (%s) for writing", filename);
+			return false;
+		}
+
+		bool success = fp.write(stream.getData(), stream.getLen());
+
+		if (is_compressed) {
+			for (size_t i = 0; i < chunks.len && success; ++i) {
+				success = fp.write(chunks[i].data, chunks[i].len);
+			}
+		}
+		else {
+			// uncompressed files can be huge, so only keep one slab in memory
+			arr<uint8_t> slab;
+			slab.reserve(slice_size * slab_depth);
+			slab.len = slice_size * slab_depth;
+
+			for (size_t i = 0; i < chunk_count && success; ++i) {
+				fn(udata, (int)i * slab_depth, (int)i * slab_depth + getSlabDepth(i), slab.buf);
+				success = fp.write(slab.buf, slice_size * getSlabDepth(i));
+			}
+		}
+
+		if (!success) {
+			err("could not write texture to file (%s)", filename);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool write(const char *filename, const vec3i &size, uint8_t type, size_t type_size, const void *data, uint8_t flags, int level) {
+		const size_t slice_size = (size_t)size.x * size.y * type_size;
+		return writeSlabs(filename, size, type, type_size,
+			[data, slice_size](int z_start, int z_end, uint8_t *out) {
+				memcpy(out, (const uint8_t *)data + z_start * slice_size, (z_end - z_start) * slice_size);
+			},
+			flags,
+			level
+		);
+	}
+
+	bool Reader::open(const char *new_filename, size_t (*getTypeSize)(uint8_t type)) {
+		close();
+		filename = str::dup(new_filename);
+
+		if (!fp.open(new_filename)) {
+			err("couldn't read file (%s)", new_filename);
+			return false;
+		}
+
+		char magic[5];
+		if (!fp.read(magic)) {
+			err("file (%s) is too small to be a Texture3D bin file", new_filename);
+			return false;
+		}
+
+		// v2 files start with an uncompressed header, v1 files are a single zstd frame
+		if (memcmp(magic, "tex3d", sizeof(magic)) != 0) {
+			file_size = fs::getSize(new_filename);
+			stream_buf.reserve(zstd::Stream::getInputSize());
+			stream_buf.len = zstd::Stream::getInputSize();
+
+			uint8_t header_data[v1_header_size];
+			if (!restartStream() || !readStream(header_data, sizeof(header_data))) {
+				err("could not decompress texture file (%s)", new_filename);
+				return false;
+			}
+
+			fs::StreamIn header_stream(header_data, sizeof(header_data));
+			if (!readV1Header(header_stream, header)) {
+				err("file (%s) is not a Texture3D bin file, the header should be \"tex3d\" but instead is \"%.5s\"", new_filename, (const char *)header_data);
+				return false;
+			}
+
+			header.version = 1;
+			header.type_size = (uint8_t)getTypeSize(header.type);
+			header.slab_depth = header.size.z;
+
+			if (header.type_size == 0 || any(header.size < 1)) {
+				err("texture file (%s) has an invalid header", new_filename);
+				return false;
+			}
+
+			return true;
+		}
+
+		uint32_t file_slab_depth = 0;
+		uint32_t chunk_count = 0;
+		bool success = true;
+		success &= fp.read(header.version);
+		success &= fp.read(header.size);
+		success &= fp.read(header.type);
+		success &= fp.read(header.type_size);
+		success &= fp.read(header.flags);
+		success &= fp.read(file_slab_depth);
+		success &= fp.read(chunk_count);
+
+		if (!success) {
+			err("could not read texture header (%s)", new_filename);
+			return false;
+		}
+
+		if (header.version != version) {
+			err("texture file (%s) has version %u, only versions 1 and %u are supported", new_filename, header.version, version);
+			return false;
+		}
+
+		if (header.flags & ~flag_uncompressed) {
+			err("texture file (%s) has unknown flags (%u)", new_filename, header.flags);
+			return false;
+		}
+
+		header.slab_depth = (int)file_slab_depth;
+		if (any(header.size < 1) || header.slab_depth < 1 || chunk_count != (uint32_t)((header.size.z + header.slab_depth - 1) / header.slab_depth)) {
+			err("texture file (%s) has an invalid header", new_filename);
+			return false;
+		}
+
+		header.chunks.reserve(chunk_count);
+		header.chunks.len = chunk_count;
+		if (!fp.read(header.chunks.buf, header.chunks.len * sizeof(Chunk))) {
+			err("could not read the chunk index of texture file (%s)", new_filename);
+			return false;
+		}
+
+		// readSlices expects the chunks to be one after the other
+		for (uint32_t i = 1; i < chunk_count; ++i) {
+			if (header.chunks[i].offset != header.chunks[i - 1].offset + header.chunks[i - 1].compressed_size) {
+				err("texture file (%s) has an invalid chunk index", new_filename);
+				return false;
+			}
+		}
+
+		if (header.flags & flag_uncompressed) {
+			for (uint32_t i = 0; i < chunk_count; ++i) {
+				const int depth = math::min(header.slab_depth, header.size.z - (int)i * header.slab_depth);
+				if (header.chunks[i].compressed_size != header.getSliceSize() * depth) {
+					err("texture file (%s) has an invalid chunk index", new_filename);
+					return false;
+				}
+			}
+
+			// we don't need to read anything else, the data is read from the map only when it's used
+			fp.close();
+			const Chunk &last = header.chunks[chunk_count - 1];
+			if (!map.open(new_filename) || map.size < last.offset + last.compressed_size) {
+				err("could not map texture file (%s)", new_filename);
+				map.close();
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void Reader::close() {
+		fp.close();
+		map.close();
+		header = Header();
+		stream_buf.destroy();
+		stream_pos = stream_len = 0;
+		file_size = file_left = 0;
+		next_slice = 0;
+	}
+
+	bool Reader::readSlices(int z_start, int z_end, uint8_t *out) {
+		z_start = math::max(z_start, 0);
+		z_end = math::min(z_end, header.size.z);
+		if (z_start >= z_end) {
+			return true;
+		}
+
+		const size_t slice_size = header.getSliceSize();
+
+		if (header.version == 1) {
+			if (z_start < next_slice && !restartStream()) {
+				err("could not restart decompressing texture file (%s)", filename.get());
+				return false;
+			}
+
+			// decompress the slices we want to skip in out, one at a time
+			bool success = true;
+			for (; next_slice < z_start && success; ++next_slice) {
+				success = readStream(out, slice_size);
+			}
+
+			success = success && readStream(out, (z_end - z_start) * slice_size);
+			if (!success) {
+				err("could not decompress slices [%d, %d) from texture file (%s)", z_start, z_end, filename.get());
+				return false;
+			}
+
+			next_slice = z_end;
+			return true;
+		}
+
+		if (isMapped()) {
+			memcpy(out, getMappedSlices(z_start), (z_end - z_start) * slice_size);
+			return true;
+		}
+
+		const size_t first = z_start / header.slab_depth;
+		const size_t last = (z_end - 1) / header.slab_depth + 1;
+
+		// the chunks are one after the other in the file, so read them all at once
+		const uint64_t read_start = header.chunks[first].offset;
+		const uint64_t read_end = header.chunks[last - 1].offset + header.chunks[last - 1].compressed_size;
+
+		arr<uint8_t> compressed;
+		compressed.reserve((size_t)(read_end - read_start));
+		compressed.len = (size_t)(read_end - read_start);
+
+		if (!fp.seek(read_start) || !fp.read(compressed.buf, compressed.len)) {
+			err("could not read slices [%d, %d) from texture file (%s)", z_start, z_end, filename.get());
+			return false;
+		}
+
+		// slabs only partially inside of the range are decompressed in a temporary buffer first
+		std::atomic<bool> success = true;
+		thr::parallelFor(last - first,
+			[&](size_t i) {
+				const Chunk &chunk = header.chunks[first + i];
+				const int slab_start = (int)(first + i) * header.slab_depth;
+				const int slab_end = math::min(slab_start + header.slab_depth, header.size.z);
+				const int copy_start = math::max(slab_start, z_start);
+				const int copy_end = math::min(slab_end, z_end);
+
+				const uint8_t *src = compressed.buf + (chunk.offset - read_start);
+				uint8_t *dst = out + (copy_start - z_start) * slice_size;
+				const size_t slab_size = (slab_end - slab_start) * slice_size;
+
+				if (copy_start == slab_start && copy_end == slab_end) {
+					if (!zstd::decompressInto(src, (size_t)chunk.compressed_size, dst, slab_size)) {
+						success = false;
+					}
+					return;
+				}
+
+				arr<uint8_t> slab;
+				slab.reserve(slab_size);
+				slab.len = slab_size;
+				if (!zstd::decompressInto(src, (size_t)chunk.compressed_size, slab.buf, slab.len)) {
+					success = false;
+					return;
+				}
+				memcpy(dst, slab.buf + (copy_start - slab_start) * slice_size, (copy_end - copy_start) * slice_size);
+			}
+		);
+
+		if (!success) {
+			err("could not decompress slices [%d, %d) from texture file (%s)", z_start, z_end, filename.get());
+			return false;
+		}
+
+		return true;
+	}
+
+	bool Reader::forEachBatch(size_t max_bytes, int align, BatchFn fn, void *udata) {
+		// batches have to be a multiple of both align and the slabs
+		align = math::max(align, 1);
+		if (header.version != 1) {
+			int gcd = align;
+			for (int b = header.slab_depth; b != 0;) {
+				const int t = gcd % b;
+				gcd = b;
+				b = t;
+			}
+			align = align / gcd * header.slab_depth;
+		}
+
+		const size_t slice_size = header.getSliceSize();
+		const int batch_depth = math::max((int)(max_bytes / slice_size) / align, 1) * align;
+
+		// the slices are already in memory (or will be once they're touched)
+		if (isMapped()) {
+			for (int z_start = 0; z_start < header.size.z; z_start += batch_depth) {
+				fn(udata, z_start, math::min(z_start + batch_depth, header.size.z), getMappedSlices(z_start));
+			}
+			return true;
+		}
+
+		const size_t batch_size = slice_size * math::min(batch_depth, header.size.z);
+
+		arr<uint8_t> batch;
+		batch.reserve(batch_size);
+		batch.len = batch_size;
+
+		for (int z_start = 0; z_start < header.size.z; z_start += batch_depth) {
+			const int z_end = math::min(z_start + batch_depth, header.size.z);
+			if (!readSlices(z_start, z_end, batch.buf)) {
+				return false;
+			}
+			fn(udata, z_start, z_end, batch.buf);
+		}
+
+		return true;
+	}
+
+	const uint8_t *Reader::getMappedSlices(int z) const {
+		if (!isMapped() || z < 0 || z >= header.size.z) {
+			return nullptr;
+		}
+		// the slabs are one after the other, so the slices are too
+		return map.data + header.chunks[0].offset + z * header.getSliceSize();
+	}
+
+	bool Reader::restartStream() {
+		if (!stream.reset() || !fp.seek(0)) {
+			return false;
+		}
+
+		stream_pos = stream_len = 0;
+		file_left = file_size;
+		next_slice = 0;
+
+		// skip the header
+		if (header.version == 1) {
+			uint8_t header_data[v1_header_size];
+			return readStream(header_data, sizeof(header_data));
+		}
+
+		return true;
+	}
+
+	bool Reader::readStream(void *out, size_t len) {
+		size_t out_pos = 0;
+		while (out_pos < len) {
+			// refill the input buffer with the next part of the file
+			if (stream_pos == stream_len) {
+				if (file_left == 0) {
+					return false;
+				}
+
+				stream_len = math::min(file_left, stream_buf.len);
+				stream_pos = 0;
+				if (!fp.read(stream_buf.buf, stream_len)) {
+					return false;
+				}
+				file_left -= stream_len;
+			}
+
+			if (!stream.decompress(stream_buf.buf, stream_len, stream_pos, out, len, out_pos)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool Reader::readAll(arr<uint8_t> &out) {
+		const size_t total = header.getSliceSize() * header.size.z;
+		out.clear();
+		out.reserve(total);
+		out.len = total;
+		return readSlices(0, header.size.z, out.buf);
+	}
+} // namespace tex3d
\ No newline at end of file
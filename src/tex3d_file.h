@@ -0,0 +1,135 @@
+#pragma once
+
+#include <zstd.hpp>
+
+#include "common.h"
+#include "vec.h"
+#include "arr.h"
+#include "fs.h"
+#include "mem.h"
+
+// reading/writing of tex3d files (see FORMATS.txt).
+// v1 files are a single zstd frame, so they can only be decompressed in order
+// (they're streamed, so they don't need to be in memory all at once).
+// v2 files are split in slabs of slab_depth z slices, each one compressed on
+// its own with an index at the start of the file, this way the slabs can be
+// compressed/decompressed in parallel and a range of slices can be read without
+// touching the rest of the file.
+// v2 files can also be saved uncompressed (flag_uncompressed), in that case the
+// slabs start at a page aligned offset and the file is memory mapped, opening it
+// is instant and the slices are only read from disk when they're used.
+// this only deals with bytes, the voxel type is just passed through so it can
+// be used both by Texture3D and Volume
+namespace tex3d {
+	constexpr uint8_t version = 2;
+	// same as the bricks, so a layer of bricks is always in a single slab
+	constexpr int slab_depth = 8;
+	// alignment of the data in uncompressed files
+	constexpr size_t page_size = 4096;
+
+	// header flags
+	constexpr uint8_t flag_uncompressed = 1 << 0;
+
+	struct Chunk {
+		uint64_t offset = 0;
+		uint64_t compressed_size = 0;
+	};
+
+	struct Header {
+		uint8_t version = 0;
+		vec3i size = 0;
+		uint8_t type = 0;
+		uint8_t type_size = 0;
+		uint8_t flags = 0;
+		int slab_depth = 0;
+		// empty for v1 files
+		arr<Chunk> chunks;
+
+		size_t getSliceSize() const {
+			return (size_t)size.x * size.y * type_size;
+		}
+	};
+
+	// fills slices [z_start, z_end) of the texture, out is dense with x changing fastest
+	using FillFn = void (*)(void *udata, int z_start, int z_end, uint8_t *out);
+
+	// writes a v2 file, fn is called from different threads (one slab each) and
+	// the slabs are compressed in parallel. the whole texture is never in memory,
+	// only the slabs that are being compressed.
+	// with flag_uncompressed the slabs are written one at a time as they are
+	bool writeSlabs(const char *filename, const vec3i &size, uint8_t type, size_t type_size, FillFn fn, void *udata, uint8_t flags = 0, int level = 0);
+
+	template<typename TFn>
+	bool writeSlabs(const char *filename, const vec3i &size, uint8_t type, size_t type_size, TFn &&fn, uint8_t flags = 0, int level = 0) {
+		return writeSlabs(
+			filename, size, type, type_size,
+			[](void *udata, int z_start, int z_end, uint8_t *out) { (*(mem::RemRefT<TFn> *)udata)(z_start, z_end, out); },
+			(void *)&fn,
+			flags,
+			level
+		);
+	}
+
+	// same as above, data is the whole dense texture
+	bool write(const char *filename, const vec3i &size, uint8_t type, size_t type_size, const void *data, uint8_t flags = 0, int level = 0);
+
+	// how much is decompressed at a time when going through a whole file
+	constexpr size_t default_batch_size = 16 * 1024 * 1024;
+
+	// called with slices [z_start, z_end) of the texture, data is dense with x changing fastest
+	using BatchFn = void (*)(void *udata, int z_start, int z_end, const uint8_t *data);
+
+	struct Reader {
+		// reads the header and the chunk index, uncompressed files are mapped.
+		// type_size is only needed for v1 files, as they don't store it
+		bool open(const char *filename, size_t (*getTypeSize)(uint8_t type));
+		void close();
+
+		// decompresses slices [z_start, z_end) in out (which must be big enough).
+		// in v2 files only the slabs that overlap the range are read, v1 files
+		// are decompressed as a stream so reading slices before the last ones
+		// that were read starts again from the beginning of the file
+		bool readSlices(int z_start, int z_end, uint8_t *out);
+		bool readAll(arr<uint8_t> &out);
+
+		bool isMapped() const {
+			return map;
+		}
+
+		// pointer to slice z and the ones after it if the file is mapped, nullptr otherwise.
+		// nothing is read from disk until the data is used
+		const uint8_t *getMappedSlices(int z) const;
+
+		// goes through the whole texture in order a batch of slices at a time, this way
+		// only one batch is ever in memory (mapped files don't copy anything). batches are a multiple of align slices (and
+		// of the slabs) and at most max_bytes, unless a single slab is already bigger
+		bool forEachBatch(size_t max_bytes, int align, BatchFn fn, void *udata);
+
+		template<typename TFn>
+		bool forEachBatch(size_t max_bytes, int align, TFn &&fn) {
+			return forEachBatch(
+				max_bytes, align,
+				[](void *udata, int z_start, int z_end, const uint8_t *data) { (*(mem::RemRefT<TFn> *)udata)(z_start, z_end, data); },
+				(void *)&fn
+			);
+		}
+
+		Header header;
+		fs::file fp;
+		fs::MappedFile map;
+		mem::ptr<char[]> filename;
+
+		// -- v1 only --
+		bool restartStream();
+		bool readStream(void *out, size_t len);
+
+		zstd::Stream stream;
+		arr<uint8_t> stream_buf;
+		size_t stream_pos = 0;
+		size_t stream_len = 0;
+		size_t file_size = 0;
+		size_t file_left = 0;
+		// first slice that hasn't been decompressed yet
+		int next_slice = 0;
+	};
+} // namespace tex3d
\ No newline at end of file
@@ -1,10 +1,8 @@
 #include "texture.h"
 
-#include <thread>
 #include <d3d11.h>
 #include <stb_image.h>
 #include <stb_image_write.h>
-#include <zstd.hpp>
 
 #include "system.h"
 #include "tracelog.h"
@@ -13,6 +11,7 @@
 #include "str.h"
 #include "fs.h"
 #include "thr.h"
+#include "tex3d_file.h"
 //#include "arr.h"
 
 /* ==========================================
@@ -132,13 +131,12 @@ void Texture2D::loadAsync(thr::Promise<Handle<Texture2D>> *promise, const char *
 		return;
 	}
 
-	std::thread(
-		[](thr::Promise<Handle<Texture2D>> *promise, mem::ptr<char[]> &&filename, bool can_gpu_read) {
+	thr::schedule(
+		[promise, filename = str::dup(filename), can_gpu_read]() {
 			Handle<Texture2D> handle = load(filename.get(), can_gpu_read);
 			promise->set(handle);
-		},
-		promise, str::dup(filename), can_gpu_read
-	).detach();
+		}
+	);
 }
 
 bool Texture2D::init(const vec2i &newsize, bool can_gpu_read) {
@@ -294,6 +292,8 @@ bool Texture2D::loadFromHDRFile(const char *filename, bool can_gpu_read) {
 	data_desc.pSysMem = data;
 
 	HRESULT hr = gfx::device->CreateTexture2D(&desc, &data_desc, &texture);
+	// any hdr texture could be used as the background
+	env_table.build(data, size);
 	stbi_image_free(data);
 	if (FAILED(hr)) {
 		err("couldn't create 2D texture");
@@ -332,6 +332,7 @@ void Texture2D::cleanup() {
 	texture.destroy();
 	srv.destroy();
 	uav.destroy();
+	env_table.destroy();
 }
 
 bool Texture2D::takeScreenshot(const char *base_name) {
@@ -402,6 +403,7 @@ static DXGI_FORMAT to_dx_format[] = {
 	DXGI_FORMAT_R16G16_UINT,     // r16g16_uint
 	DXGI_FORMAT_R11G11B10_FLOAT, // r11g11b10_float
 	DXGI_FORMAT_R16_SNORM,       // r16_snorm
+	DXGI_FORMAT_R16G16_SNORM,    // r16g16_snorm
 };
 
 static size_t type_to_size[] = {
@@ -416,6 +418,7 @@ static size_t type_to_size[] = {
 	sizeof(uint32_t), // r16g16_uint
 	sizeof(uint32_t), // r11g11b10_float
 	sizeof(int16_t),  // r16_snorm
+	sizeof(uint32_t), // r16g16_snorm
 };
 
 static_assert(ARRLEN(type_to_size) == (int)Texture3D::Type::count);
@@ -435,6 +438,7 @@ static Texture3D::Type dxToType(DXGI_FORMAT format) {
 		case DXGI_FORMAT_R16G16_UINT:     return Type::r16g16_uint;
 		case DXGI_FORMAT_R11G11B10_FLOAT: return Type::r11g11b10_float;
 		case DXGI_FORMAT_R16_SNORM:       return Type::r16_snorm;
+		case DXGI_FORMAT_R16G16_SNORM:    return Type::r16g16_snorm;
 	}
 	assert(false && "format is not in switch, probably forgot to add it");
 	return Type::count;
@@ -555,47 +559,114 @@ bool Texture3D::init(int width, int height, int depth, Type type, const void *in
 }
 
 bool Texture3D::loadFromFile(const char *filename) {
-	fs::MemoryBuf whole_file = fs::read(filename);
-	if (!whole_file.data) {
-		err("couldn't read file (%s)", filename);
+	tex3d::Reader reader;
+	const auto &getTypeSize = [](uint8_t type) -> size_t {
+		return type < (uint8_t)Type::count ? type_to_size[type] : 0;
+	};
+
+	if (!reader.open(filename, getTypeSize)) {
 		return false;
 	}
 
-	size_t compressed_size = whole_file.size;
-
-	zstd::Buf decompressed = zstd::decompress(whole_file.data.get(), whole_file.size);
-	whole_file.destroy();
+	const tex3d::Header &header = reader.header;
+	if (header.type >= (uint8_t)Type::count || header.type_size != type_to_size[header.type]) {
+		err("texture file (%s) has an unknown type (%u)", filename, header.type);
+		return false;
+	}
 
-	if (!decompressed) {
-		err("could not decompress texture file: %s", decompressed.getErrorString());
+	if (!init(header.size, (Type)header.type)) {
 		return false;
 	}
 
-	fs::StreamIn stream((uint8_t *)decompressed.data, decompressed.len);
+	// upload it a batch of slices at a time as they're decompressed, this way
+	// the whole decompressed texture is never in memory
+	const size_t row_pitch = (size_t)size.x * header.type_size;
+	const bool success = reader.forEachBatch(tex3d::default_batch_size, 1,
+		[&](int z_start, int z_end, const uint8_t *data) {
+			D3D11_BOX box;
+			box.left = 0; box.right = size.x;
+			box.top = 0; box.bottom = size.y;
+			box.front = z_start; box.back = z_end;
 
-	Type type;
-	char header[5];
-	if (!stream.read(header)) { err("could not read texture header"); return false; }
+			gfx::context->UpdateSubresource(texture, 0, &box, data, (UINT)row_pitch, (UINT)(row_pitch * size.y));
+		}
+	);
 
-	if (memcmp(header, "tex3d", sizeof(header)) != 0) {
-		err("file (%s) is not a Texture3D bin file, the header should be \"tex3d\" but instead is \"%.5s\"", header);
+	if (!success) {
+		cleanup();
 		return false;
 	}
 
-	if (!stream.read(size)) { err("could not read texture size"); return false; }
-	if (!stream.read(type)) { err("could not read texture type"); return false; }
-
-	init(size, type, stream.cur);
-
 	return true;
 }
 
-bool Texture3D::save(const char *filename, bool overwrite, thr::Promise<bool> *promise) {
+bool Texture3D::save(const char *filename, bool overwrite, thr::Promise<bool> *promise, bool compress) {
 	if (!overwrite && fs::exists(filename)) {
 		err("trying to save a Texture3D but file (%s) already exists", filename);
 		return false;
 	}
 
+	const Type type = getType();
+
+	arr<uint8_t> data;
+	if (!read(data)) {
+		return false;
+	}
+
+	info("Saving texture in another thread");
+
+	thr::schedule(
+		[data = mem::move(data), size = size, type, filename = str::dup(filename), promise, flags = compress ? (uint8_t)0 : tex3d::flag_uncompressed]() {
+			// the slabs are compressed in parallel, see tex3d_file.h
+			if (!tex3d::write(filename.get(), size, (uint8_t)type, type_to_size[(int)type], data.buf, flags)) {
+				info("failed to save file (%s)", filename.get());
+				if (promise) promise->set(false);
+				widgets::addMessage(LogLevel::Error, "Failed to save sculpture to file!");
+				return;
+			}
+
+			const auto &getUnit = [](size_t s) {
+				constexpr size_t kb = 1024;
+				constexpr size_t mb = kb * 1024;
+				constexpr size_t gb = mb * 1024;
+				if (s > gb) return "GB";
+				if (s > mb) return "MB";
+				if (s > kb) return "KB";
+				return "B";
+			};
+
+			const auto &asByteSize = [](size_t s) {
+				constexpr size_t kb = 1024;
+				constexpr size_t mb = kb * 1024;
+				constexpr size_t gb = mb * 1024;
+				if (s > gb) return (double)s / gb;
+				if (s > mb) return (double)s / mb;
+				if (s > kb) return (double)s / kb;
+				return (double)s;
+			};
+
+			const size_t compressed_size = fs::getSize(filename.get());
+			double ratio = (double)compressed_size / data.len;
+			info(
+				"(%s) size: %.2f%s, compressed size: %.2f%s, compression ratio: %.3f",
+				fs::getNameAndExt(filename.get()),
+				asByteSize(data.len), getUnit(data.len),
+				asByteSize(compressed_size), getUnit(compressed_size),
+				ratio
+			);
+			info("the compressed file is %.0f%% smaller", round((1.0 - ratio) * 100.0));
+
+			if (promise) promise->set(true);
+			widgets::addMessage(LogLevel::Info, "Saved sculpture to file!");
+		}
+	);
+
+	widgets::addMessage(LogLevel::Warning, "Saving sculpture to file, this could take a while!", 6.f);
+
+	return true;
+}
+
+bool Texture3D::read(arr<uint8_t> &out) {
 	// create a temporary texture that we can read from
 	D3D11_TEXTURE3D_DESC desc;
 	texture->GetDesc(&desc);
@@ -603,8 +674,6 @@ bool Texture3D::save(const char *filename, bool overwrite, thr::Promise<bool> *p
 	desc.BindFlags = 0;
 	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
 
-	Type type = dxToType(desc.Format);
-
 	dxptr<ID3D11Texture3D> temp = nullptr;
 	HRESULT hr = gfx::device->CreateTexture3D(&desc, nullptr, &temp);
 	if (FAILED(hr)) {
@@ -619,89 +688,142 @@ bool Texture3D::save(const char *filename, bool overwrite, thr::Promise<bool> *p
 	D3D11_MAPPED_SUBRESOURCE mapped;
 	hr = gfx::context->Map(temp, 0, D3D11_MAP_READ, 0, &mapped);
 	if (FAILED(hr)) {
-		err("couldn't map temporary texture2D");
+		err("couldn't map temporary texture3D");
 		return false;
 	}
 
-	// write the data to the file
+	// copy the data out of the mapped texture, the rows are padded to RowPitch
+	// and the slices to DepthPitch
+	const size_t type_size = type_to_size[(int)dxToType(desc.Format)];
+	const size_t row_size = size.x * type_size;
 
-	fs::StreamOut stream;
+	out.destroy();
+	out.reserve(row_size * size.y * size.z);
+	out.len = row_size * size.y * size.z;
 
-	char header[] = "tex3d";
-	stream.write(header, sizeof(header) - 1);
-	stream.write(size);
-	stream.write(type);
-
-	size_t type_size = type_to_size[(int)type];
-	uint8_t *cur = (uint8_t *)mapped.pData;
+	uint8_t *dst = out.buf;
 	for (int z = 0; z < size.z; ++z) {
+		const uint8_t *cur = (const uint8_t *)mapped.pData + z * mapped.DepthPitch;
 		for (int y = 0; y < size.y; ++y) {
-			stream.write(cur, size.x * type_size);
+			memcpy(dst, cur, row_size);
 			cur += mapped.RowPitch;
+			dst += row_size;
 		}
 	}
 
 	gfx::context->Unmap(temp, 0);
+	return true;
+}
 
-	info("Saving texture in another thread");
+static vec3i getBrickStart(size_t brick, const vec3i &brick_count, int brick_size) {
+	return vec3i(
+		(int)(brick % brick_count.x),
+		(int)((brick / brick_count.x) % brick_count.y),
+		(int)(brick / ((size_t)brick_count.x * brick_count.y))
+	) * brick_size;
+}
 
-	std::thread(
-		[](fs::StreamOut &&stream, mem::ptr<char[]> filename, thr::Promise<bool> *promise) {
-			zstd::Buf compressed = zstd::compress(stream.getData(), stream.getLen());
-			if (!compressed) {
-				err("could not compress texture data: %s", compressed.getErrorString());
-				if (promise) promise->set(false);
-				return;
-			}
+bool Texture3D::readBricks(Slice<uint32_t> bricks, int brick_size, arr<uint8_t> &out) {
+	// the bricks are copied to a staging texture in batches, laid out in a 2D grid
+	constexpr int atlas_bricks = 64;
 
-			const auto &getUnit = [](size_t s) {
-				constexpr size_t kb = 1024;
-				constexpr size_t mb = kb * 1024;
-				constexpr size_t gb = mb * 1024;
-				if (s > gb) return "GB";
-				if (s > mb) return "MB";
-				if (s > kb) return "KB";
-				return "B";
-			};
+	D3D11_TEXTURE3D_DESC desc;
+	texture->GetDesc(&desc);
+	desc.Width = atlas_bricks * brick_size;
+	desc.Height = atlas_bricks * brick_size;
+	desc.Depth = brick_size;
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.BindFlags = 0;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
 
-			const auto &asByteSize = [](size_t s) {
-				constexpr size_t kb = 1024;
-				constexpr size_t mb = kb * 1024;
-				constexpr size_t gb = mb * 1024;
-				if (s > gb) return (double)s / gb;
-				if (s > mb) return (double)s / mb;
-				if (s > kb) return (double)s / kb;
-				return (double)s;
-			};
+	dxptr<ID3D11Texture3D> atlas = nullptr;
+	HRESULT hr = gfx::device->CreateTexture3D(&desc, nullptr, &atlas);
+	if (FAILED(hr)) {
+		err("couldn't create brick staging texture");
+		return false;
+	}
 
-			double ratio = (double)compressed.len / stream.getLen();
-			info(
-				"(%s) size: %.2f%s, compressed size: %.2f%s, compression ratio: %.3f",
-				fs::getNameAndExt(filename.get()),
-				asByteSize(stream.getLen()), getUnit(stream.getLen()),
-				asByteSize(compressed.len), getUnit(compressed.len),
-				ratio
-			);
-			info("the compressed file is %.0f%% smaller", round((1.0 - ratio) * 100.0));
+	const size_t type_size = type_to_size[(int)dxToType(desc.Format)];
+	const size_t brick_bytes = (size_t)brick_size * brick_size * brick_size * type_size;
+	const vec3i brick_count = (size + brick_size - 1) / brick_size;
+	const size_t batch_size = atlas_bricks * atlas_bricks;
 
-			if (!fs::write(filename.get(), compressed.data, compressed.len)) {
-				info("failed to save file (%s)", filename.get());
-				if (promise) promise->set(false);
-				widgets::addMessage(LogLevel::Error, "Failed to save sculpture to file!");
-			}
-			else {
-				if (promise) promise->set(true);
-				widgets::addMessage(LogLevel::Info, "Saved sculpture to file!");
+	out.destroy();
+	out.reserve(bricks.len * brick_bytes);
+	out.len = bricks.len * brick_bytes;
+
+	for (size_t batch = 0; batch < bricks.len; batch += batch_size) {
+		const Slice<uint32_t> batch_bricks = bricks.sub(batch, batch + batch_size);
+
+		for (size_t i = 0; i < batch_bricks.len; ++i) {
+			const vec3i start = getBrickStart(batch_bricks[i], brick_count, brick_size);
+			const vec3i end = math::min(start + brick_size, size);
+
+			D3D11_BOX box;
+			box.left = start.x; box.right = end.x;
+			box.top = start.y; box.bottom = end.y;
+			box.front = start.z; box.back = end.z;
+
+			const UINT x = (UINT)(i % atlas_bricks) * brick_size;
+			const UINT y = (UINT)(i / atlas_bricks) * brick_size;
+			gfx::context->CopySubresourceRegion(atlas, 0, x, y, 0, texture, 0, &box);
+		}
+
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		hr = gfx::context->Map(atlas, 0, D3D11_MAP_READ, 0, &mapped);
+		if (FAILED(hr)) {
+			err("couldn't map brick staging texture");
+			return false;
+		}
+
+		const size_t row_bytes = brick_size * type_size;
+		for (size_t i = 0; i < batch_bricks.len; ++i) {
+			const uint8_t *src = (const uint8_t *)mapped.pData +
+				(i / atlas_bricks) * brick_size * mapped.RowPitch +
+				(i % atlas_bricks) * row_bytes;
+			uint8_t *dst = out.buf + (batch + i) * brick_bytes;
+
+			for (int z = 0; z < brick_size; ++z) {
+				for (int y = 0; y < brick_size; ++y) {
+					memcpy(dst, src + z * mapped.DepthPitch + y * mapped.RowPitch, row_bytes);
+					dst += row_bytes;
+				}
 			}
-		},
-		mem::move(stream), str::dup(filename), promise
-	).detach();
+		}
 
-	widgets::addMessage(LogLevel::Warning, "Saving sculpture to file, this could take a while!", 6.f);
+		gfx::context->Unmap(atlas, 0);
+	}
 
 	return true;
 }
 
+void Texture3D::writeBricks(Slice<uint32_t> bricks, int brick_size, const void *data) {
+	const size_t type_size = type_to_size[(int)getType()];
+	const size_t brick_bytes = (size_t)brick_size * brick_size * brick_size * type_size;
+	const vec3i brick_count = (size + brick_size - 1) / brick_size;
+
+	for (size_t i = 0; i < bricks.len; ++i) {
+		const vec3i start = getBrickStart(bricks[i], brick_count, brick_size);
+		const vec3i end = math::min(start + brick_size, size);
+
+		D3D11_BOX box;
+		box.left = start.x; box.right = end.x;
+		box.top = start.y; box.bottom = end.y;
+		box.front = start.z; box.back = end.z;
+
+		gfx::context->UpdateSubresource(
+			texture, 0, &box,
+			(const uint8_t *)data + i * brick_bytes,
+			(UINT)(brick_size * type_size),
+			(UINT)(brick_size * brick_size * type_size)
+		);
+	}
+}
+
+void Texture3D::copyInto(Handle<Texture3D> handle) {
+	gfx::context->CopySubresourceRegion(handle->texture, 0, 0, 0, 0, texture, 0, nullptr);
+}
+
 void Texture3D::cleanup() {
 	texture.destroy();
 	uav.destroy();
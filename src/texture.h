@@ -4,6 +4,8 @@
 #include "vec.h"
 #include "colour.h"
 #include "handle.h"
+#include "slice.h"
+#include "env_map.h"
 
 namespace thr { template<typename T> struct Promise; }
 
@@ -35,6 +37,8 @@ struct Texture2D {
 	dxptr<ID3D11Texture2D> texture = nullptr;
 	dxptr<ID3D11ShaderResourceView> srv = nullptr;
 	dxptr<ID3D11UnorderedAccessView> uav = nullptr;
+	// only for hdr textures, used to importance sample them when they're the background
+	envmap::Table env_table;
 };
 
 struct Texture3D {
@@ -50,6 +54,7 @@ struct Texture3D {
 		r16g16_uint,
 		r11g11b10_float,
 		r16_snorm,
+		r16g16_snorm,
 		count,
 	};
 
@@ -69,7 +74,16 @@ struct Texture3D {
 	bool init(const vec3u &texsize, Type type, const void *initial_data = nullptr);
 	bool init(int width, int height, int depth, Type type, const void *initial_data = nullptr);
 	bool loadFromFile(const char *filename);
-	bool save(const char *filename, bool overwrite = false, thr::Promise<bool> *promise = nullptr);
+	// uncompressed files are bigger but they can be memory mapped when loading
+	bool save(const char *filename, bool overwrite = false, thr::Promise<bool> *promise = nullptr, bool compress = true);
+	// copies the whole texture to the cpu, x changing fastest
+	bool read(arr<uint8_t> &out);
+	// only copies the given bricks (blocks of brick_size^3 voxels, indexed x + y * count.x + z * count.x * count.y)
+	// instead of the whole texture, they're written one after the other with x changing fastest
+	bool readBricks(Slice<uint32_t> bricks, int brick_size, arr<uint8_t> &out);
+	void writeBricks(Slice<uint32_t> bricks, int brick_size, const void *data);
+	// copies the texture in the corner of a texture of the same type that is at least as big
+	void copyInto(Handle<Texture3D> handle);
 	void cleanup();
 	Type getType();
 
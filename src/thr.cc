@@ -1,13 +1,457 @@
 #include "thr.h"
 
 #include <stdlib.h>
+#include <thread>
+#include <atomic>
 
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
 #include "mem.h"
+#include "arr.h"
 
 namespace thr {
+	uint getCoreCount() {
+		static uint count = math::max(std::thread::hardware_concurrency(), 1u);
+		return count;
+	}
+
+	// == JOB SYSTEM =============================================================
+
+	struct JobData {
+		JobFn fn = nullptr;
+		void *udata = nullptr;
+		JobFn udata_free = nullptr;
+
+		// one for every Job handle, plus one while it's waiting to run
+		std::atomic<int> refs = 1;
+		std::atomic<bool> finished = false;
+
+		// protects finished/continuations when adding a continuation
+		SRWLOCK lock = SRWLOCK_INIT;
+		arr<JobData *> continuations;
+	};
+
+	// jobs are pushed/popped at the back by the worker that owns the queue
+	// (so it works on the most recent, and cache-hot, jobs first) and
+	// stolen from the front by the other workers
+	struct JobQueue {
+		void push(JobData *job) {
+			mtx.lock();
+			jobs.push(job);
+			mtx.unlock();
+		}
+
+		JobData *pop() {
+			JobData *job = nullptr;
+			mtx.lock();
+			if (jobs.len > head) {
+				job = jobs[jobs.len - 1];
+				--jobs.len;
+				if (jobs.len == head) {
+					jobs.len = head = 0;
+				}
+			}
+			mtx.unlock();
+			return job;
+		}
+
+		JobData *steal() {
+			JobData *job = nullptr;
+			mtx.lock();
+			if (jobs.len > head) {
+				job = jobs[head++];
+				if (jobs.len == head) {
+					jobs.len = head = 0;
+				}
+			}
+			mtx.unlock();
+			return job;
+		}
+
+		Mutex mtx;
+		arr<JobData *> jobs;
+		size_t head = 0;
+	};
+
+	struct JobSystem {
+		JobSystem();
+		~JobSystem();
+
+		// returns false if the workers couldn't be joined
+		bool stop();
+		void push(JobData *job);
+		JobData *findJob();
+		void run(JobData *job);
+		void finish(JobData *job);
+		void wakeWorker();
+		void wakeAll();
+
+		// one queue per worker, plus the shared one (the last one)
+		JobQueue *queues = nullptr;
+		arr<std::thread> workers;
+		size_t queue_count = 0;
+
+		// number of jobs in the queues
+		std::atomic<size_t> queued = 0;
+		// number of jobs pushed that haven't finished yet
+		std::atomic<size_t> active = 0;
+		bool should_quit = false;
+
+		SRWLOCK lock = SRWLOCK_INIT;
+		// idle workers wait on this, one of them is woken up every time a job is pushed
+		CONDITION_VARIABLE work_cond = CONDITION_VARIABLE_INIT;
+		// threads waiting on a job wait on this, they're all woken up every time a job finishes
+		CONDITION_VARIABLE cond = CONDITION_VARIABLE_INIT;
+	};
+
+	// index of the queue owned by the current thread, threads outside of the pool use the shared one
+	static thread_local size_t queue_index = SIZE_MAX;
+	// jobs being run by the current thread, more than one if it helps while waiting
+	static thread_local size_t running_jobs = 0;
+
+	static void releaseJob(JobData *job) {
+		if (job && --job->refs == 0) {
+			delete job;
+		}
+	}
+
+	static JobSystem &getJobSystem() {
+		static JobSystem job_system;
+		return job_system;
+	}
+
+	JobSystem::JobSystem() {
+		const size_t worker_count = math::max((size_t)getCoreCount() - 1, (size_t)1);
+		queue_count = worker_count + 1;
+		queues = new JobQueue[queue_count];
+
+		workers.reserve(worker_count);
+		for (size_t i = 0; i < worker_count; ++i) {
+			workers.push(std::thread(
+				[this, i]() {
+					queue_index = i;
+
+					while (true) {
+						if (JobData *job = findJob()) {
+							run(job);
+							continue;
+						}
+
+						AcquireSRWLockExclusive(&lock);
+						while (queued == 0 && !should_quit) {
+							SleepConditionVariableSRW(&work_cond, &lock, INFINITE, 0);
+						}
+						const bool quit = should_quit && queued == 0;
+						ReleaseSRWLockExclusive(&lock);
+
+						if (quit) break;
+					}
+				}
+			));
+		}
+	}
+
+	JobSystem::~JobSystem() {
+		// the workers that are still running could be using the queues
+		if (stop()) {
+			delete[] queues;
+		}
+	}
+
+	bool JobSystem::stop() {
+		// a job called exit(): a worker can't join its own thread, and the job would wait
+		// for itself. the process is about to end anyway, so the workers are left running
+		if (queue_index < queue_count) {
+			AcquireSRWLockExclusive(&lock);
+			should_quit = true;
+			ReleaseSRWLockExclusive(&lock);
+			WakeAllConditionVariable(&work_cond);
+
+			for (std::thread &t : workers) {
+				t.detach();
+			}
+			workers.clear();
+			return false;
+		}
+
+		AcquireSRWLockExclusive(&lock);
+		// the jobs this thread is running (e.g. while helping in Job::wait) can't finish until it returns
+		while (active > running_jobs) {
+			SleepConditionVariableSRW(&cond, &lock, INFINITE, 0);
+		}
+		should_quit = true;
+		ReleaseSRWLockExclusive(&lock);
+		WakeAllConditionVariable(&work_cond);
+
+		for (std::thread &t : workers) {
+			t.join();
+		}
+		workers.clear();
+		return true;
+	}
+
+	void JobSystem::push(JobData *job) {
+		const size_t index = queue_index < queue_count ? queue_index : queue_count - 1;
+		++active;
+		// before pushing, otherwise a thief could take it and decrement queued first
+		++queued;
+		queues[index].push(job);
+		wakeWorker();
+	}
+
+	JobData *JobSystem::findJob() {
+		if (queued == 0) {
+			return nullptr;
+		}
+
+		const size_t own = queue_index < queue_count ? queue_index : queue_count - 1;
+		JobData *job = queues[own].pop();
+
+		for (size_t i = 1; i < queue_count && !job; ++i) {
+			job = queues[(own + i) % queue_count].steal();
+		}
+
+		if (job) {
+			--queued;
+		}
+
+		return job;
+	}
+
+	void JobSystem::run(JobData *job) {
+		++running_jobs;
+		job->fn(job->udata);
+		if (job->udata_free) {
+			job->udata_free(job->udata);
+		}
+
+		finish(job);
+		releaseJob(job);
+		--running_jobs;
+		--active;
+		wakeAll();
+	}
+
+	void JobSystem::finish(JobData *job) {
+		AcquireSRWLockExclusive(&job->lock);
+		const bool was_finished = job->finished;
+		job->finished = true;
+		arr<JobData *> continuations = mem::move(job->continuations);
+		ReleaseSRWLockExclusive(&job->lock);
+
+		if (was_finished) return;
+
+		for (JobData *next : continuations) {
+			push(next);
+		}
+	}
+
+	void JobSystem::wakeWorker() {
+		// take the lock so that nobody can miss the wake up between checking and sleeping
+		AcquireSRWLockExclusive(&lock);
+		ReleaseSRWLockExclusive(&lock);
+		WakeConditionVariable(&work_cond);
+	}
+
+	void JobSystem::wakeAll() {
+		AcquireSRWLockExclusive(&lock);
+		ReleaseSRWLockExclusive(&lock);
+		WakeAllConditionVariable(&cond);
+	}
+
+	Job::Job(const Job &j) {
+		*this = j;
+	}
+
+	Job::Job(Job &&j) {
+		*this = mem::move(j);
+	}
+
+	Job::~Job() {
+		releaseJob(data);
+		data = nullptr;
+	}
+
+	Job &Job::operator=(const Job &j) {
+		if (this != &j) {
+			if (j.data) ++j.data->refs;
+			releaseJob(data);
+			data = j.data;
+		}
+		return *this;
+	}
+
+	Job &Job::operator=(Job &&j) {
+		if (this != &j) {
+			mem::swap(data, j.data);
+		}
+		return *this;
+	}
+
+	bool Job::isValid() const {
+		return data != nullptr;
+	}
+
+	bool Job::isFinished() const {
+		return data && data->finished;
+	}
+
+	void Job::wait() const {
+		if (!data) return;
+
+		JobSystem &js = getJobSystem();
+		while (!data->finished) {
+			// help with the other jobs, the one we're waiting on might be one of them
+			if (JobData *job = js.findJob()) {
+				js.run(job);
+				continue;
+			}
+
+			// pushing a job only wakes a worker, we check the queues again every time a job finishes
+			AcquireSRWLockExclusive(&js.lock);
+			while (!data->finished && js.queued == 0) {
+				SleepConditionVariableSRW(&js.cond, &js.lock, INFINITE, 0);
+			}
+			ReleaseSRWLockExclusive(&js.lock);
+		}
+	}
+
+	bool Job::waitFor(uint ms) const {
+		if (!data) return true;
+
+		// this doesn't help with the other jobs as one of them could take longer than ms
+		JobSystem &js = getJobSystem();
+		const ULONGLONG end = GetTickCount64() + ms;
+
+		AcquireSRWLockExclusive(&js.lock);
+		while (!data->finished) {
+			const ULONGLONG now = GetTickCount64();
+			if (now >= end) break;
+			SleepConditionVariableSRW(&js.cond, &js.lock, (DWORD)(end - now), 0);
+		}
+		ReleaseSRWLockExclusive(&js.lock);
+
+		return data->finished;
+	}
+
+	static Job makeJob(JobFn fn, void *udata, JobFn udata_free) {
+		Job handle;
+		handle.data = new JobData;
+		handle.data->fn = fn;
+		handle.data->udata = udata;
+		handle.data->udata_free = udata_free;
+		// the second reference is released once it has run
+		handle.data->refs = 2;
+		return handle;
+	}
+
+	Job makeSignal() {
+		Job handle;
+		handle.data = new JobData;
+		return handle;
+	}
+
+	void signal(const Job &job) {
+		if (!job.data) return;
+
+		JobSystem &js = getJobSystem();
+		js.finish(job.data);
+		js.wakeAll();
+	}
+
+	Job schedule(JobFn fn, void *udata, JobFn udata_free) {
+		Job handle = makeJob(fn, udata, udata_free);
+		getJobSystem().push(handle.data);
+		return handle;
+	}
+
+	Job then(const Job &after, JobFn fn, void *udata, JobFn udata_free) {
+		if (!after.data) {
+			return schedule(fn, udata, udata_free);
+		}
+
+		Job handle = makeJob(fn, udata, udata_free);
+
+		AcquireSRWLockExclusive(&after.data->lock);
+		const bool is_finished = after.data->finished;
+		if (!is_finished) {
+			after.data->continuations.push(handle.data);
+		}
+		ReleaseSRWLockExclusive(&after.data->lock);
+
+		if (is_finished) {
+			getJobSystem().push(handle.data);
+		}
+
+		return handle;
+	}
+
+	Job whenAll(Slice<Job> jobs) {
+		struct Counter {
+			std::atomic<size_t> remaining;
+			Job all;
+		};
+
+		Job all = makeSignal();
+		if (jobs.empty()) {
+			signal(all);
+			return all;
+		}
+
+		Counter *counter = new Counter;
+		counter->remaining = jobs.len;
+		counter->all = all;
+
+		for (const Job &job : jobs) {
+			then(
+				job,
+				[](void *udata) {
+					Counter *counter = (Counter *)udata;
+					if (--counter->remaining == 0) {
+						signal(counter->all);
+						delete counter;
+					}
+				},
+				counter
+			);
+		}
+
+		return all;
+	}
+
+	void cleanupJobs() {
+		getJobSystem().stop();
+	}
+
+	void parallelFor(size_t count, void (*fn)(void *udata, size_t index), void *udata) {
+		if (count == 0) return;
+
+		std::atomic<size_t> next = 0;
+		const auto &worker = [&]() {
+			for (size_t i = next++; i < count; i = next++) {
+				fn(udata, i);
+			}
+		};
+
+		// every helper grabs the next index until there are none left, if
+		// a helper only starts once everything is done it just returns
+		JobSystem &js = getJobSystem();
+		const size_t helper_count = math::min(js.workers.len, count - 1);
+		arr<Job> helpers;
+		helpers.reserve(helper_count);
+		for (size_t i = 0; i < helper_count; ++i) {
+			helpers.push(schedule([](void *udata) { (*(mem::RemRefT<decltype(worker)> *)udata)(); }, (void *)&worker));
+		}
+
+		// the calling thread does some work too
+		worker();
+
+		for (const Job &helper : helpers) {
+			helper.wait();
+		}
+	}
+
 	Mutex::Mutex() {
 		internal = malloc(sizeof(CRITICAL_SECTION));
 		if (internal) {
@@ -1,8 +1,94 @@
 #pragma once
 
 #include "mem.h"
+#include "slice.h"
 
 namespace thr {
+	// number of hardware threads available, always at least 1
+	uint getCoreCount();
+
+	// -- job system --
+	// fixed size pool of worker threads (one per core, minus the main thread) that all
+	// the background work goes through instead of creating new threads every time.
+	// each worker has its own queue of jobs and when it runs out it steals from the
+	// others, jobs scheduled from outside of the pool go in a shared queue.
+	// it's started the first time it's used and stopped with cleanupJobs
+
+	struct JobData;
+
+	// handle to a scheduled job, it can be copied around and waited on
+	struct Job {
+		Job() = default;
+		Job(const Job &j);
+		Job(Job &&j);
+		~Job();
+
+		Job &operator=(const Job &j);
+		Job &operator=(Job &&j);
+
+		bool isValid() const;
+		bool isFinished() const;
+		// runs other jobs while it waits, so it's fine to call it from inside a job
+		void wait() const;
+		// sleeps for at most ms milliseconds, returns false if it timed out
+		bool waitFor(uint ms) const;
+
+		JobData *data = nullptr;
+	};
+
+	using JobFn = void (*)(void *udata);
+
+	// udata_free (if not nullptr) is called with udata once the job has run
+	Job schedule(JobFn fn, void *udata, JobFn udata_free = nullptr);
+	// same as schedule, but only once after has finished
+	Job then(const Job &after, JobFn fn, void *udata, JobFn udata_free = nullptr);
+
+	template<typename TFn>
+	Job schedule(TFn &&fn) {
+		using Fn = mem::RemRefT<TFn>;
+		return schedule(
+			[](void *udata) { (*(Fn *)udata)(); },
+			new Fn((TFn &&)fn),
+			[](void *udata) { delete (Fn *)udata; }
+		);
+	}
+
+	template<typename TFn>
+	Job then(const Job &after, TFn &&fn) {
+		using Fn = mem::RemRefT<TFn>;
+		return then(
+			after,
+			[](void *udata) { (*(Fn *)udata)(); },
+			new Fn((TFn &&)fn),
+			[](void *udata) { delete (Fn *)udata; }
+		);
+	}
+
+	// a job that never runs, it's only finished once signal is called on it.
+	// continuations and waits work the same as with any other job
+	Job makeSignal();
+	void signal(const Job &job);
+
+	// finishes once every job in jobs has finished
+	Job whenAll(Slice<Job> jobs);
+
+	// waits for every job to finish and stops the worker threads
+	void cleanupJobs();
+
+	// calls fn(udata, i) for every i in [0, count), the work is spread over the
+	// job system (the calling thread included) and it only returns once every
+	// index has been processed. it can be called from inside a job
+	void parallelFor(size_t count, void (*fn)(void *udata, size_t index), void *udata);
+
+	template<typename TFn>
+	void parallelFor(size_t count, TFn &&fn) {
+		parallelFor(
+			count,
+			[](void *udata, size_t index) { (*(mem::RemRefT<TFn> *)udata)(index); },
+			(void *)&fn
+		);
+	}
+
 	struct Mutex {
 		Mutex();
 		~Mutex();
@@ -15,64 +101,67 @@ namespace thr {
 		void *internal = nullptr;
 	};
 
+	// value that is set from another thread, waiting on it sleeps instead of spinning.
+	// it's built on top of a signal job so it can be chained with then/whenAll
 	template<typename T>
 	struct Promise {
-		Promise() = default;
-		Promise(const T &value) : value(value), finished(true) {}
-		Promise(T &&value) : value(mem::move(value)), finished(true) {}
-		Promise(Promise &&p) { *this = mem::move(p); }
+		Promise() : done(makeSignal()) {}
+		Promise(const T &value) : value(value), done(makeSignal()) { signal(done); }
+		Promise(T &&value) : value(mem::move(value)), done(makeSignal()) { signal(done); }
+		// p is left with a new signal, so it can still be used (and reset) afterwards
+		Promise(Promise &&p) : done(makeSignal()) { *this = mem::move(p); }
 		Promise &operator=(Promise &&p) {
 			if (this != &p) {
-				mtx.lock();
-				p.mtx.lock();
-				mem::swap(finished, p.finished);
 				mem::swap(value, p.value);
-				mem::swap(mtx, p.mtx);
-				p.mtx.unlock();
-				mtx.unlock();
+				mem::swap(done, p.done);
 			}
 			return *this;
 		}
 
+		// don't call it while someone might still call set on the old value.
+		// the old job is signalled first so nobody waits on it (or its continuations) forever
 		void reset() {
-			mtx.lock();
-			finished = false;
-			mtx.unlock();
+			signal(done);
+			done = makeSignal();
 		}
 
 		void set(const T &v) {
-			mtx.lock();
 			value = v;
-			finished = true;
-			mtx.unlock();
+			signal(done);
 		}
 
 		void set(T &&v) {
-			mtx.lock();
 			value = mem::move(v);
-			finished = true;
-			mtx.unlock();
+			signal(done);
 		}
 
-		bool isFinished() {
-			bool result = false;
+		bool isFinished() const {
+			return done.isFinished();
+		}
 
-			if (mtx.tryLock()) {
-				result = finished;
-				mtx.unlock();
-			}
+		void join() const {
+			done.wait();
+		}
+
+		// returns false if it wasn't set in ms milliseconds
+		bool joinFor(uint ms) const {
+			return done.waitFor(ms);
+		}
 
-			return result;
+		// calls fn(value) as a job once it's set, the promise must not move
+		// or be destroyed until then
+		template<typename TFn>
+		Job then(TFn &&fn) {
+			return thr::then(done, [this, fn = mem::RemRefT<TFn>((TFn &&)fn)]() mutable { fn(value); });
 		}
 
-		void join() {
-			while (!isFinished()) {}
+		const Job &getJob() const {
+			return done;
 		}
 
 		T value;
 
 	private:
-		bool finished = false;
-		Mutex mtx;
+		Job done;
 	};
 } // namespace thr
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "tracelog.h"
 
 #include <stdio.h>
+#include <atomic>
+#include <thread>
 
 #include <imgui.h>
 
@@ -9,6 +11,7 @@
 
 #include "system.h"
 #include "options.h"
+#include "timer.h"
 #include "thr.h"
 
 static const char *level_strings[(int)LogLevel::Count] = {
@@ -37,20 +40,71 @@ struct Line {
     int millis = 0;
 };
 
+// messages are formatted by the thread that logs them and pushed in a fixed size
+// ring buffer without taking any lock. a consumer thread takes them out and prints
+// them to the console/log file/logger window (see Logger::drain), it wakes up every
+// flush_interval_ms or as soon as the ring is half full. errors wake it up right
+// away, fatal errors are drained by the thread that logs them before quitting so
+// they're in the log file. the logger window only takes a short lock to copy the
+// new lines, it never waits for the console or the file.
+// if the ring is full the message is dropped instead of waiting
+constexpr size_t ring_size = 1024;
+constexpr DWORD flush_interval_ms = 100;
+constexpr size_t max_record_len = 512;
+static_assert((ring_size & (ring_size - 1)) == 0, "ring_size must be a power of 2");
+
+struct Record {
+    // == index when it's free to write, index + 1 when it's ready to be read
+    std::atomic<size_t> sequence = 0;
+    LogLevel level = LogLevel::None;
+    uint64_t time = 0;
+    int len = 0;
+    char text[max_record_len];
+};
+
 struct Logger {
     Logger();
     ~Logger();
 
+    bool push(LogLevel level, uint64_t time, const char *text, int len);
+    // drains the ring from the calling thread
+    void flush();
+    void drain();
+    void writeToFile(LogLevel level, int minutes, int seconds, int millis, const char *text, int len);
+    void addLine(LogLevel level, int minutes, int seconds, int millis, const char *text, int len);
+    // moves the lines added by the consumer in buf/lines
+    void takeIncoming();
     void clear();
-    void endLine(LogLevel level, int minutes, int seconds, int millis);
     void draw();
 
     FILE *fp = nullptr;
+    // so that it doesn't try to open the file again for every message
+    bool has_file_failed = false;
+    // copies of the options, they're changed by the main thread while the consumer reads them
+    std::atomic<bool> print_to_console = true;
+    std::atomic<bool> print_to_file = true;
+
+    // only used by the main thread
     ImGuiTextBuffer buf;
     ImVector<Line> lines;
     bool auto_scrool = true;
     bool is_open = true;
-    thr::Mutex mutex;
+
+    // lines drained since the last draw, protected by incoming_mtx
+    ImGuiTextBuffer incoming_buf;
+    ImVector<Line> incoming_lines;
+    thr::Mutex incoming_mtx;
+
+    Record records[ring_size];
+    std::atomic<size_t> write_pos = 0;
+    std::atomic<size_t> dropped = 0;
+    std::atomic<size_t> read_pos = 0;
+
+    // only one thread can drain at a time, it also protects fp
+    thr::Mutex mtx;
+    std::thread consumer;
+    HANDLE wake_event = nullptr;
+    std::atomic<bool> should_quit = false;
 };
 
 static Logger logger;
@@ -63,54 +117,39 @@ void logMessage(LogLevel level, const char *fmt, ...) {
 }
 
 void logMessageV(LogLevel level, const char *fmt, va_list vlist) {
-    logger.mutex.lock();
-
-    double time_millis = timerToMilli(timerNow());
-    double time_seconds = time_millis / 1000.0;
-    int minutes = (int)(time_seconds / 60.0);
-    int seconds = (int)(time_seconds) % 60;
-    int millis = (int)(time_millis) % 1000;
+    const uint64_t time = timerNow();
 
-    int start = logger.buf.size();
-    logger.buf.appendfv(fmt, vlist);
-    logger.endLine(level, minutes, seconds, millis);
+    char text[max_record_len];
+    int len = vsnprintf(text, sizeof(text), fmt, vlist);
+    len = len < 0 ? 0 : math::min(len, (int)sizeof(text) - 1);
 
-    // also print to terminal
-
-    HANDLE hc = GetStdHandle(STD_OUTPUT_HANDLE);
+    logger.push(level, time, text, len);
 
-    switch (level) {
-        case LogLevel::Debug:   SetConsoleTextAttribute(hc, 1); break;
-        case LogLevel::Info:    SetConsoleTextAttribute(hc, 2); break;
-        case LogLevel::Warning: SetConsoleTextAttribute(hc, 6); break;
-        case LogLevel::Error:   SetConsoleTextAttribute(hc, 4); break;
-        case LogLevel::Fatal:   SetConsoleTextAttribute(hc, 4); break;
-        default:                SetConsoleTextAttribute(hc, 15); 
+    if (level == LogLevel::Error) {
+        SetEvent(logger.wake_event);
     }
-
-    const Options &options = Options::get();
-    
-    if (options.print_to_console) {
-        printf("%s", level_strings[(int)level]);
-        SetConsoleTextAttribute(hc, 6); // yellow
-        printf("(%02d:%02d:%04d): ", minutes, seconds, millis);
-        SetConsoleTextAttribute(hc, 15); // white
-        printf("%s\n", logger.buf.c_str() + start);
+    else if (level == LogLevel::Fatal) {
+        // we might be about to quit, so it can't wait for the consumer
+        logger.flush();
     }
 
-    if (options.quit_on_fatal && level == LogLevel::Fatal) {
-        str::tstr temp = logger.buf.c_str() + start;
+    if (level == LogLevel::Fatal && Options::get().quit_on_fatal) {
+        str::tstr temp = text;
         MessageBox((HWND)win::hwnd, temp, TEXT("FATAL ERROR"), MB_OK);
         exit(1);
     }
-
-    logger.mutex.unlock();
 }
 
 void drawLogger() {
+    logger.takeIncoming();
     logger.draw();
 }
 
+void logSetOutputs(bool to_console, bool to_file) {
+    logger.print_to_console = to_console;
+    logger.print_to_file = to_file;
+}
+
 void logSetOpen(bool is_open) {
     logger.is_open = is_open;
 }
@@ -127,32 +166,193 @@ const ImColor &logGetLevelColour(LogLevel level) {
 
 Logger::Logger() {
     SetConsoleOutputCP(CP_UTF8);
+    for (size_t i = 0; i < ring_size; ++i) {
+        records[i].sequence = i;
+    }
     clear();
+
+    wake_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    consumer = std::thread(
+        [this]() {
+            while (!should_quit) {
+                WaitForSingleObject(wake_event, flush_interval_ms);
+                flush();
+            }
+        }
+    );
 }
 
 Logger::~Logger() {
-    if (Options::get().print_to_file) {
-        if (!fp) {
-            mem::ptr<char[]> filename = fs::findFirstAvailable("logs", "log_%d.txt");
-            errno_t error = fopen_s(&fp, filename.get(), "wb+");
-            if (error) {
-                printf("[LOGGER ERROR] could not open file %s: %s", filename.get(), strerror(error));
-                fp = nullptr;
-                return;
+    should_quit = true;
+    SetEvent(wake_event);
+    if (consumer.joinable()) {
+        consumer.join();
+    }
+    CloseHandle(wake_event);
+
+    // anything logged after the consumer stopped
+    flush();
+
+    if (fp) {
+        fclose(fp);
+        fp = nullptr;
+    }
+}
+
+bool Logger::push(LogLevel level, uint64_t time, const char *text, int len) {
+    size_t pos = write_pos.load(std::memory_order_relaxed);
+    Record *record = nullptr;
+
+    while (true) {
+        record = &records[pos & (ring_size - 1)];
+        const size_t seq = record->sequence.load(std::memory_order_acquire);
+        const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (write_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
             }
         }
+        else if (diff < 0) {
+            // the consumer hasn't caught up yet
+            ++dropped;
+            return false;
+        }
+        else {
+            pos = write_pos.load(std::memory_order_relaxed);
+        }
+    }
 
-        int last_offset = 0;
-        const char* buf_beg = buf.begin();
-        for (Line &line : lines) {
-            const char* line_start = buf_beg + last_offset;
-            int line_len = line.offset - last_offset;
-            last_offset = line.offset;
-            fputs(level_strings[(int)line.level], fp);
-            fprintf(fp, "(%02d:%02d:%04d): ", line.minutes, line.seconds, line.millis);
-            fprintf(fp, "%.*s\n", line_len, line_start);
+    record->level = level;
+    record->time = time;
+    record->len = len;
+    memcpy(record->text, text, len);
+    record->sequence.store(pos + 1, std::memory_order_release);
+
+    // wake the consumer early so that a burst of messages doesn't fill the ring
+    if (pos + 1 - read_pos.load(std::memory_order_relaxed) >= ring_size / 2) {
+        SetEvent(wake_event);
+    }
+
+    return true;
+}
+
+void Logger::flush() {
+    mtx.lock();
+    drain();
+    mtx.unlock();
+}
+
+// must be called with mtx locked
+void Logger::drain() {
+    HANDLE hc = GetStdHandle(STD_OUTPUT_HANDLE);
+    const bool to_console = print_to_console;
+    const bool to_file = print_to_file;
+    bool has_written = false;
+
+    while (true) {
+        const size_t pos = read_pos.load(std::memory_order_relaxed);
+        Record &record = records[pos & (ring_size - 1)];
+        if (record.sequence.load(std::memory_order_acquire) != pos + 1) {
+            break;
+        }
+
+        double time_millis = timerToMilli(record.time);
+        double time_seconds = time_millis / 1000.0;
+        int minutes = (int)(time_seconds / 60.0);
+        int seconds = (int)(time_seconds) % 60;
+        int millis = (int)(time_millis) % 1000;
+
+        addLine(record.level, minutes, seconds, millis, record.text, record.len);
+
+        if (to_file) {
+            writeToFile(record.level, minutes, seconds, millis, record.text, record.len);
+            has_written = true;
+        }
+
+        // also print to terminal
+        if (to_console) {
+            switch (record.level) {
+                case LogLevel::Debug:   SetConsoleTextAttribute(hc, 1); break;
+                case LogLevel::Info:    SetConsoleTextAttribute(hc, 2); break;
+                case LogLevel::Warning: SetConsoleTextAttribute(hc, 6); break;
+                case LogLevel::Error:   SetConsoleTextAttribute(hc, 4); break;
+                case LogLevel::Fatal:   SetConsoleTextAttribute(hc, 4); break;
+                default:                SetConsoleTextAttribute(hc, 15); 
+            }
+
+            printf("%s", level_strings[(int)record.level]);
+            SetConsoleTextAttribute(hc, 6); // yellow
+            printf("(%02d:%02d:%04d): ", minutes, seconds, millis);
+            SetConsoleTextAttribute(hc, 15); // white
+            printf("%.*s\n", record.len, record.text);
+        }
+
+        record.sequence.store(pos + ring_size, std::memory_order_release);
+        read_pos.store(pos + 1, std::memory_order_relaxed);
+    }
+
+    if (size_t count = dropped.exchange(0)) {
+        char text[64];
+        int len = snprintf(text, sizeof(text), "dropped %zu log messages", count);
+        double time_millis = timerToMilli(timerNow());
+        int minutes = (int)(time_millis / 60000.0);
+        int seconds = (int)(time_millis / 1000.0) % 60;
+        int millis = (int)(time_millis) % 1000;
+        addLine(LogLevel::Warning, minutes, seconds, millis, text, len);
+
+        if (to_file) {
+            writeToFile(LogLevel::Warning, minutes, seconds, millis, text, len);
+            has_written = true;
         }
     }
+
+    // so that nothing is lost if the program crashes
+    if (has_written && fp) {
+        fflush(fp);
+    }
+}
+
+void Logger::writeToFile(LogLevel level, int minutes, int seconds, int millis, const char *text, int len) {
+    if (!fp) {
+        if (has_file_failed) return;
+        mem::ptr<char[]> filename = fs::findFirstAvailable("logs", "log_%d.txt");
+        errno_t error = fopen_s(&fp, filename.get(), "wb+");
+        if (error) {
+            printf("[LOGGER ERROR] could not open file %s: %s", filename.get(), strerror(error));
+            fp = nullptr;
+            has_file_failed = true;
+            return;
+        }
+    }
+
+    fputs(level_strings[(int)level], fp);
+    fprintf(fp, "(%02d:%02d:%04d): ", minutes, seconds, millis);
+    fprintf(fp, "%.*s\n", len, text);
+}
+
+void Logger::addLine(LogLevel level, int minutes, int seconds, int millis, const char *text, int len) {
+    incoming_mtx.lock();
+    incoming_buf.append(text, text + len);
+    incoming_lines.push_back({ level, incoming_buf.size(), minutes, seconds, millis });
+    incoming_mtx.unlock();
+}
+
+void Logger::takeIncoming() {
+    incoming_mtx.lock();
+    if (!incoming_lines.empty()) {
+        // the offsets are relative to incoming_buf
+        const int base = buf.size();
+        buf.append(incoming_buf.begin(), incoming_buf.end());
+        for (int i = 0; i < incoming_lines.Size; ++i) {
+            Line line = incoming_lines[i];
+            line.offset += base;
+            lines.push_back(line);
+        }
+        incoming_buf.clear();
+        incoming_lines.clear();
+    }
+    incoming_mtx.unlock();
 }
 
 void Logger::clear() {
@@ -160,10 +360,6 @@ void Logger::clear() {
     lines.clear();
 }
 
-void Logger::endLine(LogLevel level, int minutes, int seconds, int millis) {
-    lines.push_back({ level, buf.size(), minutes, seconds, millis });
-}
-
 void Logger::draw() {
     if (!is_open) return;
     if (!ImGui::Begin("Logger", &is_open)) {
@@ -17,6 +17,8 @@ enum class LogLevel {
 void logMessage(LogLevel level, const char *fmt, ...);
 void logMessageV(LogLevel level, const char *fmt, va_list vlist);
 void drawLogger();
+// mirrors the log options, the messages are printed on another thread
+void logSetOutputs(bool to_console, bool to_file);
 void logSetOpen(bool is_open);
 bool logIsOpen();
 const ImColor &logGetLevelColour(LogLevel level);
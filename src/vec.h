@@ -116,6 +116,16 @@ struct vec3T {
 	constexpr vec3T<bool> operator!=(const vec3T& o) const { return { x != o.x, y != o.y, z != o.z }; }
 	constexpr vec3T<bool> operator!=(T o) const { return { x != o, y != o, z != o }; }
 
+	constexpr vec3T<bool> operator<(const vec3T &o) const { return { x < o.x, y < o.y, z < o.z }; }
+	constexpr vec3T<bool> operator>(const vec3T &o) const { return { x > o.x, y > o.y, z > o.z }; }
+	constexpr vec3T<bool> operator<=(const vec3T &o) const { return { x <= o.x, y <= o.y, z <= o.z }; }
+	constexpr vec3T<bool> operator>=(const vec3T &o) const { return { x >= o.x, y >= o.y, z >= o.z }; }
+
+	constexpr vec3T<bool> operator<(T o) const { return { x < o, y < o, z < o }; }
+	constexpr vec3T<bool> operator>(T o) const { return { x > o, y > o, z > o }; }
+	constexpr vec3T<bool> operator<=(T o) const { return { x <= o, y <= o, z <= o }; }
+	constexpr vec3T<bool> operator>=(T o) const { return { x >= o, y >= o, z >= o }; }
+
 	T& operator[](size_t ind) { return data[ind]; }
 	constexpr const T& operator[](size_t ind) const { return data[ind]; }
 
@@ -194,6 +204,16 @@ struct vec4T {
 };
 
 namespace math {
+	template<typename T>
+	constexpr vec3T<T> min(const vec3T<T> &a, const vec3T<T> &b) {
+		return vec3T<T>(math::min(a.x, b.x), math::min(a.y, b.y), math::min(a.z, b.z));
+	}
+
+	template<typename T>
+	constexpr vec3T<T> max(const vec3T<T> &a, const vec3T<T> &b) {
+		return vec3T<T>(math::max(a.x, b.x), math::max(a.y, b.y), math::max(a.z, b.z));
+	}
+
 	template<typename T>
 	constexpr vec2T<T> clamp(const vec2T<T> &v, const vec2T<T> &minv, const vec2T<T> &maxv) {
 		return vec2T<T>(
@@ -249,6 +269,7 @@ template<typename T> constexpr T dot(const vec4T<T> &v1, const vec4T<T> &v2) { r
 VEC_FUN(abs)
 VEC_FUN(round)
 VEC_FUN(ceil)
+VEC_FUN(floor)
 
 #undef VEC_FUN
 
@@ -0,0 +1,340 @@
+#include "volume.h"
+
+#include "tracelog.h"
+#include "fs.h"
+#include "thr.h"
+#include "sdf.h"
+#include "tex3d_file.h"
+
+// same value as Texture3D::Type::r16_snorm, we don't include texture.h
+// so that this file doesn't depend on d3d
+constexpr uint8_t r16_snorm_type = 10;
+
+namespace snorm {
+	int16_t fromFloat(float value) {
+		// NaN is converted to 0
+		if (value != value) return 0;
+		value = math::clamp(value, -1.f, 1.f) * 32767.f;
+		// round to nearest, away from zero
+		return (int16_t)(value >= 0.f ? value + 0.5f : value - 0.5f);
+	}
+
+	float toFloat(int16_t value) {
+		// both -32768 and -32767 map to -1
+		return math::max((float)value / 32767.f, -1.f);
+	}
+} // namespace snorm
+
+Volume::Volume(const vec3i &size, float value) {
+	init(size, value);
+}
+
+bool Volume::init(const vec3i &new_size, float value) {
+	if (any(new_size < 2)) {
+		err("volume size must be at least 2x2x2, instead it is %dx%dx%d", new_size.x, new_size.y, new_size.z);
+		return false;
+	}
+
+	cleanup();
+	size = new_size;
+	brick_count = (size + brick_size - 1) / brick_size;
+
+	const size_t count = (size_t)brick_count.x * brick_count.y * brick_count.z;
+	// calloc'd memory, so all the bricks start as nullptr (uniform)
+	bricks.reserve(count);
+	bricks.len = count;
+	uniform.reserve(count);
+	uniform.len = count;
+	uniform.fill(clampToBand(snorm::fromFloat(value)));
+	return true;
+}
+
+bool Volume::loadFromFile(const char *filename) {
+	tex3d::Reader reader;
+	const auto &getTypeSize = [](uint8_t type) -> size_t {
+		return type == r16_snorm_type ? sizeof(int16_t) : 0;
+	};
+
+	if (!reader.open(filename, getTypeSize)) {
+		return false;
+	}
+
+	const tex3d::Header &header = reader.header;
+	if (header.type != r16_snorm_type || header.type_size != sizeof(int16_t)) {
+		err("volume (%s) must be r16_snorm, instead the type is %u", filename, header.type);
+		return false;
+	}
+
+	if (!init(header.size)) {
+		return false;
+	}
+
+	// keep the mapping, the bricks are copied from it only once they're written
+	if (reader.isMapped()) {
+		source_data = (const int16_t *)reader.getMappedSlices(0);
+		source = mem::move(reader.map);
+		in_source.reserve(bricks.len);
+		in_source.len = bricks.len;
+		in_source.fill(1);
+		return true;
+	}
+
+	// the file is dense, go through it a few layers of bricks at a time
+	// and only allocate the bricks that are not uniform
+	const size_t row = (size_t)size.x;
+	const size_t slice = row * size.y;
+	const size_t bricks_per_layer = (size_t)brick_count.x * brick_count.y;
+
+	const bool success = reader.forEachBatch(tex3d::default_batch_size, brick_size,
+		[&](int batch_start, int batch_end, const uint8_t *data) {
+			const int16_t *dense = (const int16_t *)data;
+			const size_t first_brick = (batch_start / brick_size) * bricks_per_layer;
+			const size_t brick_range = ((batch_end - batch_start + brick_size - 1) / brick_size) * bricks_per_layer;
+
+			thr::parallelFor(brick_range,
+				[&](size_t i) {
+					const size_t brick = first_brick + i;
+					const vec3i start = vec3i(
+						(int)(brick % brick_count.x),
+						(int)((brick / brick_count.x) % brick_count.y),
+						(int)(brick / bricks_per_layer)
+					) * brick_size;
+					const vec3i end = math::min(start + brick_size, size);
+
+					const int16_t first = clampToBand(dense[start.x + start.y * row + (start.z - batch_start) * slice]);
+					bool is_uniform = true;
+
+					for (int z = start.z; z < end.z && is_uniform; ++z) {
+						for (int y = start.y; y < end.y && is_uniform; ++y) {
+							const int16_t *cur = dense + (z - batch_start) * slice + y * row;
+							for (int x = start.x; x < end.x; ++x) {
+								if (clampToBand(cur[x]) != first) {
+									is_uniform = false;
+									break;
+								}
+							}
+						}
+					}
+
+					uniform[brick] = first;
+					if (is_uniform) return;
+
+					Brick *b = allocBrick(brick);
+					for (int z = start.z; z < end.z; ++z) {
+						for (int y = start.y; y < end.y; ++y) {
+							const int16_t *cur = dense + (z - batch_start) * slice + y * row;
+							for (int x = start.x; x < end.x; ++x) {
+								b->data[voxelIndex(vec3i(x, y, z))] = clampToBand(cur[x]);
+							}
+						}
+					}
+				}
+			);
+		}
+	);
+
+	if (!success) {
+		cleanup();
+		return false;
+	}
+
+	return true;
+}
+
+bool Volume::save(const char *filename, bool overwrite, bool compress) const {
+	if (!overwrite && fs::exists(filename)) {
+		err("trying to save a Volume but file (%s) already exists", filename);
+		return false;
+	}
+
+	// the file is dense, each slab is filled one row at a time
+	const bool success = tex3d::writeSlabs(filename, size, r16_snorm_type, sizeof(int16_t),
+		[this](int z_start, int z_end, uint8_t *out) {
+			int16_t *cur = (int16_t *)out;
+			for (int z = z_start; z < z_end; ++z) {
+				for (int y = 0; y < size.y; ++y) {
+					for (int x = 0; x < size.x; ++x) {
+						*cur++ = getRaw(vec3i(x, y, z));
+					}
+				}
+			}
+		},
+		compress ? (uint8_t)0 : tex3d::flag_uncompressed
+	);
+
+	if (!success) {
+		err("could not write volume to file (%s)", filename);
+		return false;
+	}
+
+	info("saved volume to %s, %zu/%zu bricks allocated", filename, getAllocatedBricks(), bricks.len);
+	return true;
+}
+
+void Volume::cleanup() {
+	source_data = nullptr;
+	source.close();
+	in_source.destroy();
+	bricks.destroy();
+	uniform.destroy();
+	size = 0;
+	brick_count = 0;
+}
+
+void Volume::setBandWidth(float voxels) {
+	band = snorm::fromFloat(math::clamp(voxels / sdf::max_step, 0.f, 1.f));
+
+	// clamp what we already have, the bricks that are now fully
+	// outside of the band become uniform
+	thr::parallelFor(bricks.len,
+		[this](size_t brick) {
+			uniform[brick] = clampToBand(uniform[brick]);
+			if (Brick *b = bricks[brick].get()) {
+				for (int16_t &v : b->data) {
+					v = clampToBand(v);
+				}
+				compactBrick(brick);
+			}
+		}
+	);
+}
+
+float Volume::getBandWidth() const {
+	return snorm::toFloat(band) * sdf::max_step;
+}
+
+void Volume::setBrick(size_t brick, const int16_t *data) {
+	const vec3i start = vec3i(
+		(int)(brick % brick_count.x),
+		(int)((brick / brick_count.x) % brick_count.y),
+		(int)(brick / ((size_t)brick_count.x * brick_count.y))
+	) * brick_size;
+	// bricks at the edge of the volume can be partially outside of it
+	const vec3i end = math::min(start + brick_size, size);
+
+	for (int z = start.z; z < end.z; ++z) {
+		for (int y = start.y; y < end.y; ++y) {
+			for (int x = start.x; x < end.x; ++x) {
+				const vec3i pos = vec3i(x, y, z);
+				setRaw(pos, data[voxelIndex(pos)]);
+			}
+		}
+	}
+
+	compactBrick(brick);
+}
+
+void Volume::compactBrick(size_t brick) {
+	const Brick *b = bricks[brick].get();
+	if (!b) return;
+
+	const int16_t first = b->data[0];
+	for (int i = 1; i < brick_voxels; ++i) {
+		if (b->data[i] != first) {
+			return;
+		}
+	}
+
+	uniform[brick] = first;
+	bricks[brick].destroy();
+}
+
+void Volume::compact() {
+	thr::parallelFor(bricks.len, [this](size_t brick) { compactBrick(brick); });
+}
+
+void Volume::releaseSource() {
+	if (!source_data) return;
+
+	thr::parallelFor(bricks.len,
+		[this](size_t brick) {
+			if (isInSource(brick)) {
+				allocBrick(brick);
+				compactBrick(brick);
+			}
+		}
+	);
+
+	source_data = nullptr;
+	source.close();
+	in_source.destroy();
+}
+
+size_t Volume::getAllocatedBricks() const {
+	size_t count = 0;
+	for (const mem::ptr<Brick> &b : bricks) {
+		if (b) ++count;
+	}
+	return count;
+}
+
+size_t Volume::getMemoryUsage() const {
+	return getAllocatedBricks() * sizeof(Brick) +
+		   bricks.len * sizeof(mem::ptr<Brick>) +
+		   uniform.len * sizeof(int16_t) +
+		   in_source.len * sizeof(uint8_t);
+}
+
+Volume::Brick *Volume::allocBrick(size_t brick) {
+	mem::ptr<Brick> b = mem::ptr<Brick>::make();
+
+	if (isInSource(brick)) {
+		const vec3i start = vec3i(
+			(int)(brick % brick_count.x),
+			(int)((brick / brick_count.x) % brick_count.y),
+			(int)(brick / ((size_t)brick_count.x * brick_count.y))
+		) * brick_size;
+		const vec3i end = math::min(start + brick_size, size);
+
+		// same as loading a compressed file, the part of the brick outside
+		// of the volume gets the value of its first voxel
+		uniform[brick] = getSourceRaw(start);
+		for (int16_t &v : b->data) {
+			v = uniform[brick];
+		}
+
+		for (int z = start.z; z < end.z; ++z) {
+			for (int y = start.y; y < end.y; ++y) {
+				for (int x = start.x; x < end.x; ++x) {
+					const vec3i pos = vec3i(x, y, z);
+					b->data[voxelIndex(pos)] = getSourceRaw(pos);
+				}
+			}
+		}
+
+		in_source[brick] = 0;
+	}
+	else {
+		// the new brick starts with the value the uniform brick had
+		for (int16_t &v : b->data) {
+			v = uniform[brick];
+		}
+	}
+
+	bricks[brick] = mem::move(b);
+	return bricks[brick].get();
+}
+
+float Volume::sample(const vec3 &pos) const {
+	vec3i start = math::max(math::min(vec3i(pos), size - 2), vec3i(0));
+	vec3i end = start + 1;
+
+	vec3 delta = pos - vec3(start);
+	vec3 rem = vec3(1) - delta;
+
+#define map(x, y, z) get(vec3i((x), (y), (z)))
+
+	vec4 c = vec4(
+		map(start.x, start.y, start.z) * rem.x + map(end.x, start.y, start.z) * delta.x,
+		map(start.x, end.y,   start.z) * rem.x + map(end.x, end.y,   start.z) * delta.x,
+		map(start.x, start.y, end.z)   * rem.x + map(end.x, start.y, end.z)   * delta.x,
+		map(start.x, end.y,   end.z)   * rem.x + map(end.x, end.y,   end.z)   * delta.x
+	);
+
+#undef map
+
+	float c0 = c.x * rem.y + c.y * delta.y;
+	float c1 = c.z * rem.y + c.w * delta.y;
+
+	return c0 * rem.z + c1 * delta.z;
+}
\ No newline at end of file
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "common.h"
+#include "vec.h"
+#include "arr.h"
+#include "mem.h"
+#include "fs.h"
+
+// conversion between floats and 16 bit snorm values, follows the same rules
+// as D3D so values match with what a r16_snorm texture would store
+namespace snorm {
+	int16_t fromFloat(float value);
+	float toFloat(int16_t value);
+} // namespace snorm
+
+// CPU-side version of a r16_snorm Texture3D, this is used to work on the
+// sculpture without going through the GPU (e.g. headless sculpting).
+// GpuVolume uses the same bricks on the GPU.
+// the volume is split in 8x8x8 bricks, most of the volume is either empty (+1)
+// or solid (-1), so bricks where every voxel has the same value are only stored
+// as that single value and don't allocate anything.
+// bricks can be written from different threads as long as each brick is only
+// written by one thread at a time.
+// the volume can also be used in narrow band mode, where only the voxels within
+// band width of the surface are stored, everything further away is clamped to
+// +-band so those bricks become uniform and only keep the sign.
+// volumes loaded from an uncompressed (memory mapped) file keep the mapping, the
+// bricks that haven't been written yet are read straight from it and are only
+// copied in a Brick the first time they're written, so opening it is instant
+struct Volume {
+	static constexpr int brick_size = 8;
+	static constexpr int brick_voxels = brick_size * brick_size * brick_size;
+
+	struct Brick {
+		int16_t data[brick_voxels];
+	};
+
+	Volume() = default;
+	Volume(const vec3i &size, float value = 1.f);
+
+	bool init(const vec3i &size, float value = 1.f);
+	bool loadFromFile(const char *filename);
+	// same as Texture3D::save, uncompressed files can be memory mapped
+	bool save(const char *filename, bool overwrite = false, bool compress = true) const;
+	void cleanup();
+
+	// same as Texture3D.Load in hlsl, pos must be inside the volume
+	float get(const vec3i &pos) const {
+		return snorm::toFloat(getRaw(pos));
+	}
+
+	void set(const vec3i &pos, float value) {
+		setRaw(pos, snorm::fromFloat(value));
+	}
+
+	int16_t getRaw(const vec3i &pos) const {
+		const size_t brick = brickIndex(pos);
+		if (const Brick *b = bricks[brick].get()) {
+			return b->data[voxelIndex(pos)];
+		}
+		if (isInSource(brick)) {
+			return getSourceRaw(pos);
+		}
+		return uniform[brick];
+	}
+
+	void setRaw(const vec3i &pos, int16_t value) {
+		value = clampToBand(value);
+		const size_t brick = brickIndex(pos);
+		Brick *b = bricks[brick].get();
+		if (!b) {
+			if (!isInSource(brick) && uniform[brick] == value) return;
+			b = allocBrick(brick);
+		}
+		b->data[voxelIndex(pos)] = value;
+	}
+
+	// writes a whole brick, data is brick_voxels values with x changing fastest
+	void setBrick(size_t brick, const int16_t *data);
+
+	// same as trilinearInterpolation in shaders/common.hlsl
+	float sample(const vec3 &pos) const;
+
+	// band width is in voxels, by default it covers the whole range (MAX_STEP)
+	void setBandWidth(float voxels);
+	float getBandWidth() const;
+
+	int16_t clampToBand(int16_t value) const {
+		return math::clamp(value, (int16_t)-band, band);
+	}
+
+	// value of voxels that are fully outside the band, either inside or outside the shape
+	int16_t getBandValue(bool inside) const {
+		return (int16_t)(inside ? -band : band);
+	}
+
+	bool isUniform(size_t brick, int16_t value) const {
+		return !bricks[brick] && !isInSource(brick) && uniform[brick] == value;
+	}
+
+	// the brick hasn't been touched since the volume was loaded from a mapped file
+	bool isInSource(size_t brick) const {
+		return source_data && in_source[brick];
+	}
+
+	// copies every brick still in the mapped file and closes it, e.g. before the file is
+	// overwritten. the uniform bricks are compacted
+	void releaseSource();
+
+	// if every voxel in the brick has the same value, free it and only store that value
+	void compactBrick(size_t brick);
+	void compact();
+
+	size_t getAllocatedBricks() const;
+	size_t getMemoryUsage() const;
+
+	size_t brickIndex(const vec3i &pos) const {
+		const vec3i b = pos / brick_size;
+		return (size_t)b.x + (size_t)b.y * brick_count.x + (size_t)b.z * brick_count.x * brick_count.y;
+	}
+
+	static size_t voxelIndex(const vec3i &pos) {
+		const vec3i v = pos % brick_size;
+		return (size_t)v.x + (size_t)v.y * brick_size + (size_t)v.z * brick_size * brick_size;
+	}
+
+	vec3i size = 0;
+	vec3i brick_count = 0;
+	// indirection grid, nullptr means that the brick is uniform
+	arr<mem::ptr<Brick>> bricks;
+	// value of the uniform bricks, in narrow band mode this is the coarse sign grid
+	arr<int16_t> uniform;
+	// band width as a snorm value
+	int16_t band = 32767;
+
+	// -- only for volumes loaded from a mapped file --
+	fs::MappedFile source;
+	// dense, x changing fastest
+	const int16_t *source_data = nullptr;
+	// per brick, 1 until it's written for the first time
+	arr<uint8_t> in_source;
+
+private:
+	Brick *allocBrick(size_t brick);
+
+	int16_t getSourceRaw(const vec3i &pos) const {
+		return clampToBand(source_data[(size_t)pos.x + (size_t)pos.y * size.x + (size_t)pos.z * size.x * size.y]);
+	}
+};
\ No newline at end of file
@@ -446,15 +446,16 @@ void MenuBar::widget() {
 		ImGui::OpenPopup("New File");
 	}
 
-	const auto &qualityDecision = [](Handle<Texture3D> tex, vec3u &quality, int &cur_level) {
+	const auto &qualityDecision = [](const vec3u &original, vec3u &quality, int &cur_level) {
 		static const char *quality_levels[] = { "Low", "Medium", "High", "Very High", "Maximum", "Original", "Custom" };
-		vec3u quality_sizes[] = { 32, 64, 128, 256, 512, tex->size, 0 };
+		vec3u quality_sizes[] = { 32, 64, 128, 256, 512, original, 0 };
 
 		if (ImGui::Combo("Quality Level", &cur_level, quality_levels, ARRLEN(quality_levels))) {
 			quality = quality_sizes[cur_level];
 		}
 
-		if (sliderUInt3("Size", quality.data, 0, 1024)) {
+		// the sculpture is sparse, so only the parts close to its surface grow with the size
+		if (sliderUInt3("Size", quality.data, 0, 2048)) {
 			quality = vec3u(round(vec3(quality) / 8.f)) * 8;
 			cur_level = ARRLEN(quality_levels) - 1;
 		}
@@ -463,12 +464,12 @@ void MenuBar::widget() {
 	if (ImGui::BeginPopupModal("Save To File", &is_saving, ImGuiWindowFlags_AlwaysAutoResize)) {
 		static int cur_level = 5;
 		static bool once = true;
-		qualityDecision(sculpture->texture, save_quality, cur_level);
+		qualityDecision(vec3u(sculpture->volume.size), save_quality, cur_level);
 
 		// only called once, so we can setup the variables
 		if (once) {
 			once = false;
-			save_quality = sculpture->texture->size;
+			save_quality = vec3u(sculpture->volume.size);
 		}
 
 		if (ImGui::Button("Save")) {
@@ -489,10 +490,10 @@ void MenuBar::widget() {
 		// only called once, so we can setup the variables
 		if (once) {
 			once = false;
-			quality = sculpture->texture->size;
+			quality = vec3u(sculpture->volume.size);
 		}
 
-		qualityDecision(sculpture->texture, quality, cur_level);
+		qualityDecision(vec3u(sculpture->volume.size), quality, cur_level);
 
 		ImGui::Combo("Initial Shape", (int *)&cur_shape, "Sphere\0Box\0Cylinder");
 
@@ -512,10 +513,9 @@ void MenuBar::widget() {
 		}
 
 		if (ImGui::Button("New")) {
-			if (all(quality != sculpture->texture->size)) {
-				sculpture->texture->init(quality, sculpture->texture->getType());
+			if (!sculpture->fill(cur_shape, shader_data, vec3i(quality))) {
+				widgets::addMessage(LogLevel::Error, "Failed to create the new sculpture!");
 			}
-			brush_editor->runFillShader(cur_shape, shader_data, sculpture->texture);
 			
 			ImGui::CloseCurrentPopup();
 		}
@@ -551,7 +551,7 @@ void MenuBar::saveWidget() {
 		nfdu8filteritem_t filter[] = { { "Tex3D", "bin" } };
 		nfdresult_t result = NFD::OpenDialog(path, filter, ARRLEN(filter));
 		if (result == NFD_OKAY) {
-			sculpture->texture->loadFromFile(path.get());
+			sculpture->load(path.get());
 			return;
 		}
 		else if (result == NFD_CANCEL) {